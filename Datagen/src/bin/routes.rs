@@ -0,0 +1,257 @@
+extern crate datagen;
+extern crate pcap_file;
+extern crate rand;
+extern crate structopt;
+
+use datagen::routes::*;
+use pcap_file::*;
+use rand::rngs::StdRng;
+use rand::{Rng, SeedableRng};
+use std::collections::BTreeMap;
+use std::fs::File;
+use std::io::BufWriter;
+use std::io::Write;
+use structopt::StructOpt;
+
+const RIP_ENTRIES: usize = 25;
+const RIP_PORT: u16 = 520;
+
+#[derive(StructOpt, Debug)]
+struct Opt {
+    /// file names are lookup_{input,output}${index}.{in,out},
+    /// rip_input${index}.pcap and traffic_input${index}.pcap
+    #[structopt(name = "index")]
+    index: String,
+
+    /// number of routes
+    #[structopt(name = "routes")]
+    routes: usize,
+
+    /// number of queries, the number of routes by default
+    #[structopt(long = "queries")]
+    queries: Option<usize>,
+
+    /// number of deletes and re-inserts between the queries
+    #[structopt(long = "updates", default_value = "0")]
+    updates: usize,
+
+    /// prefix length distribution, bgp or igp
+    #[structopt(long = "profile", default_value = "bgp")]
+    profile: String,
+
+    /// chance that a prefix is a more specific of an earlier one
+    #[structopt(long = "nested", default_value = "0.3")]
+    nested: f64,
+
+    /// exponent of the Zipf distribution of destinations over routes
+    #[structopt(long = "zipf", default_value = "1.0")]
+    zipf: f64,
+
+    /// share of destinations that no route covers
+    #[structopt(long = "miss", default_value = "0.05")]
+    miss: f64,
+
+    /// nexthops are 10.0.if.2 and up on these interfaces
+    #[structopt(long = "interfaces", default_value = "4")]
+    interfaces: u32,
+
+    /// number of nexthops on each interface
+    #[structopt(long = "neighbors", default_value = "1")]
+    neighbors: u32,
+
+    /// also write the routes as RIP responses from the nexthops
+    #[structopt(long = "rip")]
+    rip: bool,
+
+    /// also write this many packets to forward, destinations as the queries
+    #[structopt(long = "traffic", default_value = "0")]
+    traffic: usize,
+
+    /// IP length of the packets to forward
+    #[structopt(long = "length", default_value = "64")]
+    length: usize,
+
+    /// random seed, different every time by default
+    #[structopt(long = "seed")]
+    seed: Option<u64>,
+}
+
+/// lookup traces store addresses big endian and print them as a number
+fn trace(addr: u32) -> u32 {
+    addr.swap_bytes()
+}
+
+fn pcap_writer(path: String) -> PcapWriter<File> {
+    let file = File::create(path).unwrap();
+    let mut header = PcapHeader::with_datalink(DataLink::ETHERNET);
+    header.snaplen = 0x40000;
+    PcapWriter::with_header(header, file).unwrap()
+}
+
+/// destinations as queries and traffic ask for them: popular routes first
+fn pick<R: Rng>(rng: &mut R, opt: &Opt, routes: &[Route], popular: &[usize], zipf: &Zipf) -> u32 {
+    if rng.gen::<f64>() < opt.miss {
+        unrouted(rng)
+    } else {
+        let rank = zipf.sample(rng);
+        destination(rng, &routes[popular[rank]])
+    }
+}
+
+fn shuffle<R: Rng, T>(rng: &mut R, items: &mut [T]) {
+    for i in (1..items.len()).rev() {
+        items.swap(i, rng.gen_range(0, i + 1));
+    }
+}
+
+fn main() {
+    let opt = Opt::from_args();
+    println!("options: {:?}", opt);
+    let lengths = lengths(&opt.profile).expect("profile is bgp or igp");
+    assert!(opt.routes > 0, "at least one route");
+    let mut rng = match opt.seed {
+        Some(seed) => StdRng::seed_from_u64(seed),
+        None => StdRng::from_rng(rand::thread_rng()).unwrap(),
+    };
+
+    let mut routes = generate(
+        &mut rng,
+        opt.routes,
+        &lengths,
+        opt.interfaces,
+        opt.neighbors.max(1),
+        opt.nested,
+    );
+    // inserted in no particular order, popularity unrelated to either
+    shuffle(&mut rng, &mut routes);
+    let mut popular: Vec<usize> = (0..routes.len()).collect();
+    shuffle(&mut rng, &mut popular);
+    let zipf = Zipf::new(routes.len(), opt.zipf);
+
+    // lookup trace and its answers
+    let file = File::create(format!("lookup_input{}.in", opt.index)).unwrap();
+    let ans_file = File::create(format!("lookup_output{}.out", opt.index)).unwrap();
+    let mut writer = BufWriter::with_capacity(1 << 20, file);
+    let mut ans_writer = BufWriter::with_capacity(1 << 20, ans_file);
+    let mut table = Table::new();
+    for route in &routes {
+        write!(
+            writer,
+            "I,0x{:08x},{},{},0x{:08x}\n",
+            trace(route.addr),
+            route.len,
+            route.if_index,
+            trace(route.nexthop)
+        )
+        .expect("write");
+        table.insert(route);
+    }
+    let queries = opt.queries.unwrap_or(opt.routes);
+    let mut live: Vec<usize> = (0..routes.len()).collect();
+    let mut deleted: Vec<usize> = Vec::new();
+    let mut updates = opt.updates;
+    let mut remaining = queries + updates;
+    while remaining > 0 {
+        if updates > 0 && rng.gen_range(0, remaining) < updates {
+            if !deleted.is_empty() && (live.is_empty() || rng.gen()) {
+                let index = deleted.swap_remove(rng.gen_range(0, deleted.len()));
+                let route = &routes[index];
+                write!(
+                    writer,
+                    "I,0x{:08x},{},{},0x{:08x}\n",
+                    trace(route.addr),
+                    route.len,
+                    route.if_index,
+                    trace(route.nexthop)
+                )
+                .expect("write");
+                table.insert(route);
+                live.push(index);
+            } else if !live.is_empty() {
+                let index = live.swap_remove(rng.gen_range(0, live.len()));
+                let route = &routes[index];
+                write!(writer, "D,0x{:08x},{}\n", trace(route.addr), route.len).expect("write");
+                table.remove(route.addr, route.len);
+                deleted.push(index);
+            }
+            updates -= 1;
+        } else {
+            let addr = pick(&mut rng, &opt, &routes, &popular, &zipf);
+            write!(writer, "Q,0x{:08x}\n", trace(addr)).expect("write");
+            match table.lookup(addr) {
+                Some((if_index, nexthop)) => {
+                    write!(ans_writer, "0x{:08x} {}\n", trace(nexthop), if_index).expect("write")
+                }
+                None => write!(ans_writer, "Not Found\n").expect("write"),
+            }
+        }
+        remaining -= 1;
+    }
+
+    if opt.rip {
+        // one neighbor after another, 25 routes per response
+        let mut by_neighbor: BTreeMap<(u32, u32), Vec<&Route>> = BTreeMap::new();
+        for route in &routes {
+            by_neighbor
+                .entry((route.if_index, route.nexthop))
+                .or_insert_with(Vec::new)
+                .push(route);
+        }
+        let mut writer = pcap_writer(format!("rip_input{}.pcap", opt.index));
+        let mut i = 0;
+        for (&(if_index, nexthop), routes) in &by_neighbor {
+            for chunk in routes.chunks(RIP_ENTRIES) {
+                // response, version 2
+                let mut rip = vec![2, 2, 0, 0];
+                for route in chunk {
+                    rip.extend_from_slice(&[0, 2, 0, 0]);
+                    rip.extend_from_slice(&route.addr.to_be_bytes());
+                    rip.extend_from_slice(&mask(route.len).to_be_bytes());
+                    rip.extend_from_slice(&[0, 0, 0, 0]);
+                    let metric: u32 = rng.gen_range(1, 16);
+                    rip.extend_from_slice(&metric.to_be_bytes());
+                }
+                let ip = datagen::udp_packet(nexthop, 0xe000_0009, 1, RIP_PORT, RIP_PORT, &rip);
+                let src_mac = [2, 0, 0, 0, if_index as u8, nexthop as u8];
+                let frame = datagen::ethernet_frame(
+                    [0x01, 0x00, 0x5e, 0x00, 0x00, 0x09],
+                    src_mac,
+                    if_index,
+                    &ip,
+                );
+                writer
+                    .write_packet(&Packet::new_owned(
+                        (i / 1000000) as u32,
+                        (i % 1000000) as u32,
+                        frame.len() as u32,
+                        frame,
+                    ))
+                    .unwrap();
+                i += 1;
+            }
+        }
+    }
+
+    if opt.traffic > 0 {
+        let mut writer = pcap_writer(format!("traffic_input{}.pcap", opt.index));
+        let payload = vec![0u8; opt.length.max(28) - 28];
+        for i in 0..opt.traffic {
+            let if_index = rng.gen_range(0, opt.interfaces);
+            let host = rng.gen_range(100, 200);
+            let src = (10 << 24) | (if_index << 8) | host;
+            let dst = pick(&mut rng, &opt, &routes, &popular, &zipf);
+            let ip = datagen::udp_packet(src, dst, 64, rng.gen_range(1024, 65535), 9, &payload);
+            let dst_mac = [2, 3, 3, 0, 0, if_index as u8];
+            let src_mac = [2, 0, 0, 0, if_index as u8, host as u8];
+            let frame = datagen::ethernet_frame(dst_mac, src_mac, if_index, &ip);
+            writer
+                .write_packet(&Packet::new_owned(
+                    (i / 1000000) as u32,
+                    (i % 1000000) as u32,
+                    frame.len() as u32,
+                    frame,
+                ))
+                .unwrap();
+        }
+    }
+}
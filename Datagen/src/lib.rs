@@ -1,3 +1,5 @@
+pub mod routes;
+
 pub fn parse_string(input: &str) -> Vec<u8> {
     let mut cur = 0;
     let mut index = 0;
@@ -45,3 +47,55 @@ pub fn update_ip_checksum(mut data: Vec<u8>) -> Vec<u8> {
 
     data
 }
+
+/// Checksum of an IPv4 header, the checksum field itself included
+pub fn ip_checksum(header: &[u8]) -> u16 {
+    let mut checksum = 0u32;
+    for i in 0..header.len() / 2 {
+        checksum += ((header[i * 2] as u32) << 8) | (header[i * 2 + 1] as u32);
+    }
+    while checksum >= 0x10000 {
+        checksum = (checksum & 0xffff) + (checksum >> 16);
+    }
+    !(checksum as u16)
+}
+
+/// IPv4 packet carrying UDP, addresses in host byte order, no UDP checksum
+pub fn udp_packet(src: u32, dst: u32, ttl: u8, sport: u16, dport: u16, payload: &[u8]) -> Vec<u8> {
+    let length = 20 + 8 + payload.len();
+    let mut data = vec![
+        0x45,
+        0x00,
+        (length >> 8) as u8,
+        length as u8,
+        0,
+        0,
+        0,
+        0,
+        ttl,
+        17,
+        0,
+        0,
+    ];
+    data.extend_from_slice(&src.to_be_bytes());
+    data.extend_from_slice(&dst.to_be_bytes());
+    let checksum = ip_checksum(&data);
+    data[10] = (checksum >> 8) as u8;
+    data[11] = checksum as u8;
+    let udp_length = 8 + payload.len();
+    data.extend_from_slice(&sport.to_be_bytes());
+    data.extend_from_slice(&dport.to_be_bytes());
+    data.extend_from_slice(&[(udp_length >> 8) as u8, udp_length as u8, 0, 0]);
+    data.extend_from_slice(payload);
+    data
+}
+
+/// Ethernet frame with the 802.1Q tag that tells the stdio HAL the interface
+pub fn ethernet_frame(dst: [u8; 6], src: [u8; 6], if_index: u32, ip: &[u8]) -> Vec<u8> {
+    let mut data = Vec::with_capacity(18 + ip.len());
+    data.extend_from_slice(&dst);
+    data.extend_from_slice(&src);
+    data.extend_from_slice(&[0x81, 0x00, 0x00, if_index as u8, 0x08, 0x00]);
+    data.extend_from_slice(ip);
+    data
+}
@@ -0,0 +1,169 @@
+use rand::Rng;
+use std::collections::{HashMap, HashSet};
+
+/// A route, addresses in host byte order
+#[derive(Clone, Copy, Debug, PartialEq, Eq, Hash)]
+pub struct Route {
+    pub addr: u32,
+    pub len: u8,
+    pub if_index: u32,
+    pub nexthop: u32,
+}
+
+/// `<profile> <length> <weight>` lines, shared with Homework/perf.py
+const LENGTHS: &str = include_str!("../prefix_lengths.txt");
+
+/// (prefix length, weight) of a profile, bgp or igp
+pub fn lengths(profile: &str) -> Option<Vec<(u8, u32)>> {
+    let mut lengths = Vec::new();
+    for line in LENGTHS.lines() {
+        let fields: Vec<&str> = line.split_whitespace().collect();
+        if fields.len() == 3 && fields[0] == profile {
+            lengths.push((fields[1].parse().unwrap(), fields[2].parse().unwrap()));
+        }
+    }
+    if lengths.is_empty() {
+        None
+    } else {
+        Some(lengths)
+    }
+}
+
+pub fn mask(len: u8) -> u32 {
+    if len == 0 {
+        0
+    } else {
+        !0u32 << (32 - len)
+    }
+}
+
+/// 0/8, 10/8 (the interfaces), 127/8, 240/4 and multicast are never routed
+fn usable(addr: u32) -> bool {
+    let first = addr >> 24;
+    first != 0 && first != 10 && first != 127 && first < 224
+}
+
+/// An address no generated route covers
+pub fn unrouted<R: Rng>(rng: &mut R) -> u32 {
+    0xf000_0000 | (rng.gen::<u32>() & 0x0fff_ffff)
+}
+
+/// A random address inside the route
+pub fn destination<R: Rng>(rng: &mut R, route: &Route) -> u32 {
+    route.addr | (rng.gen::<u32>() & !mask(route.len))
+}
+
+/// Distinct prefixes with lengths drawn from the weights. With probability
+/// `nested` a prefix is a more specific of an earlier one, as aggregates and
+/// their deaggregated parts are in real tables. Nexthops are 10.0.if.x, x
+/// from 2 on, one of `neighbors` per interface.
+pub fn generate<R: Rng>(
+    rng: &mut R,
+    count: usize,
+    lengths: &[(u8, u32)],
+    interfaces: u32,
+    neighbors: u32,
+    nested: f64,
+) -> Vec<Route> {
+    let total: u32 = lengths.iter().map(|&(_, weight)| weight).sum();
+    let mut seen = HashSet::new();
+    let mut routes: Vec<Route> = Vec::with_capacity(count);
+    while routes.len() < count {
+        let mut pick = rng.gen_range(0, total);
+        let mut len = lengths[lengths.len() - 1].0;
+        for &(l, weight) in lengths {
+            if pick < weight {
+                len = l;
+                break;
+            }
+            pick -= weight;
+        }
+
+        let mut addr = None;
+        if !routes.is_empty() && rng.gen::<f64>() < nested {
+            for _ in 0..8 {
+                let outer = routes[rng.gen_range(0, routes.len())];
+                if outer.len < len {
+                    addr = Some(destination(rng, &outer) & mask(len));
+                    break;
+                }
+            }
+        }
+        let addr = match addr {
+            Some(addr) => addr,
+            None => rng.gen::<u32>() & mask(len),
+        };
+        if !usable(addr) || !seen.insert((addr, len)) {
+            // short lengths run out quickly, then the weights decide again
+            continue;
+        }
+
+        let if_index = rng.gen_range(0, interfaces);
+        let host = 2 + rng.gen_range(0, neighbors);
+        routes.push(Route {
+            addr,
+            len,
+            if_index,
+            nexthop: (10 << 24) | (if_index << 8) | host,
+        });
+    }
+    routes
+}
+
+/// Ranks 0..n with probability proportional to 1 / (rank + 1)^s
+pub struct Zipf {
+    cdf: Vec<f64>,
+}
+
+impl Zipf {
+    pub fn new(n: usize, s: f64) -> Zipf {
+        let mut cdf = Vec::with_capacity(n);
+        let mut sum = 0.0;
+        for rank in 0..n {
+            sum += 1.0 / ((rank + 1) as f64).powf(s);
+            cdf.push(sum);
+        }
+        Zipf { cdf }
+    }
+
+    pub fn sample<R: Rng>(&self, rng: &mut R) -> usize {
+        let total = self.cdf[self.cdf.len() - 1];
+        let u = rng.gen::<f64>() * total;
+        let rank = match self.cdf.binary_search_by(|x| x.partial_cmp(&u).unwrap()) {
+            Ok(rank) => rank,
+            Err(rank) => rank,
+        };
+        rank.min(self.cdf.len() - 1)
+    }
+}
+
+/// Longest prefix match as the lookup homework defines it, for the answers
+pub struct Table {
+    by_len: Vec<HashMap<u32, (u32, u32)>>,
+}
+
+impl Table {
+    pub fn new() -> Table {
+        Table {
+            by_len: (0..33).map(|_| HashMap::new()).collect(),
+        }
+    }
+
+    pub fn insert(&mut self, route: &Route) {
+        self.by_len[route.len as usize].insert(route.addr, (route.if_index, route.nexthop));
+    }
+
+    pub fn remove(&mut self, addr: u32, len: u8) {
+        self.by_len[len as usize].remove(&addr);
+    }
+
+    /// (if_index, nexthop)
+    pub fn lookup(&self, addr: u32) -> Option<(u32, u32)> {
+        for len in (0..33).rev() {
+            if let Some(&found) = self.by_len[len].get(&(addr & mask(len as u8))) {
+                return Some(found);
+            }
+        }
+        None
+    }
+}
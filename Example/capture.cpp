@@ -1,13 +1,59 @@
+#include "pcap_reader.h"
 #include "router_hal.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-void printMAC(macaddr_t mac) {
+void printMAC(const uint8_t *mac) {
   printf("%02X:%02X:%02X:%02X:%02X:%02X", mac[0], mac[1], mac[2], mac[3],
          mac[4], mac[5]);
 }
 
+// same output as printf("%02X ") per byte, but formatted in chunks
+void printData(const uint8_t *data, size_t length) {
+  static const char digits[] = "0123456789ABCDEF";
+  char line[3 * 512];
+  while (length > 0) {
+    size_t chunk = length > 512 ? 512 : length;
+    for (size_t i = 0; i < chunk; i++) {
+      line[3 * i] = digits[data[i] >> 4];
+      line[3 * i + 1] = digits[data[i] & 0xf];
+      line[3 * i + 2] = ' ';
+    }
+    fwrite(line, 3, chunk, stdout);
+    data += chunk;
+    length -= chunk;
+  }
+}
+
+// dump every frame of a capture file without going through the HAL
+int dumpFile(const char *path) {
+  PcapReader reader;
+  if (!reader.open(path)) {
+    fprintf(stderr, "Cannot read capture %s\n", path);
+    return 1;
+  }
+  // output is usually redirected to a file, avoid a write per line
+  setvbuf(stdout, NULL, _IOFBF, 1 << 20);
+  PcapFrame frame;
+  uint64_t count = 0;
+  while (reader.next(&frame)) {
+    printf("Frame %llu of length %u", (unsigned long long)count++,
+           frame.caplen);
+    if (frame.caplen >= 12) {
+      printf("\nSrc MAC: ");
+      printMAC(&frame.data[6]);
+      printf(" Dst MAC: ");
+      printMAC(&frame.data[0]);
+    }
+    printf("\nData: ");
+    printData(frame.data, frame.caplen);
+    printf("\n");
+  }
+  fprintf(stderr, "%llu frames\n", (unsigned long long)count);
+  return 0;
+}
+
 uint8_t packet[2048];
 bool cont = false;
 
@@ -15,7 +61,11 @@ bool cont = false;
 in_addr_t addrs[N_IFACE_ON_BOARD] = {0x0100000a, 0x0101000a, 0x0102000a,
                                      0x0103000a};
 
-int main() {
+int main(int argc, char *argv[]) {
+  if (argc > 1) {
+    return dumpFile(argv[1]);
+  }
+
   fprintf(stderr, "HAL init: %d\n", HAL_Init(1, addrs));
   for (int i = 0; i < N_IFACE_ON_BOARD; i++) {
     macaddr_t mac;
@@ -38,9 +88,7 @@ int main() {
       printf(" Dst MAC: ");
       printMAC(dst_mac);
       printf("\nData: ");
-      for (int i = 0; i < res; i++) {
-        printf("%02X ", packet[i]);
-      }
+      printData(packet, res);
       printf("\n");
     } else if (res == 0) {
       fprintf(stderr, "Timeout\n");
@@ -0,0 +1,343 @@
+#ifndef __PCAP_READER_H__
+#define __PCAP_READER_H__
+
+// memory mapped reader for pcap and pcapng files
+//
+// the whole capture is mapped at once and every frame is returned as a view
+// into the mapping, so opening a large capture costs nothing and replaying it
+// copies no data. stdin works too: a redirected file is mapped like any other
+// file, a pipe is read as the frames are asked for, so a live capture such as
+// `tcpdump -w - | ...` is replayed while it is being written.
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+struct PcapFrame {
+  // points into the mapping, valid until close(); read from a pipe, valid
+  // until the next call to next()
+  const uint8_t *data;
+  uint32_t caplen;     // bytes available at data
+  uint32_t len;        // length of the frame on the wire
+  uint64_t ts_nsec;    // timestamp in nanoseconds
+  uint32_t if_id;      // pcapng interface id, 0 for pcap
+};
+
+class PcapReader {
+public:
+  PcapReader()
+      : base(NULL), size(0), offset(0), mapped(false), stream_fd(-1),
+        capacity(0), swapped(false), pcapng(false), nsec(false),
+        link_type(0) {}
+  ~PcapReader() { close(); }
+
+  // path "-" reads stdin
+  bool open(const char *path) {
+    if (strcmp(path, "-") == 0) {
+      return openFd(STDIN_FILENO);
+    }
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0) {
+      return false;
+    }
+    bool res = openFd(fd);
+    ::close(fd);
+    return res;
+  }
+
+  bool openFd(int fd) {
+    close();
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+      return false;
+    }
+    if (S_ISREG(st.st_mode)) {
+      off_t start = lseek(fd, 0, SEEK_CUR);
+      if (start < 0) {
+        start = 0;
+      }
+      if (st.st_size == 0) {
+        return false;
+      }
+      void *addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (addr == MAP_FAILED) {
+        return false;
+      }
+      madvise(addr, st.st_size, MADV_SEQUENTIAL);
+      base = (const uint8_t *)addr;
+      size = st.st_size;
+      offset = start;
+      mapped = true;
+    } else {
+      // pipes can not be mapped, read them bit by bit in ensure()
+      stream_fd = dup(fd);
+      if (stream_fd < 0) {
+        return false;
+      }
+      capacity = 1 << 20;
+      base = (const uint8_t *)malloc(capacity);
+      if (base == NULL) {
+        ::close(stream_fd);
+        stream_fd = -1;
+        return false;
+      }
+      size = 0;
+      offset = 0;
+      mapped = false;
+    }
+    return readHeader();
+  }
+
+  void close() {
+    if (base) {
+      if (mapped) {
+        munmap((void *)base, size);
+      } else {
+        free((void *)base);
+      }
+    }
+    if (stream_fd >= 0) {
+      ::close(stream_fd);
+    }
+    stream_fd = -1;
+    base = NULL;
+    size = offset = capacity = 0;
+    if_units.clear();
+  }
+
+  // returns false at the end of the capture or on malformed data
+  bool next(PcapFrame *frame) {
+    if (base == NULL) {
+      return false;
+    }
+    return pcapng ? nextBlock(frame) : nextRecord(frame);
+  }
+
+  uint32_t linkType() const { return link_type; }
+
+private:
+  const uint8_t *base;
+  size_t size;
+  size_t offset;
+  bool mapped;
+  // a pipe being read; base then holds capacity bytes, of which size are read
+  int stream_fd;
+  size_t capacity;
+  bool swapped;
+  bool pcapng;
+  bool nsec;
+  uint32_t link_type;
+  // pcapng: timestamp units per second of each interface
+  std::vector<uint64_t> if_units;
+
+  uint16_t read16(size_t pos) const {
+    uint16_t value;
+    memcpy(&value, base + pos, sizeof(value));
+    return swapped ? __builtin_bswap16(value) : value;
+  }
+
+  uint32_t read32(size_t pos) const {
+    uint32_t value;
+    memcpy(&value, base + pos, sizeof(value));
+    return swapped ? __builtin_bswap32(value) : value;
+  }
+
+  // makes n bytes from offset on available; a pipe is read until they are,
+  // after moving what is left to the front of the buffer
+  bool ensure(size_t n) {
+    if (size - offset >= n) {
+      return true;
+    }
+    if (stream_fd < 0) {
+      return false;
+    }
+    uint8_t *buffer = (uint8_t *)base;
+    memmove(buffer, buffer + offset, size - offset);
+    size -= offset;
+    offset = 0;
+    if (n > capacity) {
+      uint8_t *grown = (uint8_t *)realloc(buffer, n);
+      if (grown == NULL) {
+        return false;
+      }
+      base = buffer = grown;
+      capacity = n;
+    }
+    while (size < n) {
+      ssize_t res = read(stream_fd, buffer + size, capacity - size);
+      if (res == 0) {
+        return false;
+      }
+      if (res < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        return false;
+      }
+      size += res;
+    }
+    return true;
+  }
+
+  bool readHeader() {
+    if (!ensure(24)) {
+      return false;
+    }
+    uint32_t magic;
+    memcpy(&magic, base + offset, sizeof(magic));
+    switch (magic) {
+    case 0xa1b2c3d4:
+    case 0xa1b23c4d:
+      swapped = false;
+      break;
+    case 0xd4c3b2a1:
+    case 0x4d3cb2a1:
+      swapped = true;
+      break;
+    case 0x0a0d0d0a:
+      // pcapng: the byte order magic follows the block length
+      pcapng = true;
+      memcpy(&magic, base + offset + 8, sizeof(magic));
+      if (magic == 0x1a2b3c4d) {
+        swapped = false;
+      } else if (magic == 0x4d3c2b1a) {
+        swapped = true;
+      } else {
+        return false;
+      }
+      return true;
+    default:
+      return false;
+    }
+    pcapng = false;
+    nsec = magic == 0xa1b23c4d || magic == 0x4d3cb2a1;
+    link_type = read32(offset + 20);
+    offset += 24;
+    return true;
+  }
+
+  bool nextRecord(PcapFrame *frame) {
+    if (!ensure(16)) {
+      return false;
+    }
+    uint32_t ts_sec = read32(offset);
+    uint32_t ts_frac = read32(offset + 4);
+    uint32_t caplen = read32(offset + 8);
+    uint32_t len = read32(offset + 12);
+    if (!ensure(16 + (size_t)caplen)) {
+      // truncated capture
+      return false;
+    }
+    frame->data = base + offset + 16;
+    frame->caplen = caplen;
+    frame->len = len;
+    frame->ts_nsec =
+        (uint64_t)ts_sec * 1000000000 + (nsec ? ts_frac : ts_frac * 1000ull);
+    frame->if_id = 0;
+    offset += 16 + caplen;
+    return true;
+  }
+
+  uint64_t toNsec(uint64_t ts, uint32_t if_id) const {
+    uint64_t units = if_id < if_units.size() ? if_units[if_id] : 1000000;
+    return ts / units * 1000000000 + ts % units * 1000000000 / units;
+  }
+
+  // interface description block: remember link type and timestamp unit
+  void readInterface(size_t body, size_t body_end) {
+    if (if_units.empty()) {
+      link_type = read16(body);
+    }
+    uint64_t units = 1000000;
+    // options
+    size_t pos = body + 8;
+    while (pos + 4 <= body_end) {
+      uint16_t code = read16(pos);
+      uint16_t length = read16(pos + 2);
+      if (code == 0 || pos + 4 + length > body_end) {
+        break;
+      }
+      if (code == 9 && length >= 1) {
+        // if_tsresol
+        uint8_t resol = base[pos + 4];
+        units = 1;
+        for (int i = 0; i < (resol & 0x7f); i++) {
+          units *= (resol & 0x80) ? 2 : 10;
+        }
+      }
+      pos += 4 + ((length + 3) & ~3);
+    }
+    if_units.push_back(units);
+  }
+
+  bool nextBlock(PcapFrame *frame) {
+    while (ensure(12)) {
+      uint32_t type = read32(offset);
+      if (type == 0x0a0d0d0a) {
+        // a new section may switch byte order
+        uint32_t magic;
+        memcpy(&magic, base + offset + 8, sizeof(magic));
+        swapped = magic == 0x4d3c2b1a;
+        if_units.clear();
+      }
+      uint32_t length = read32(offset + 4);
+      if (length < 12 || length % 4 != 0 || !ensure(length)) {
+        return false;
+      }
+      size_t body = offset + 8;
+      size_t body_end = offset + length - 4;
+      offset += length;
+
+      if (type == 1 && body_end >= body + 8) {
+        readInterface(body, body_end);
+      } else if (type == 6 && body_end >= body + 20) {
+        // enhanced packet block
+        uint32_t if_id = read32(body);
+        uint64_t ts = ((uint64_t)read32(body + 4) << 32) | read32(body + 8);
+        uint32_t caplen = read32(body + 12);
+        if (body_end - body - 20 < caplen) {
+          return false;
+        }
+        frame->data = base + body + 20;
+        frame->caplen = caplen;
+        frame->len = read32(body + 16);
+        frame->ts_nsec = toNsec(ts, if_id);
+        frame->if_id = if_id;
+        return true;
+      } else if (type == 3 && body_end >= body + 4) {
+        // simple packet block
+        uint32_t len = read32(body);
+        uint32_t caplen = body_end - body - 4;
+        frame->data = base + body + 4;
+        frame->caplen = len < caplen ? len : caplen;
+        frame->len = len;
+        frame->ts_nsec = 0;
+        frame->if_id = 0;
+        return true;
+      } else if (type == 2 && body_end >= body + 20) {
+        // obsolete packet block
+        uint32_t if_id = read16(body);
+        uint64_t ts = ((uint64_t)read32(body + 4) << 32) | read32(body + 8);
+        uint32_t caplen = read32(body + 12);
+        if (body_end - body - 20 < caplen) {
+          return false;
+        }
+        frame->data = base + body + 20;
+        frame->caplen = caplen;
+        frame->len = read32(body + 16);
+        frame->ts_nsec = toNsec(ts, if_id);
+        frame->if_id = if_id;
+        return true;
+      }
+      // other blocks are skipped
+    }
+    return false;
+  }
+};
+
+#endif
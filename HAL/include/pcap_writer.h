@@ -0,0 +1,185 @@
+#ifndef __PCAP_WRITER_H__
+#define __PCAP_WRITER_H__
+
+// buffered pcap writer
+//
+// frames are assembled directly in one of two large buffers. when the active
+// buffer fills up it is handed to a writer thread, which writes it out in one
+// go while the other buffer keeps filling, so a frame costs a memcpy instead
+// of a stdio call. nothing reaches the file before flush() or close(), and
+// output written to the same fd by other means is not ordered with it.
+#include <condition_variable>
+#include <errno.h>
+#include <mutex>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <time.h>
+#include <unistd.h>
+
+class PcapWriter {
+public:
+  PcapWriter()
+      : fd(-1), link_type(0), snaplen(0), buffer_size(0), active(0), used(0),
+        pending(NULL), pending_length(0), header_written(false),
+        stopping(false) {
+    buffers[0] = buffers[1] = NULL;
+  }
+  ~PcapWriter() { close(); }
+
+  // buffer_size must hold at least one record of snaplen bytes
+  bool open(int out_fd, uint32_t out_link_type = 1 /* DLT_EN10MB */,
+            uint32_t out_snaplen = 0x40000, size_t out_buffer_size = 4 << 20) {
+    if (fd >= 0 || out_buffer_size < 16 + out_snaplen) {
+      return false;
+    }
+    buffers[0] = (uint8_t *)malloc(out_buffer_size);
+    buffers[1] = (uint8_t *)malloc(out_buffer_size);
+    if (buffers[0] == NULL || buffers[1] == NULL) {
+      free(buffers[0]);
+      free(buffers[1]);
+      buffers[0] = buffers[1] = NULL;
+      return false;
+    }
+    fd = out_fd;
+    link_type = out_link_type;
+    snaplen = out_snaplen;
+    buffer_size = out_buffer_size;
+    active = 0;
+    used = 0;
+    header_written = false;
+    stopping = false;
+    thread = std::thread(&PcapWriter::writer, this);
+    return true;
+  }
+
+  bool isOpen() const { return fd >= 0; }
+
+  // room for a frame of caplen bytes, valid until the next call
+  uint8_t *reserve(uint32_t caplen) {
+    if (fd < 0 || caplen > snaplen) {
+      return NULL;
+    }
+    if (!header_written) {
+      // the file header only appears once something is written
+      // host byte order, version 2.4
+      uint32_t magic = 0xa1b2c3d4;
+      uint16_t version[2] = {2, 4};
+      uint32_t rest[4] = {0, 0, snaplen, link_type};
+      memcpy(buffers[active], &magic, 4);
+      memcpy(buffers[active] + 4, version, 4);
+      memcpy(buffers[active] + 8, rest, 16);
+      used = 24;
+      header_written = true;
+    }
+    if (used + 16 + caplen > buffer_size) {
+      handOff();
+    }
+    struct timespec tp = {0};
+    clock_gettime(CLOCK_MONOTONIC, &tp);
+    uint32_t record[4] = {(uint32_t)tp.tv_sec, (uint32_t)(tp.tv_nsec / 1000),
+                          caplen, caplen};
+    uint8_t *res = buffers[active] + used;
+    memcpy(res, record, sizeof(record));
+    used += 16 + caplen;
+    return res + 16;
+  }
+
+  bool write(const uint8_t *frame, uint32_t caplen) {
+    uint8_t *res = reserve(caplen);
+    if (res == NULL) {
+      return false;
+    }
+    memcpy(res, frame, caplen);
+    return true;
+  }
+
+  // write out everything buffered so far and wait for it
+  void flush() {
+    if (fd < 0) {
+      return;
+    }
+    if (used > 0) {
+      handOff();
+    }
+    std::unique_lock<std::mutex> lock(mutex);
+    cond.wait(lock, [this] { return pending == NULL; });
+  }
+
+  void close() {
+    if (fd < 0) {
+      return;
+    }
+    flush();
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    cond.notify_all();
+    thread.join();
+    free(buffers[0]);
+    free(buffers[1]);
+    buffers[0] = buffers[1] = NULL;
+    fd = -1;
+  }
+
+private:
+  int fd;
+  uint32_t link_type;
+  uint32_t snaplen;
+  size_t buffer_size;
+  uint8_t *buffers[2];
+  int active;
+  size_t used;
+  // handed to the writer thread, NULL when it is idle
+  uint8_t *pending;
+  size_t pending_length;
+  bool header_written;
+  bool stopping;
+  std::mutex mutex;
+  std::condition_variable cond;
+  std::thread thread;
+
+  // give the active buffer to the writer and continue in the other one
+  void handOff() {
+    std::unique_lock<std::mutex> lock(mutex);
+    cond.wait(lock, [this] { return pending == NULL; });
+    pending = buffers[active];
+    pending_length = used;
+    lock.unlock();
+    cond.notify_all();
+    active ^= 1;
+    used = 0;
+  }
+
+  void writer() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (1) {
+      cond.wait(lock, [this] { return pending != NULL || stopping; });
+      if (pending == NULL) {
+        break;
+      }
+      const uint8_t *data = pending;
+      size_t length = pending_length;
+      lock.unlock();
+      while (length > 0) {
+        ssize_t res = ::write(fd, data, length);
+        if (res < 0) {
+          if (errno == EINTR) {
+            continue;
+          }
+          // nowhere to report it, drop the rest of this buffer
+          break;
+        }
+        data += res;
+        length -= res;
+      }
+      lock.lock();
+      pending = NULL;
+      cond.notify_all();
+    }
+  }
+};
+
+#endif
@@ -9,6 +9,10 @@
 #include <arpa/inet.h>
 #elif defined ROUTER_BACKEND_STDIO
 #include <arpa/inet.h>
+#elif defined ROUTER_BACKEND_BENCH
+#include <arpa/inet.h>
+#elif defined ROUTER_BACKEND_SIM
+#include <arpa/inet.h>
 #elif defined ROUTER_BACKEND_XILINX
 typedef uint32_t in_addr_t;
 #endif
@@ -17,6 +21,26 @@ typedef uint32_t in_addr_t;
 #define N_IFACE_ON_BOARD 4
 typedef uint8_t macaddr_t[6];
 
+// IPv6 地址，16 个字节按网络字节序存储，即 2001:db8::1 的 addr[0] 是 0x20
+typedef struct {
+  uint8_t addr[16];
+} in6_addr_t;
+
+// ARP 表中的一个邻居，见 HAL_ArpGetEntries
+typedef struct {
+  in_addr_t ip;
+  int32_t if_index;
+  macaddr_t mac;
+} arpentry_t;
+
+// sim 后端在一个进程里用多个线程模拟多台路由器，
+// 路由器自己的全局变量需要声明成 ROUTER_LOCAL，使每台路由器各有一份
+#ifdef ROUTER_BACKEND_SIM
+#define ROUTER_LOCAL thread_local
+#else
+#define ROUTER_LOCAL
+#endif
+
 enum HAL_ERROR_NUMBER {
   HAL_ERR_INVALID_PARAMETER = -1000,
   HAL_ERR_IP_NOT_EXIST,
@@ -25,8 +49,30 @@ enum HAL_ERROR_NUMBER {
   HAL_ERR_EOF,
   HAL_ERR_NOT_SUPPORTED,
   HAL_ERR_UNKNOWN,
+  HAL_ERR_QUEUE_FULL,
+  HAL_ERR_NO_BUFFER,
 };
 
+// 报文缓冲区在 IP 报文前为链路层头部预留的字节数
+#define HAL_PACKET_HEADROOM 64
+// 报文缓冲区能容纳的最长 IP 报文
+#define HAL_PACKET_SIZE 2048
+
+// 内存区域，见 HAL_ArenaCreate
+typedef struct hal_arena hal_arena_t;
+
+// 报文缓冲池中的一个报文，见 HAL_AllocPacket
+typedef struct hal_packet {
+  uint8_t *data;      // IP 报文的开始，前面至少有 HAL_PACKET_HEADROOM 字节空闲
+  size_t length;      // IP 报文的长度
+  int if_index;       // 收到报文的接口
+  macaddr_t src_mac;  // 收到报文时下层的源 MAC 地址
+  macaddr_t dst_mac;  // 收到报文时下层的目的 MAC 地址
+  uint32_t refcnt;    // 引用计数，降为 0 时回到缓冲池
+  struct hal_packet *next; // HAL 内部使用
+  uint8_t buffer[HAL_PACKET_HEADROOM + HAL_PACKET_SIZE];
+} hal_packet_t;
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -63,6 +109,78 @@ uint64_t HAL_GetTicks();
  */
 int HAL_ArpGetMacAddress(int if_index, in_addr_t ip, macaddr_t o_mac);
 
+/**
+ * @brief 告诉 HAL 某个邻居正在被路由使用，HAL 会提前解析并保持它的 ARP 表项新鲜
+ *
+ * 路由器在学到经过某个下一跳的路由时（例如每次收到该邻居的 RIP
+ * 报文时）调用。不在表中的邻居会立即发出 ARP 请求；已有的表项会被标记为使用中，
+ * 支持邻居维护的后端会在它过期前主动发送单播 ARP 请求进行刷新，使转发时不会遇到
+ * ARP 表缺失
+ *
+ * @param if_index IN，接口索引号，[0, N_IFACE_ON_BOARD-1]
+ * @param ip IN，邻居的 IP 地址
+ * @return int 0 表示该邻居已经解析，非 0 表示正在解析或失败
+ */
+int HAL_ArpKeepAlive(int if_index, in_addr_t ip);
+
+/**
+ * @brief 导出 ARP 表中已经解析的邻居，不含本机的接口
+ *
+ * 用于保存路由器的状态，重启后再用 HAL_ArpAddEntry 恢复，省去重新解析的时间。
+ * 没有 ARP 表的后端总是返回 0
+ *
+ * @param o_entries OUT，导出的表项，由调用者分配
+ * @param max IN，o_entries 最多能容纳的表项数
+ * @return int >=0 表示导出的表项数，<0 表示失败
+ */
+int HAL_ArpGetEntries(arpentry_t *o_entries, int max);
+
+/**
+ * @brief 把之前学到的邻居加入 ARP 表，表中已有的邻居不会被覆盖
+ *
+ * 加入的表项立即可以用于发送。支持邻居维护的后端会马上向它发送单播 ARP
+ * 请求进行确认，没有回应时按正常的规则过期删除；没有 ARP 表的后端直接返回 0
+ *
+ * @param if_index IN，接口索引号，[0, N_IFACE_ON_BOARD-1]
+ * @param ip IN，邻居的 IP 地址
+ * @param mac IN，邻居的 MAC 地址
+ * @return int 0 表示成功，非 0 为失败
+ */
+int HAL_ArpAddEntry(int if_index, in_addr_t ip, macaddr_t mac);
+
+/**
+ * @brief 打开 IPv6 ，在 HAL_Init 之后调用
+ *
+ * 之后 HAL_ReceiveIPPacket 也会收到 IPv6 报文（以太网类型 0x86DD ），
+ * 调用者根据报文第一个字节的版本号区分 IPv4 和 IPv6 。邻居发现（ ND ）的 NS 和
+ * NA 报文由 HAL 处理，不会交给调用者，其余 ICMPv6 报文照常返回。
+ * 每个端口都有一个由 MAC 地址按照 EUI-64 生成的链路本地地址 fe80::/64 ，
+ * HAL 会回应询问它或者 if_addrs 中对应地址的 NS 。
+ * 不调用本函数时 HAL 的行为和原来一样，只收发 IPv4 。部分后端不支持 IPv6 ，
+ * 返回 HAL_ERR_NOT_SUPPORTED
+ *
+ * @param if_addrs IN，包含 N_IFACE_ON_BOARD 个 IPv6 地址，对应每个端口的全局
+ * 地址，全零表示该端口只有链路本地地址
+ * @return int 0 表示成功，非 0 表示失败
+ */
+int HAL_InitIPv6(const in6_addr_t if_addrs[N_IFACE_ON_BOARD]);
+
+/**
+ * @brief 从邻居表中查询 IPv6 地址对应的 MAC 地址，相当于 IPv6 的
+ * HAL_ArpGetMacAddress
+ *
+ * 如果是表中不存在的地址，系统将自动向它的被请求节点组播地址发送 NS
+ * 报文进行查询，待对方回应 NA 后可重新调用本接口从表中查询，每秒向同一个地址
+ * 最多发送一个 NS 报文。组播地址 ff00::/8 直接映射为 33:33 开头的 MAC 地址。
+ * IPv6 没有等待队列，查不到时调用者自行丢弃报文
+ *
+ * @param if_index IN，接口索引号，[0, N_IFACE_ON_BOARD-1]
+ * @param ip IN，要查询的 IPv6 地址
+ * @param o_mac OUT，查询结果 MAC 地址
+ * @return int 0 表示成功，非 0 为失败
+ */
+int HAL_NdGetMacAddress(int if_index, in6_addr_t ip, macaddr_t o_mac);
+
 /**
  * @brief 获取网卡的 MAC 地址，如果为全 0 代表系统中不存在该网卡或者获取失败
  *
@@ -73,8 +191,8 @@ int HAL_ArpGetMacAddress(int if_index, in_addr_t ip, macaddr_t o_mac);
 int HAL_GetInterfaceMacAddress(int if_index, macaddr_t o_mac);
 
 /**
- * @brief 接收一个 IPv4
- * 报文，保证不会收到自己发送的报文；请保证缓冲区大小足够大（如大于常见的
+ * @brief 接收一个 IPv4 报文（调用过 HAL_InitIPv6 时也可能是 IPv6
+ * 报文），保证不会收到自己发送的报文；请保证缓冲区大小足够大（如大于常见的
  * MTU），报文只能读取一次
  *
  * @param if_index_mask IN，接口索引号的 bitset，最低的 N_IFACE_ON_BOARD
@@ -95,6 +213,8 @@ int HAL_ReceiveIPPacket(int if_index_mask, uint8_t *buffer, size_t length,
 /**
  * @brief 发送一个 IP 报文，它的源 MAC 地址就是对应接口的 MAC 地址
  *
+ * 以太网类型由报文第一个字节的版本号决定，版本号为 6 时是 0x86DD ，否则是 0x0800
+ *
  * @param if_index IN，接口索引号，[0, N_IFACE_ON_BOARD-1]
  * @param buffer IN，发送缓冲区
  * @param length IN，待发送报文的长度
@@ -104,6 +224,139 @@ int HAL_ReceiveIPPacket(int if_index_mask, uint8_t *buffer, size_t length,
 int HAL_SendIPPacket(int if_index, uint8_t *buffer, size_t length,
                      macaddr_t dst_mac);
 
+/**
+ * @brief 向下一跳发送一个 IP 报文，由 HAL 负责查询下一跳的 MAC 地址
+ *
+ * 如果 ARP 表中已有下一跳，则与 HAL_SendIPPacket 相同，立即发送；否则发出 ARP
+ * 请求，并把报文复制到这个邻居的等待队列中，待 HAL_ReceiveIPPacket 收到对方的
+ * ARP 报文后自动发送，这样新的流的第一批报文不会因为 ARP 而丢失。
+ * 每个邻居等待的报文数和所有等待的报文的总字节数都有上限，等待超过几秒的报文会被
+ * 丢弃。部分后端不支持等待队列，在 ARP 表中查不到时直接返回
+ * HAL_ERR_IP_NOT_EXIST
+ *
+ * @param if_index IN，接口索引号，[0, N_IFACE_ON_BOARD-1]
+ * @param buffer IN，发送缓冲区，返回后即可复用
+ * @param length IN，待发送报文的长度
+ * @param nexthop IN，下一跳的 IPv4 地址
+ * @return int 0 表示已发送，1 表示已进入等待队列，<0 表示失败，等待队列已满时为
+ * HAL_ERR_QUEUE_FULL
+ */
+int HAL_SendIPPacketToNexthop(int if_index, uint8_t *buffer, size_t length,
+                              in_addr_t nexthop);
+
+/**
+ * @brief 从报文缓冲池中取出一个报文，引用计数为 1 ，data 指向预留的链路层头部
+ * 之后，length 为 0
+ *
+ * 缓冲池按需增长，达到上限后返回 NULL 。报文用完后调用 HAL_FreePacket ，或者
+ * 交给 HAL_SendPacket 等函数发送
+ *
+ * @return hal_packet_t* 报文，缓冲池已满时为 NULL
+ */
+hal_packet_t *HAL_AllocPacket();
+
+/**
+ * @brief 增加报文的引用计数。同一个报文要发送到多个接口时，每次发送消耗一个
+ * 引用，发送前先为多出来的每次增加一个
+ *
+ * @param packet IN，报文
+ */
+void HAL_RefPacket(hal_packet_t *packet);
+
+/**
+ * @brief 减少报文的引用计数，降为 0 时报文回到缓冲池
+ *
+ * @param packet IN，报文，可以为 NULL
+ */
+void HAL_FreePacket(hal_packet_t *packet);
+
+/**
+ * @brief 与 HAL_ReceiveIPPacket 相同，但是直接接收到缓冲池的报文中，之后的
+ * 修改和发送都可以在这个报文上原地进行
+ *
+ * @param if_index_mask IN，同 HAL_ReceiveIPPacket
+ * @param o_packet OUT，收到的报文，引用计数为 1 ，接口号和 MAC 地址记录在报文中
+ * @param timeout IN，同 HAL_ReceiveIPPacket
+ * @return int >0 表示报文的实际长度，大于 HAL_PACKET_SIZE 时报文被截断，
+ * length 为 HAL_PACKET_SIZE ；=0 表示超时返回，<0 表示发生错误，缓冲池已满时为
+ * HAL_ERR_NO_BUFFER
+ */
+int HAL_ReceivePacket(int if_index_mask, hal_packet_t **o_packet,
+                      int64_t timeout);
+
+/**
+ * @brief 发送缓冲池中的报文，与 HAL_SendIPPacket 相同。pcap 后端把以太网头部
+ * 写在报文前预留的空间里原地发送，不再复制报文
+ *
+ * 无论成功与否都消耗调用者的一个引用，之后不能再使用 packet 。同一个报文发往
+ * 多个接口时，发送期间不要修改它的内容
+ *
+ * @param if_index IN，接口索引号，[0, N_IFACE_ON_BOARD-1]
+ * @param packet IN，待发送的报文
+ * @param dst_mac IN，下层的目的 MAC 地址
+ * @return int 0 表示成功，非 0 为失败
+ */
+int HAL_SendPacket(int if_index, hal_packet_t *packet, macaddr_t dst_mac);
+
+/**
+ * @brief 向下一跳发送缓冲池中的报文，与 HAL_SendIPPacketToNexthop 相同，但进入
+ * 等待队列的是报文本身而不是它的副本。与 HAL_SendPacket 一样消耗调用者的一个
+ * 引用
+ *
+ * @param if_index IN，接口索引号，[0, N_IFACE_ON_BOARD-1]
+ * @param packet IN，待发送的报文
+ * @param nexthop IN，下一跳的 IPv4 地址
+ * @return int 同 HAL_SendIPPacketToNexthop
+ */
+int HAL_SendPacketToNexthop(int if_index, hal_packet_t *packet,
+                            in_addr_t nexthop);
+
+/**
+ * @brief 创建一个 arena ，从向系统申请的大块区域中依次切出内存，给路由表和报文
+ * 缓冲池这样的大数据结构使用
+ *
+ * 区域尽量用大页映射：区域是 1GB 的整数倍时先试 1GB 的大页，再试 2MB 的大页；
+ * 系统没有预留大页时退回普通页，Linux 上再建议内核用透明大页。这样大的路由表只
+ * 占用很少的 TLB 表项。设置环境变量 HAL_HUGEPAGES=0 可以关闭大页，sim 后端
+ * 默认关闭
+ *
+ * @param region_size IN，每次向系统申请的区域大小，向上取整到 2MB ，0 表示 2MB
+ * @return hal_arena_t* arena ，失败时为 NULL
+ */
+hal_arena_t *HAL_ArenaCreate(size_t region_size);
+
+/**
+ * @brief 从 arena 中分配内存，按 16 字节对齐，内容未初始化
+ *
+ * 先复用 HAL_ArenaFree 还回的块：不超过 1KB 的用同样大小的，更大的用足够大的
+ * 一块切出，剩下的留着；否则在当前区域中顺序切出；比区域还大的分配单独占一块区域
+ *
+ * @param arena IN，arena
+ * @param size IN，字节数
+ * @return void* 内存，失败时为 NULL
+ */
+void *HAL_ArenaAlloc(hal_arena_t *arena, size_t size);
+
+/**
+ * @brief 还回 HAL_ArenaAlloc 分配的一块内存
+ *
+ * 不超过 1KB 的块留给之后同样大小的分配，更大的按大小留给之后不超过它的分配，
+ * 单独占一块区域的直接还给系统
+ *
+ * @param arena IN，arena
+ * @param ptr IN，内存，可以为 NULL
+ * @param size IN，分配时的字节数
+ */
+void HAL_ArenaFree(hal_arena_t *arena, void *ptr, size_t size);
+
+/**
+ * @brief 一次释放 arena 中分配的所有内存，用于整体重建数据结构。区域留给之后的
+ * 分配，不还给系统
+ *
+ * @param arena IN，arena
+ */
+void HAL_ArenaReset(hal_arena_t *arena);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,320 @@
+#ifndef __ROUTER_HAL_ARENA_H__
+#define __ROUTER_HAL_ARENA_H__
+
+// don't include this file in your own code.
+// memory arenas, shared by all backends. Memory is cut from big regions by
+// bumping a pointer; the regions are mapped with hugepages where the platform
+// has them, so that a big table needs only a few TLB entries.
+#include "router_hal.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__linux__) || defined(__APPLE__)
+#include <sys/mman.h>
+#ifdef MAP_ANONYMOUS
+#define HAL_ARENA_MMAP
+#endif
+#endif
+
+// allocations are rounded up to this
+#define HAL_ARENA_ALIGN 16
+// freed blocks up to this size are kept for allocations of the same size
+#define HAL_ARENA_SLAB_MAX 1024
+#define HAL_ARENA_CLASSES (HAL_ARENA_SLAB_MAX / HAL_ARENA_ALIGN)
+// bigger freed blocks are kept by the power of two below their size and cut
+// for any allocation that fits
+#define HAL_ARENA_MEDIUM_CLASSES 64
+#define HAL_ARENA_PAGE_2M ((size_t)2 << 20)
+#define HAL_ARENA_PAGE_1G ((size_t)1 << 30)
+
+typedef struct hal_arena_region {
+  uint8_t *base;
+  size_t size;
+  struct hal_arena_region *next;
+} hal_arena_region_t;
+
+// written into a freed block bigger than HAL_ARENA_SLAB_MAX
+typedef struct hal_arena_block {
+  struct hal_arena_block *next;
+  size_t size;
+} hal_arena_block_t;
+
+struct hal_arena {
+  size_t region_size;
+  // in the order they were mapped, reused after a reset
+  hal_arena_region_t *regions;
+  // the region being cut and how far
+  hal_arena_region_t *current;
+  uint8_t *cursor;
+  // allocations bigger than a region, one region each
+  hal_arena_region_t *large;
+  // freed blocks by size, linked through their first word
+  void *free_blocks[HAL_ARENA_CLASSES];
+  hal_arena_block_t *medium_blocks[HAL_ARENA_MEDIUM_CLASSES];
+#ifdef ROUTER_BACKEND_SIM
+  // the router that created the arena and the bytes it is charged for
+  void *owner;
+  int64_t charged;
+#endif
+};
+
+#ifdef ROUTER_BACKEND_SIM
+// the sim backend counts the bytes handed out into the heap usage of the
+// router that created the arena, defined there
+static void *HAL_SimArenaOwner();
+static void HAL_SimArenaCharge(void *owner, int64_t bytes);
+#endif
+
+static void HAL_ArenaCharge(hal_arena_t *arena, int64_t bytes) {
+#ifdef ROUTER_BACKEND_SIM
+  arena->charged += bytes;
+  HAL_SimArenaCharge(arena->owner, bytes);
+#else
+  (void)arena;
+  (void)bytes;
+#endif
+}
+
+static size_t HAL_ArenaRound(size_t size, size_t unit) {
+  return (size + unit - 1) & ~(unit - 1);
+}
+
+static int HAL_ArenaMediumClass(size_t size) {
+  int k = 0;
+  while (size >> (k + 1)) {
+    k++;
+  }
+  return k;
+}
+
+// keeps a free block for later allocations, size is a multiple of
+// HAL_ARENA_ALIGN and at most a region
+static void HAL_ArenaKeep(hal_arena_t *arena, void *ptr, size_t size) {
+  if (size <= HAL_ARENA_SLAB_MAX) {
+    void **head = &arena->free_blocks[size / HAL_ARENA_ALIGN - 1];
+    *(void **)ptr = *head;
+    *head = ptr;
+  } else {
+    hal_arena_block_t *block = (hal_arena_block_t *)ptr;
+    hal_arena_block_t **head =
+        &arena->medium_blocks[HAL_ArenaMediumClass(size)];
+    block->size = size;
+    block->next = *head;
+    *head = block;
+  }
+}
+
+// cuts size bytes from the smallest kept block bigger than HAL_ARENA_SLAB_MAX
+// that fits and keeps the rest, NULL when none is big enough. blocks are not
+// merged again, but a table rebuilt with the same sizes finds them all exact
+static void *HAL_ArenaTakeMedium(hal_arena_t *arena, size_t size) {
+  for (int k = HAL_ArenaMediumClass(size); k < HAL_ARENA_MEDIUM_CLASSES; k++) {
+    hal_arena_block_t **best = NULL;
+    for (hal_arena_block_t **link = &arena->medium_blocks[k]; *link;
+         link = &(*link)->next) {
+      if ((*link)->size >= size &&
+          (best == NULL || (*link)->size < (*best)->size)) {
+        best = link;
+        if ((*link)->size == size) {
+          break;
+        }
+      }
+    }
+    if (best) {
+      hal_arena_block_t *block = *best;
+      *best = block->next;
+      if (block->size > size) {
+        HAL_ArenaKeep(arena, (uint8_t *)block + size, block->size - size);
+      }
+      return block;
+    }
+  }
+  return NULL;
+}
+
+static int HAL_ArenaHuge() {
+#ifdef ROUTER_BACKEND_SIM
+  // many routers in one process, each would take whole pages
+  const char *fallback = "0";
+#else
+  const char *fallback = "1";
+#endif
+  const char *env = getenv("HAL_HUGEPAGES");
+  return strcmp(env && env[0] ? env : fallback, "0") != 0;
+}
+
+// maps size bytes (a multiple of 2 MB) with the biggest pages available
+static uint8_t *HAL_ArenaMap(size_t size) {
+#ifdef HAL_ARENA_MMAP
+  int huge = HAL_ArenaHuge();
+  int prot = PROT_READ | PROT_WRITE;
+  int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+  void *p = MAP_FAILED;
+#ifdef MAP_HUGETLB
+  // only succeeds if the administrator has set hugepages aside
+#ifdef MAP_HUGE_SHIFT
+  if (huge && size % HAL_ARENA_PAGE_1G == 0) {
+    p = mmap(NULL, size, prot, flags | MAP_HUGETLB | (30 << MAP_HUGE_SHIFT),
+             -1, 0);
+  }
+#endif
+  if (huge && p == MAP_FAILED) {
+    p = mmap(NULL, size, prot, flags | MAP_HUGETLB, -1, 0);
+  }
+#endif
+  if (p != MAP_FAILED) {
+    return (uint8_t *)p;
+  }
+  // normal pages, aligned to 2 MB so that transparent hugepages can back
+  // all of it
+  uint8_t *raw = (uint8_t *)mmap(NULL, size + HAL_ARENA_PAGE_2M, prot, flags,
+                                 -1, 0);
+  if ((void *)raw == MAP_FAILED) {
+    return NULL;
+  }
+  uint8_t *base = (uint8_t *)HAL_ArenaRound((uintptr_t)raw, HAL_ARENA_PAGE_2M);
+  if (base > raw) {
+    munmap(raw, base - raw);
+  }
+  if (raw + HAL_ARENA_PAGE_2M > base) {
+    munmap(base + size, raw + HAL_ARENA_PAGE_2M - base);
+  }
+#ifdef MADV_HUGEPAGE
+  if (huge) {
+    madvise(base, size, MADV_HUGEPAGE);
+  }
+#endif
+  return base;
+#else
+  return (uint8_t *)malloc(size);
+#endif
+}
+
+static void HAL_ArenaUnmap(hal_arena_region_t *region) {
+#ifdef HAL_ARENA_MMAP
+  munmap(region->base, region->size);
+#else
+  free(region->base);
+#endif
+  free(region);
+}
+
+static hal_arena_region_t *HAL_ArenaNewRegion(size_t size) {
+  hal_arena_region_t *region =
+      (hal_arena_region_t *)malloc(sizeof(hal_arena_region_t));
+  if (region == NULL) {
+    return NULL;
+  }
+  region->size = HAL_ArenaRound(size, HAL_ARENA_PAGE_2M);
+  region->base = HAL_ArenaMap(region->size);
+  region->next = NULL;
+  if (region->base == NULL) {
+    free(region);
+    return NULL;
+  }
+  return region;
+}
+
+hal_arena_t *HAL_ArenaCreate(size_t region_size) {
+  hal_arena_t *arena = (hal_arena_t *)calloc(1, sizeof(hal_arena_t));
+  if (arena == NULL) {
+    return NULL;
+  }
+  if (region_size == 0) {
+    region_size = HAL_ARENA_PAGE_2M;
+  }
+  arena->region_size = HAL_ArenaRound(region_size, HAL_ARENA_PAGE_2M);
+#ifdef ROUTER_BACKEND_SIM
+  arena->owner = HAL_SimArenaOwner();
+#endif
+  return arena;
+}
+
+void *HAL_ArenaAlloc(hal_arena_t *arena, size_t size) {
+  size = HAL_ArenaRound(size ? size : 1, HAL_ARENA_ALIGN);
+  if (size <= HAL_ARENA_SLAB_MAX) {
+    void **head = &arena->free_blocks[size / HAL_ARENA_ALIGN - 1];
+    if (*head) {
+      void *block = *head;
+      *head = *(void **)block;
+      HAL_ArenaCharge(arena, size);
+      return block;
+    }
+  } else if (size > arena->region_size) {
+    hal_arena_region_t *region = HAL_ArenaNewRegion(size);
+    if (region == NULL) {
+      return NULL;
+    }
+    region->next = arena->large;
+    arena->large = region;
+    HAL_ArenaCharge(arena, size);
+    return region->base;
+  } else {
+    void *block = HAL_ArenaTakeMedium(arena, size);
+    if (block) {
+      HAL_ArenaCharge(arena, size);
+      return block;
+    }
+  }
+
+  while (arena->current == NULL ||
+         arena->cursor + size > arena->current->base + arena->current->size) {
+    hal_arena_region_t *next =
+        arena->current ? arena->current->next : arena->regions;
+    if (next == NULL) {
+      next = HAL_ArenaNewRegion(arena->region_size);
+      if (next == NULL) {
+        return NULL;
+      }
+      if (arena->current) {
+        arena->current->next = next;
+      } else {
+        arena->regions = next;
+      }
+    }
+    arena->current = next;
+    arena->cursor = next->base;
+  }
+  void *block = arena->cursor;
+  arena->cursor += size;
+  HAL_ArenaCharge(arena, size);
+  return block;
+}
+
+void HAL_ArenaFree(hal_arena_t *arena, void *ptr, size_t size) {
+  if (ptr == NULL) {
+    return;
+  }
+  size = HAL_ArenaRound(size ? size : 1, HAL_ARENA_ALIGN);
+  HAL_ArenaCharge(arena, -(int64_t)size);
+  if (size <= arena->region_size) {
+    HAL_ArenaKeep(arena, ptr, size);
+  } else {
+    hal_arena_region_t **link = &arena->large;
+    while (*link && (*link)->base != ptr) {
+      link = &(*link)->next;
+    }
+    if (*link) {
+      hal_arena_region_t *region = *link;
+      *link = region->next;
+      HAL_ArenaUnmap(region);
+    }
+  }
+}
+
+void HAL_ArenaReset(hal_arena_t *arena) {
+  while (arena->large) {
+    hal_arena_region_t *region = arena->large;
+    arena->large = region->next;
+    HAL_ArenaUnmap(region);
+  }
+  arena->current = NULL;
+  arena->cursor = NULL;
+  memset(arena->free_blocks, 0, sizeof(arena->free_blocks));
+  memset(arena->medium_blocks, 0, sizeof(arena->medium_blocks));
+#ifdef ROUTER_BACKEND_SIM
+  HAL_ArenaCharge(arena, -arena->charged);
+#endif
+}
+
+#endif
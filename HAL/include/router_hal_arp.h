@@ -0,0 +1,145 @@
+#ifndef __ROUTER_HAL_ARP_H__
+#define __ROUTER_HAL_ARP_H__
+
+// don't include this file in your own code.
+// packets waiting for ARP resolution, shared by the pcap based backends.
+// The queues hold pool packets, see router_hal_pool.h
+#include "router_hal.h"
+#include "router_hal_pool.h"
+#include <deque>
+#include <map>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <utility>
+
+// at most this many packets wait for one neighbor
+#define ARP_PENDING_PER_NEIGHBOR 16
+// at most this many packets wait for all neighbors together. Every one holds
+// a whole pool buffer whatever its length, so this stays well below
+// HAL_POOL_MAX_PACKETS and receiving never runs out of buffers
+#define ARP_PENDING_MAX_PACKETS (HAL_POOL_MAX_PACKETS / 4)
+// packets waiting longer than this (ms) are dropped
+#define ARP_PENDING_TIMEOUT 3000
+// how often (ms) to look for expired packets
+#define ARP_PENDING_SCAN_INTERVAL 100
+
+extern int debugEnabled;
+
+struct ArpPendingPacket {
+  uint64_t enqueue_time;
+  hal_packet_t *packet;
+};
+
+std::map<std::pair<in_addr_t, int>, std::deque<ArpPendingPacket>> arp_pending;
+size_t arp_pending_packets = 0;
+uint64_t arp_pending_last_scan = 0;
+
+// called when the MAC address of (ip, if_index) is learned
+static void HAL_ArpFlushPending(int if_index, in_addr_t ip,
+                                const macaddr_t mac) {
+  auto it = arp_pending.find(std::pair<in_addr_t, int>(ip, if_index));
+  if (it == arp_pending.end()) {
+    return;
+  }
+  // detach the queue first, sending must not see it half consumed
+  std::deque<ArpPendingPacket> queue;
+  queue.swap(it->second);
+  arp_pending.erase(it);
+
+  macaddr_t dst_mac;
+  memcpy(dst_mac, mac, sizeof(macaddr_t));
+  if (debugEnabled) {
+    fprintf(stderr, "HAL_ArpFlushPending: sending %zu pending packet(s) to %s\n",
+            queue.size(), inet_ntoa(in_addr{ip}));
+  }
+  for (auto &pending : queue) {
+    arp_pending_packets--;
+    HAL_SendPacket(if_index, pending.packet, dst_mac);
+  }
+}
+
+// drop packets whose neighbor did not answer in time
+static void HAL_ArpExpirePending(uint64_t now) {
+  if (arp_pending.empty() ||
+      now < arp_pending_last_scan + ARP_PENDING_SCAN_INTERVAL) {
+    return;
+  }
+  arp_pending_last_scan = now;
+  for (auto it = arp_pending.begin(); it != arp_pending.end();) {
+    std::deque<ArpPendingPacket> &queue = it->second;
+    while (!queue.empty() &&
+           queue.front().enqueue_time + ARP_PENDING_TIMEOUT < now) {
+      arp_pending_packets--;
+      HAL_FreePacket(queue.front().packet);
+      queue.pop_front();
+    }
+    if (queue.empty()) {
+      if (debugEnabled) {
+        fprintf(stderr,
+                "HAL_ArpExpirePending: no ARP reply from %s, dropped its "
+                "pending packets\n",
+                inet_ntoa(in_addr{it->first.first}));
+      }
+      it = arp_pending.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+// takes the caller's reference to packet, also when the queue is full
+static int HAL_ArpQueuePacket(int if_index, in_addr_t ip, hal_packet_t *packet,
+                              uint64_t now) {
+  std::deque<ArpPendingPacket> &queue =
+      arp_pending[std::pair<in_addr_t, int>(ip, if_index)];
+  if (queue.size() >= ARP_PENDING_PER_NEIGHBOR ||
+      arp_pending_packets >= ARP_PENDING_MAX_PACKETS) {
+    HAL_FreePacket(packet);
+    return HAL_ERR_QUEUE_FULL;
+  }
+  ArpPendingPacket pending = {now, packet};
+  queue.push_back(pending);
+  arp_pending_packets++;
+  return 1;
+}
+
+extern "C" int HAL_SendPacketToNexthop(int if_index, hal_packet_t *packet,
+                                       in_addr_t nexthop) {
+  macaddr_t dst_mac;
+  int res = HAL_ArpGetMacAddress(if_index, nexthop, dst_mac);
+  if (res == 0) {
+    return HAL_SendPacket(if_index, packet, dst_mac);
+  } else if (res != HAL_ERR_IP_NOT_EXIST) {
+    HAL_FreePacket(packet);
+    return res;
+  }
+  // the ARP request has been sent (or rate limited) by HAL_ArpGetMacAddress
+  uint64_t now = HAL_GetTicks();
+  HAL_ArpExpirePending(now);
+  return HAL_ArpQueuePacket(if_index, nexthop, packet, now);
+}
+
+extern "C" int HAL_SendIPPacketToNexthop(int if_index, uint8_t *buffer,
+                                         size_t length, in_addr_t nexthop) {
+  macaddr_t dst_mac;
+  int res = HAL_ArpGetMacAddress(if_index, nexthop, dst_mac);
+  if (res == 0) {
+    return HAL_SendIPPacket(if_index, buffer, length, dst_mac);
+  } else if (res != HAL_ERR_IP_NOT_EXIST) {
+    return res;
+  }
+  // only a packet that has to wait is copied, into a pool packet
+  hal_packet_t *packet = HAL_AllocPacket();
+  if (packet == NULL || length > HAL_PACKET_SIZE) {
+    HAL_FreePacket(packet);
+    return HAL_ERR_QUEUE_FULL;
+  }
+  memcpy(packet->data, buffer, length);
+  packet->length = length;
+  uint64_t now = HAL_GetTicks();
+  HAL_ArpExpirePending(now);
+  return HAL_ArpQueuePacket(if_index, nexthop, packet, now);
+}
+
+#endif
@@ -0,0 +1,300 @@
+#ifndef __ROUTER_HAL_ND_H__
+#define __ROUTER_HAL_ND_H__
+
+// don't include this file in your own code.
+// IPv6 neighbor discovery, shared by the pcap based backends. NS and NA are
+// IPv6 packets themselves, so they go out through HAL_SendIPPacket like any
+// other packet and each backend only has to recognize them on receive.
+#include "router_hal.h"
+#include <map>
+#include <stdio.h>
+#include <string.h>
+#include <utility>
+
+// all in milliseconds
+// a neighbor in use is probed with a unicast NS this long after we last
+// heard from it
+#define ND_REACHABLE_TIME 30000
+// neighbors not heard from for this long are removed
+#define ND_EXPIRE_TIME 60000
+// interval between two NS for the same address
+#define ND_PROBE_INTERVAL 1000
+
+#define ND_ICMPV6 58
+#define ND_TYPE_NS 135
+#define ND_TYPE_NA 136
+#define ND_OPT_SOURCE_LL 1
+#define ND_OPT_TARGET_LL 2
+// NA flags: router, solicited, override
+#define ND_FLAG_ROUTER 0x80
+#define ND_FLAG_SOLICITED 0x40
+#define ND_FLAG_OVERRIDE 0x20
+
+extern bool inited;
+extern int debugEnabled;
+
+struct NdEntry {
+  macaddr_t mac;
+  uint64_t confirmed; // last time we heard from the neighbor
+  uint64_t probed;    // last time we probed it
+};
+
+typedef std::pair<std::pair<uint64_t, uint64_t>, int> NdKey;
+
+bool nd_enabled = false;
+// link local and global address of each interface, the global one may be zero
+in6_addr_t nd_addrs[N_IFACE_ON_BOARD][2];
+std::map<NdKey, NdEntry> nd_table;
+// last NS for addresses not in nd_table
+std::map<NdKey, uint64_t> nd_timer;
+
+static NdKey HAL_NdKey(const uint8_t *ip, int if_index) {
+  uint64_t hi, lo;
+  memcpy(&hi, ip, sizeof(uint64_t));
+  memcpy(&lo, ip + 8, sizeof(uint64_t));
+  return NdKey(std::make_pair(hi, lo), if_index);
+}
+
+static bool HAL_NdIsZero(const uint8_t *ip) {
+  for (int i = 0; i < 16; i++) {
+    if (ip[i]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool HAL_NdIsOurs(int if_index, const uint8_t *ip) {
+  return memcmp(ip, nd_addrs[if_index][0].addr, 16) == 0 ||
+         (!HAL_NdIsZero(nd_addrs[if_index][1].addr) &&
+          memcmp(ip, nd_addrs[if_index][1].addr, 16) == 0);
+}
+
+static const char *HAL_NdFormat(const uint8_t *ip, char *buffer) {
+  return inet_ntop(AF_INET6, ip, buffer, INET6_ADDRSTRLEN);
+}
+
+// ones' complement sum over the pseudo header and the ICMPv6 message; zero
+// when the checksum in the message is right
+static uint16_t HAL_NdChecksum(const uint8_t *packet, size_t icmp_len) {
+  uint32_t sum = 0;
+  // source and destination
+  for (int i = 8; i < 40; i += 2) {
+    sum += (packet[i] << 8) | packet[i + 1];
+  }
+  sum += (icmp_len >> 16) + (icmp_len & 0xffff);
+  sum += ND_ICMPV6;
+  const uint8_t *icmp = &packet[40];
+  for (size_t i = 0; i + 1 < icmp_len; i += 2) {
+    sum += (icmp[i] << 8) | icmp[i + 1];
+  }
+  if (icmp_len & 1) {
+    sum += icmp[icmp_len - 1] << 8;
+  }
+  while (sum >> 16) {
+    sum = (sum & 0xffff) + (sum >> 16);
+  }
+  return ~sum;
+}
+
+static void HAL_NdSend(int if_index, uint8_t type, uint8_t flags,
+                       const uint8_t *src, const uint8_t *dst,
+                       const uint8_t *dst_mac, const uint8_t *target) {
+  uint8_t packet[72] = {0};
+  // IPv6, ND only counts packets that were never routed
+  packet[0] = 0x60;
+  packet[5] = 32;
+  packet[6] = ND_ICMPV6;
+  packet[7] = 255;
+  memcpy(&packet[8], src, 16);
+  memcpy(&packet[24], dst, 16);
+  // ICMPv6
+  uint8_t *icmp = &packet[40];
+  icmp[0] = type;
+  icmp[4] = flags;
+  memcpy(&icmp[8], target, 16);
+  // our link layer address
+  icmp[24] = type == ND_TYPE_NS ? ND_OPT_SOURCE_LL : ND_OPT_TARGET_LL;
+  icmp[25] = 1;
+  HAL_GetInterfaceMacAddress(if_index, &icmp[26]);
+  uint16_t checksum = HAL_NdChecksum(packet, 32);
+  icmp[2] = checksum >> 8;
+  icmp[3] = checksum;
+
+  macaddr_t mac;
+  memcpy(mac, dst_mac, sizeof(macaddr_t));
+  HAL_SendIPPacket(if_index, packet, sizeof(packet), mac);
+}
+
+// NS for target, to its solicited-node multicast address or, if dst_mac is
+// given, directly to the neighbor
+static void HAL_NdSendSolicit(int if_index, const uint8_t *target,
+                              const uint8_t *dst_mac) {
+  uint8_t dst[16] = {0xff, 0x02, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x01, 0xff};
+  macaddr_t mac = {0x33, 0x33, 0xff};
+  if (dst_mac) {
+    memcpy(dst, target, 16);
+    memcpy(mac, dst_mac, sizeof(macaddr_t));
+  } else {
+    memcpy(&dst[13], &target[13], 3);
+    memcpy(&mac[3], &target[13], 3);
+  }
+  HAL_NdSend(if_index, ND_TYPE_NS, 0, nd_addrs[if_index][0].addr, dst, mac,
+             target);
+}
+
+// learns from NS and NA and answers NS for our addresses; returns true if the
+// packet was one of them and must not reach the caller
+static bool HAL_NdInput(int if_index, const uint8_t *packet, size_t len,
+                        const uint8_t *src_mac, uint64_t now) {
+  if (len < 40 + 24 || packet[6] != ND_ICMPV6 ||
+      (packet[40] != ND_TYPE_NS && packet[40] != ND_TYPE_NA)) {
+    return false;
+  }
+  const uint8_t *icmp = &packet[40];
+  uint8_t type = icmp[0];
+  size_t icmp_len = (packet[4] << 8) | packet[5];
+  // a hop limit below 255 means it came from off link
+  if (packet[7] != 255 || icmp[1] != 0 || icmp_len < 24 ||
+      40 + icmp_len > len || HAL_NdChecksum(packet, icmp_len) != 0) {
+    return true;
+  }
+  const uint8_t *src = &packet[8];
+  const uint8_t *target = &icmp[8];
+
+  // the link layer address option, the frame's source if there is none
+  const uint8_t *ll = src_mac;
+  uint8_t wanted = type == ND_TYPE_NS ? ND_OPT_SOURCE_LL : ND_OPT_TARGET_LL;
+  for (size_t offset = 24; offset + 8 <= icmp_len;) {
+    size_t opt_len = icmp[offset + 1] * 8;
+    if (opt_len == 0 || offset + opt_len > icmp_len) {
+      break;
+    }
+    if (icmp[offset] == wanted) {
+      ll = &icmp[offset + 2];
+    }
+    offset += opt_len;
+  }
+
+  // an NS tells about its sender, an NA about its target; duplicate address
+  // detection comes from the unspecified address and tells nothing
+  const uint8_t *neighbor = type == ND_TYPE_NS ? src : target;
+  char name[INET6_ADDRSTRLEN];
+  if (!HAL_NdIsZero(neighbor) && !HAL_NdIsOurs(if_index, neighbor)) {
+    NdKey key = HAL_NdKey(neighbor, if_index);
+    auto it = nd_table.find(key);
+    if (debugEnabled) {
+      if (it == nd_table.end()) {
+        fprintf(stderr, "HAL_NdInput: learned MAC address of %s\n",
+                HAL_NdFormat(neighbor, name));
+      } else if (memcmp(it->second.mac, ll, sizeof(macaddr_t)) != 0) {
+        fprintf(stderr, "HAL_NdInput: MAC address of %s changed\n",
+                HAL_NdFormat(neighbor, name));
+      }
+    }
+    NdEntry &entry = nd_table[key];
+    memcpy(entry.mac, ll, sizeof(macaddr_t));
+    entry.confirmed = now;
+    entry.probed = now;
+    nd_timer.erase(key);
+  }
+
+  if (type == ND_TYPE_NS && HAL_NdIsOurs(if_index, target)) {
+    if (HAL_NdIsZero(src)) {
+      // defend the address against duplicate address detection
+      uint8_t all_nodes[16] = {0xff, 0x02};
+      all_nodes[15] = 0x01;
+      macaddr_t mac = {0x33, 0x33, 0, 0, 0, 0x01};
+      HAL_NdSend(if_index, ND_TYPE_NA, ND_FLAG_ROUTER | ND_FLAG_OVERRIDE,
+                 target, all_nodes, mac, target);
+    } else {
+      HAL_NdSend(if_index, ND_TYPE_NA,
+                 ND_FLAG_ROUTER | ND_FLAG_SOLICITED | ND_FLAG_OVERRIDE, target,
+                 src, ll, target);
+    }
+    if (debugEnabled) {
+      fprintf(stderr, "HAL_NdInput: replied NA to %s\n",
+              HAL_NdFormat(src, name));
+    }
+  }
+  return true;
+}
+
+extern "C" int HAL_InitIPv6(const in6_addr_t if_addrs[N_IFACE_ON_BOARD]) {
+  if (!inited) {
+    return HAL_ERR_CALLED_BEFORE_INIT;
+  }
+  for (int i = 0; i < N_IFACE_ON_BOARD; i++) {
+    // fe80::/64 with the EUI-64 interface identifier
+    macaddr_t mac;
+    HAL_GetInterfaceMacAddress(i, mac);
+    uint8_t *ll = nd_addrs[i][0].addr;
+    memset(ll, 0, 16);
+    ll[0] = 0xfe;
+    ll[1] = 0x80;
+    ll[8] = mac[0] ^ 0x02;
+    ll[9] = mac[1];
+    ll[10] = mac[2];
+    ll[11] = 0xff;
+    ll[12] = 0xfe;
+    ll[13] = mac[3];
+    ll[14] = mac[4];
+    ll[15] = mac[5];
+    nd_addrs[i][1] = if_addrs[i];
+  }
+  nd_enabled = true;
+  return 0;
+}
+
+extern "C" int HAL_NdGetMacAddress(int if_index, in6_addr_t ip,
+                                   macaddr_t o_mac) {
+  if (!inited || !nd_enabled) {
+    return HAL_ERR_CALLED_BEFORE_INIT;
+  }
+  if (if_index >= N_IFACE_ON_BOARD || if_index < 0) {
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+
+  // handle multicast
+  if (ip.addr[0] == 0xff) {
+    o_mac[0] = 0x33;
+    o_mac[1] = 0x33;
+    memcpy(&o_mac[2], &ip.addr[12], 4);
+    return 0;
+  }
+
+  uint64_t now = HAL_GetTicks();
+  NdKey key = HAL_NdKey(ip.addr, if_index);
+  auto it = nd_table.find(key);
+  if (it != nd_table.end()) {
+    NdEntry &entry = it->second;
+    if (now <= entry.confirmed + ND_EXPIRE_TIME) {
+      if (now > entry.confirmed + ND_REACHABLE_TIME &&
+          now >= entry.probed + ND_PROBE_INTERVAL) {
+        // still in use, make sure it is still there; the old MAC is used
+        // meanwhile
+        entry.probed = now;
+        HAL_NdSendSolicit(if_index, ip.addr, entry.mac);
+      }
+      memcpy(o_mac, entry.mac, sizeof(macaddr_t));
+      return 0;
+    }
+    nd_table.erase(it);
+  }
+
+  // not found, send NS; rate limit by 1 req/s
+  auto timer = nd_timer.find(key);
+  if (timer == nd_timer.end() || now >= timer->second + ND_PROBE_INTERVAL) {
+    nd_timer[key] = now;
+    if (debugEnabled) {
+      char name[INET6_ADDRSTRLEN];
+      fprintf(stderr,
+              "HAL_NdGetMacAddress: asking for ip address %s with NS\n",
+              HAL_NdFormat(ip.addr, name));
+    }
+    HAL_NdSendSolicit(if_index, ip.addr, NULL);
+  }
+  return HAL_ERR_IP_NOT_EXIST;
+}
+
+#endif
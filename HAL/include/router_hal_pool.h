@@ -0,0 +1,95 @@
+#ifndef __ROUTER_HAL_POOL_H__
+#define __ROUTER_HAL_POOL_H__
+
+// don't include this file in your own code.
+// the packet buffer pool, shared by all backends. Buffers are cut from an
+// arena in chunks as they are first needed and never given back to the
+// system; under the sim backend every router has its own pool.
+#include "router_hal.h"
+#include "router_hal_arena.h"
+#include <stdlib.h>
+#include <string.h>
+
+// buffers allocated at a time
+#define HAL_POOL_CHUNK 64
+// at most this many buffers, about 8 MB
+#define HAL_POOL_MAX_PACKETS 4096
+
+ROUTER_LOCAL hal_arena_t *hal_pool_arena = NULL;
+ROUTER_LOCAL hal_packet_t *hal_pool_free = NULL;
+ROUTER_LOCAL size_t hal_pool_packets = 0;
+
+hal_packet_t *HAL_AllocPacket() {
+  if (hal_pool_free == NULL) {
+    if (hal_pool_packets + HAL_POOL_CHUNK > HAL_POOL_MAX_PACKETS) {
+      return NULL;
+    }
+    if (hal_pool_arena == NULL) {
+      hal_pool_arena = HAL_ArenaCreate(0);
+    }
+    hal_packet_t *chunk = NULL;
+    if (hal_pool_arena) {
+      chunk = (hal_packet_t *)HAL_ArenaAlloc(hal_pool_arena,
+                                             sizeof(hal_packet_t) *
+                                                 HAL_POOL_CHUNK);
+    }
+    if (chunk == NULL) {
+      return NULL;
+    }
+    for (int i = 0; i < HAL_POOL_CHUNK; i++) {
+      chunk[i].next = hal_pool_free;
+      hal_pool_free = &chunk[i];
+    }
+    hal_pool_packets += HAL_POOL_CHUNK;
+  }
+  hal_packet_t *packet = hal_pool_free;
+  hal_pool_free = packet->next;
+  packet->data = packet->buffer + HAL_PACKET_HEADROOM;
+  packet->length = 0;
+  packet->if_index = -1;
+  packet->refcnt = 1;
+  packet->next = NULL;
+  return packet;
+}
+
+void HAL_RefPacket(hal_packet_t *packet) { packet->refcnt++; }
+
+void HAL_FreePacket(hal_packet_t *packet) {
+  if (packet == NULL || --packet->refcnt > 0) {
+    return;
+  }
+  packet->next = hal_pool_free;
+  hal_pool_free = packet;
+}
+
+int HAL_ReceivePacket(int if_index_mask, hal_packet_t **o_packet,
+                      int64_t timeout) {
+  if (o_packet == NULL) {
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+  hal_packet_t *packet = HAL_AllocPacket();
+  if (packet == NULL) {
+    return HAL_ERR_NO_BUFFER;
+  }
+  // the backend copies straight into the pool, this is the only copy
+  int res = HAL_ReceiveIPPacket(if_index_mask, packet->data, HAL_PACKET_SIZE,
+                                packet->src_mac, packet->dst_mac, timeout,
+                                &packet->if_index);
+  if (res <= 0) {
+    HAL_FreePacket(packet);
+    return res;
+  }
+  packet->length = res > HAL_PACKET_SIZE ? HAL_PACKET_SIZE : res;
+  *o_packet = packet;
+  return res;
+}
+
+// for the backends that copy the packet when sending anyway
+static int HAL_SendPacketCopy(int if_index, hal_packet_t *packet,
+                              macaddr_t dst_mac) {
+  int res = HAL_SendIPPacket(if_index, packet->data, packet->length, dst_mac);
+  HAL_FreePacket(packet);
+  return res;
+}
+
+#endif
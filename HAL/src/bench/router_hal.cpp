@@ -0,0 +1,643 @@
+#include "router_hal.h"
+#include "router_hal_pool.h"
+#include <stdio.h>
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+
+// synthetic traffic for measuring the router code alone: IPv4 packets are
+// generated in memory, ARP is answered immediately and transmitted frames are
+// only counted. configured through the environment:
+//   HAL_BENCH_PACKETS  number of packets before EOF (10000000)
+//   HAL_BENCH_DIST     uniform, zipf or routes (uniform)
+//   HAL_BENCH_ROUTES   routes in the lookup format (I,addr,len,if,nexthop),
+//                      taught to the router with RIP before the traffic starts
+//   HAL_BENCH_FLOWS    number of distinct destinations for zipf (65536)
+//   HAL_BENCH_ZIPF     zipf exponent (1.0)
+//   HAL_BENCH_LENGTH   IP packet length (64)
+//   HAL_BENCH_SEED     random seed (1)
+//   HAL_BENCH_IPV6     IPv6 routes in the ROUTER_IPV6_ROUTES format
+//                      (prefix/len if_index [nexthop]); once the router calls
+//                      HAL_InitIPv6, every packet is IPv6 to an address drawn
+//                      from these prefixes
+// uniform draws from the whole address space, routes from the prefixes (the
+// interface subnets when no route file is given), zipf ranks flows that are
+// drawn like routes.
+
+// destinations are precomputed and replayed in a loop
+const size_t BENCH_POOL_SIZE = 1 << 20;
+const int BENCH_RIP_ENTRIES = 25;
+
+bool inited = false;
+int debugEnabled = 0;
+in_addr_t interface_addrs[N_IFACE_ON_BOARD] = {0};
+macaddr_t interface_mac[N_IFACE_ON_BOARD] = {0};
+
+struct BenchPrefix {
+  in_addr_t addr; // big endian
+  uint32_t len;
+  uint32_t if_index;
+};
+
+std::vector<BenchPrefix> bench_prefixes;
+std::vector<in_addr_t> bench_pool;
+
+struct BenchPrefix6 {
+  in6_addr_t addr;
+  uint32_t len;
+};
+
+std::vector<BenchPrefix6> bench_prefixes6;
+std::vector<in6_addr_t> bench_pool6;
+uint8_t bench_template6[2048];
+bool bench_ipv6 = false; // HAL_InitIPv6 has been called
+// RIP responses announcing bench_prefixes, received before the traffic
+std::vector<std::vector<uint8_t>> bench_rip;
+std::vector<int> bench_rip_if;
+size_t bench_rip_sent = 0;
+
+uint64_t bench_packets = 10000000;
+uint64_t bench_received = 0;
+uint32_t bench_length = 64;
+uint8_t bench_template[2048];
+// ones' complement sum of the template without the addresses
+uint32_t bench_sum = 0;
+int bench_port = 0;
+
+uint64_t bench_begin = 0;
+bool bench_reported = false;
+uint64_t bench_tx_packets[N_IFACE_ON_BOARD] = {0};
+uint64_t bench_tx_bytes[N_IFACE_ON_BOARD] = {0};
+
+uint64_t bench_seed = 1;
+
+static uint64_t HAL_BenchRandom() {
+  // xorshift64*
+  bench_seed ^= bench_seed >> 12;
+  bench_seed ^= bench_seed << 25;
+  bench_seed ^= bench_seed >> 27;
+  return bench_seed * 0x2545f4914f6cdd1dull;
+}
+
+static uint64_t HAL_BenchNanos() {
+  struct timespec tp = {0};
+  clock_gettime(CLOCK_MONOTONIC, &tp);
+  return (uint64_t)tp.tv_sec * 1000000000 + tp.tv_nsec;
+}
+
+static const char *HAL_BenchEnv(const char *name, const char *fallback) {
+  const char *value = getenv(name);
+  return value && value[0] ? value : fallback;
+}
+
+static bool HAL_BenchLoadRoutes(const char *path) {
+  FILE *fp = fopen(path, "r");
+  if (!fp) {
+    return false;
+  }
+  char line[256];
+  while (fgets(line, sizeof(line), fp)) {
+    if (line[0] != 'I' || line[1] != ',') {
+      continue;
+    }
+    char *p = line + 2;
+    BenchPrefix prefix;
+    prefix.addr = strtoul(p, &p, 0);
+    prefix.len = strtoul(p + 1, &p, 0);
+    prefix.if_index = strtoul(p + 1, &p, 0) % N_IFACE_ON_BOARD;
+    if (prefix.len > 32) {
+      continue;
+    }
+    bench_prefixes.push_back(prefix);
+  }
+  fclose(fp);
+  return true;
+}
+
+static bool HAL_BenchLoadRoutes6(const char *path) {
+  FILE *fp = fopen(path, "r");
+  if (!fp) {
+    return false;
+  }
+  char line[256];
+  while (fgets(line, sizeof(line), fp)) {
+    char prefix[128];
+    if (sscanf(line, "%127s", prefix) != 1 || prefix[0] == '#') {
+      continue;
+    }
+    char *slash = strchr(prefix, '/');
+    if (slash == NULL) {
+      continue;
+    }
+    *slash = '\0';
+    BenchPrefix6 route;
+    route.len = strtoul(slash + 1, NULL, 0);
+    if (route.len > 128 || inet_pton(AF_INET6, prefix, route.addr.addr) != 1) {
+      continue;
+    }
+    bench_prefixes6.push_back(route);
+  }
+  fclose(fp);
+  return true;
+}
+
+// a random address inside a random prefix
+static in_addr_t HAL_BenchRouteAddress() {
+  const BenchPrefix &prefix =
+      bench_prefixes[HAL_BenchRandom() % bench_prefixes.size()];
+  uint32_t host = prefix.len == 32 ? 0 : (uint32_t)HAL_BenchRandom() >> prefix.len;
+  return prefix.addr | htonl(host);
+}
+
+// the same for IPv6, drawn uniformly from the prefixes
+static in6_addr_t HAL_BenchRouteAddress6() {
+  const BenchPrefix6 &prefix =
+      bench_prefixes6[HAL_BenchRandom() % bench_prefixes6.size()];
+  in6_addr_t addr = prefix.addr;
+  for (int i = 0; i < 16; i++) {
+    int bits = (int)prefix.len - i * 8; // prefix bits in this byte
+    uint8_t mask = bits >= 8 ? 0xff : bits <= 0 ? 0 : (uint8_t)(0xff << (8 - bits));
+    addr.addr[i] = (addr.addr[i] & mask) | ((uint8_t)HAL_BenchRandom() & ~mask);
+  }
+  return addr;
+}
+
+static void HAL_BenchBuildPool(const char *dist) {
+  bench_pool.resize(BENCH_POOL_SIZE);
+  if (strcmp(dist, "zipf") == 0) {
+    size_t flows = strtoul(HAL_BenchEnv("HAL_BENCH_FLOWS", "65536"), NULL, 0);
+    double s = atof(HAL_BenchEnv("HAL_BENCH_ZIPF", "1.0"));
+    if (flows == 0) {
+      flows = 1;
+    }
+    std::vector<in_addr_t> flow_addrs(flows);
+    std::vector<double> cdf(flows);
+    double total = 0;
+    for (size_t i = 0; i < flows; i++) {
+      flow_addrs[i] = HAL_BenchRouteAddress();
+      total += 1.0 / pow((double)(i + 1), s);
+      cdf[i] = total;
+    }
+    for (size_t i = 0; i < BENCH_POOL_SIZE; i++) {
+      double u = (double)(HAL_BenchRandom() >> 11) / (1ull << 53) * total;
+      size_t lo = 0, hi = flows - 1;
+      while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (cdf[mid] < u) {
+          lo = mid + 1;
+        } else {
+          hi = mid;
+        }
+      }
+      bench_pool[i] = flow_addrs[lo];
+    }
+  } else if (strcmp(dist, "routes") == 0) {
+    for (size_t i = 0; i < BENCH_POOL_SIZE; i++) {
+      bench_pool[i] = HAL_BenchRouteAddress();
+    }
+  } else {
+    for (size_t i = 0; i < BENCH_POOL_SIZE; i++) {
+      bench_pool[i] = (in_addr_t)HAL_BenchRandom();
+    }
+  }
+}
+
+// the neighbor that announces routes on an interface: x.x.x.2 of its /24
+static in_addr_t HAL_BenchNeighbor(int if_index) {
+  return (interface_addrs[if_index] & 0x00ffffff) | 0x02000000;
+}
+
+static uint16_t HAL_BenchChecksum(const uint8_t *header) {
+  uint32_t sum = 0;
+  for (int i = 0; i < 20; i += 2) {
+    sum += (header[i] << 8) | header[i + 1];
+  }
+  while (sum >> 16) {
+    sum = (sum & 0xffff) + (sum >> 16);
+  }
+  return ~sum;
+}
+
+static void HAL_BenchBuildRip() {
+  std::vector<BenchPrefix> by_if[N_IFACE_ON_BOARD];
+  for (auto &prefix : bench_prefixes) {
+    by_if[prefix.if_index].push_back(prefix);
+  }
+  for (int i = 0; i < N_IFACE_ON_BOARD; i++) {
+    in_addr_t src = HAL_BenchNeighbor(i);
+    for (size_t begin = 0; begin < by_if[i].size();
+         begin += BENCH_RIP_ENTRIES) {
+      size_t count = by_if[i].size() - begin;
+      if (count > BENCH_RIP_ENTRIES) {
+        count = BENCH_RIP_ENTRIES;
+      }
+      size_t length = 20 + 8 + 4 + 20 * count;
+      std::vector<uint8_t> packet(length, 0);
+      uint8_t *p = packet.data();
+      // IP
+      p[0] = 0x45;
+      p[2] = length >> 8;
+      p[3] = length;
+      p[8] = 1;
+      p[9] = 17;
+      memcpy(&p[12], &src, sizeof(in_addr_t));
+      p[16] = 224;
+      p[19] = 9;
+      uint16_t checksum = HAL_BenchChecksum(p);
+      p[10] = checksum >> 8;
+      p[11] = checksum;
+      // UDP, no checksum
+      p[20] = p[22] = 0x02;
+      p[21] = p[23] = 0x08;
+      p[24] = (length - 20) >> 8;
+      p[25] = length - 20;
+      // RIP response, version 2
+      p[28] = 2;
+      p[29] = 2;
+      for (size_t j = 0; j < count; j++) {
+        const BenchPrefix &prefix = by_if[i][begin + j];
+        uint8_t *entry = &p[32 + 20 * j];
+        uint32_t mask = prefix.len == 0 ? 0 : htonl(~0u << (32 - prefix.len));
+        entry[1] = 2;
+        memcpy(&entry[4], &prefix.addr, sizeof(in_addr_t));
+        memcpy(&entry[8], &mask, sizeof(uint32_t));
+        memcpy(&entry[12], &src, sizeof(in_addr_t));
+        entry[19] = 1;
+      }
+      bench_rip.push_back(packet);
+      bench_rip_if.push_back(i);
+    }
+  }
+}
+
+static void HAL_BenchBuildTemplate() {
+  if (bench_length < 28) {
+    bench_length = 28;
+  }
+  if (bench_length > sizeof(bench_template)) {
+    bench_length = sizeof(bench_template);
+  }
+  uint8_t *p = bench_template;
+  memset(p, 0, bench_length);
+  // IP
+  p[0] = 0x45;
+  p[2] = bench_length >> 8;
+  p[3] = bench_length;
+  p[8] = 64;
+  p[9] = 17;
+  // UDP
+  p[20] = 0x30;
+  p[21] = 0x39;
+  p[22] = 0x30;
+  p[23] = 0x39;
+  p[24] = (bench_length - 20) >> 8;
+  p[25] = bench_length - 20;
+  // the checksum of each packet adds the addresses to this
+  for (int i = 0; i < 16; i += 2) {
+    bench_sum += (p[i] << 8) | p[i + 1];
+  }
+}
+
+static void HAL_BenchBuildTemplate6() {
+  size_t length = bench_length < 48 ? 48 : bench_length;
+  uint8_t *p = bench_template6;
+  memset(p, 0, length);
+  // IPv6, no header checksum
+  p[0] = 0x60;
+  p[4] = (length - 40) >> 8;
+  p[5] = length - 40;
+  p[6] = 17;
+  p[7] = 64;
+  // source 2001:db8::2, the destination is filled in per packet
+  p[8] = 0x20;
+  p[9] = 0x01;
+  p[10] = 0x0d;
+  p[11] = 0xb8;
+  p[23] = 2;
+  // UDP
+  p[40] = 0x30;
+  p[41] = 0x39;
+  p[42] = 0x30;
+  p[43] = 0x39;
+  p[44] = (length - 40) >> 8;
+  p[45] = length - 40;
+}
+
+static void HAL_BenchReport() {
+  uint64_t elapsed = HAL_BenchNanos() - bench_begin;
+  uint64_t tx_packets = 0, tx_bytes = 0;
+  for (int i = 0; i < N_IFACE_ON_BOARD; i++) {
+    tx_packets += bench_tx_packets[i];
+    tx_bytes += bench_tx_bytes[i];
+  }
+  double seconds = elapsed / 1e9;
+  fprintf(stderr,
+          "HAL bench: %llu packets in %.3f s, %.3f Mpps, %.1f ns/packet\n",
+          (unsigned long long)bench_received, seconds,
+          bench_received / seconds / 1e6,
+          bench_received ? (double)elapsed / bench_received : 0.0);
+  fprintf(stderr, "HAL bench: transmitted %llu frames, %llu bytes\n",
+          (unsigned long long)tx_packets, (unsigned long long)tx_bytes);
+  for (int i = 0; i < N_IFACE_ON_BOARD; i++) {
+    fprintf(stderr, "HAL bench:   if %d: %llu frames, %llu bytes\n", i,
+            (unsigned long long)bench_tx_packets[i],
+            (unsigned long long)bench_tx_bytes[i]);
+  }
+}
+
+extern "C" {
+int HAL_Init(int debug, in_addr_t if_addrs[N_IFACE_ON_BOARD]) {
+  if (inited) {
+    return 0;
+  }
+  debugEnabled = debug;
+
+  for (int i = 0; i < N_IFACE_ON_BOARD; i++) {
+    // hard coded MAC
+    macaddr_t mac = {2, 3, 3, 0, 0, (uint8_t)i};
+    memcpy(interface_mac[i], mac, sizeof(macaddr_t));
+  }
+  memcpy(interface_addrs, if_addrs, sizeof(interface_addrs));
+
+  bench_packets = strtoull(HAL_BenchEnv("HAL_BENCH_PACKETS", "10000000"), NULL, 0);
+  bench_length = strtoul(HAL_BenchEnv("HAL_BENCH_LENGTH", "64"), NULL, 0);
+  bench_seed = strtoull(HAL_BenchEnv("HAL_BENCH_SEED", "1"), NULL, 0);
+  if (bench_seed == 0) {
+    bench_seed = 1;
+  }
+  const char *dist = HAL_BenchEnv("HAL_BENCH_DIST", "uniform");
+  if (strcmp(dist, "uniform") != 0 && strcmp(dist, "zipf") != 0 &&
+      strcmp(dist, "routes") != 0) {
+    fprintf(stderr, "HAL_Init: unknown HAL_BENCH_DIST %s\n", dist);
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+
+  const char *routes = getenv("HAL_BENCH_ROUTES");
+  if (routes && routes[0]) {
+    if (!HAL_BenchLoadRoutes(routes)) {
+      fprintf(stderr, "HAL_Init: cannot read routes from %s\n", routes);
+      return HAL_ERR_INVALID_PARAMETER;
+    }
+    HAL_BenchBuildRip();
+  }
+  if (bench_prefixes.empty()) {
+    // the directly connected subnets are routable without any RIP
+    for (int i = 0; i < N_IFACE_ON_BOARD; i++) {
+      BenchPrefix prefix = {interface_addrs[i] & 0x00ffffff, 24, (uint32_t)i};
+      bench_prefixes.push_back(prefix);
+    }
+  }
+
+  HAL_BenchBuildPool(dist);
+  HAL_BenchBuildTemplate();
+
+  const char *routes6 = getenv("HAL_BENCH_IPV6");
+  if (routes6 && routes6[0]) {
+    if (!HAL_BenchLoadRoutes6(routes6) || bench_prefixes6.empty()) {
+      fprintf(stderr, "HAL_Init: cannot read IPv6 routes from %s\n", routes6);
+      return HAL_ERR_INVALID_PARAMETER;
+    }
+    bench_pool6.resize(BENCH_POOL_SIZE);
+    for (size_t i = 0; i < BENCH_POOL_SIZE; i++) {
+      bench_pool6[i] = HAL_BenchRouteAddress6();
+    }
+    HAL_BenchBuildTemplate6();
+  }
+  if (debugEnabled) {
+    fprintf(stderr,
+            "HAL_Init: %llu packets of %u bytes, %s destinations over %zu "
+            "prefixes, %zu RIP packets first\n",
+            (unsigned long long)bench_packets, bench_length, dist,
+            bench_prefixes.size(), bench_rip.size());
+  }
+
+  inited = true;
+  return 0;
+}
+
+uint64_t HAL_GetTicks() {
+  struct timespec tp = {0};
+  clock_gettime(CLOCK_MONOTONIC, &tp);
+  return (uint64_t)tp.tv_sec * 1000 + (uint64_t)tp.tv_nsec / 1000000;
+}
+
+int HAL_ArpGetMacAddress(int if_index, in_addr_t ip, macaddr_t o_mac) {
+  if (!inited) {
+    return HAL_ERR_CALLED_BEFORE_INIT;
+  }
+  if (if_index >= N_IFACE_ON_BOARD || if_index < 0) {
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+
+  if ((ip & 0xe0) == 0xe0) {
+    uint8_t multicasting_mac[6] = {0x01, 0, 0x5e, (uint8_t)((ip >> 8) & 0x7f), (uint8_t)(ip >> 16), (uint8_t)(ip >> 24)};
+    memcpy(o_mac, multicasting_mac, sizeof(macaddr_t));
+    return 0;
+  }
+
+  // every neighbor answers at once
+  o_mac[0] = 0x02;
+  o_mac[1] = 0x00;
+  memcpy(&o_mac[2], &ip, sizeof(in_addr_t));
+  return 0;
+}
+
+int HAL_ArpKeepAlive(int if_index, in_addr_t ip) {
+  macaddr_t mac;
+  return HAL_ArpGetMacAddress(if_index, ip, mac);
+}
+
+int HAL_ArpGetEntries(arpentry_t *o_entries, int max) {
+  if (!inited) {
+    return HAL_ERR_CALLED_BEFORE_INIT;
+  }
+  if (max < 0 || (max > 0 && o_entries == NULL)) {
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+  // every neighbor answers at once, there is no table to save
+  return 0;
+}
+
+int HAL_ArpAddEntry(int if_index, in_addr_t ip, macaddr_t mac) {
+  if (!inited) {
+    return HAL_ERR_CALLED_BEFORE_INIT;
+  }
+  if (if_index >= N_IFACE_ON_BOARD || if_index < 0) {
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+  return 0;
+}
+
+int HAL_InitIPv6(const in6_addr_t if_addrs[N_IFACE_ON_BOARD]) {
+  if (!inited) {
+    return HAL_ERR_CALLED_BEFORE_INIT;
+  }
+  bench_ipv6 = true;
+  return 0;
+}
+
+int HAL_NdGetMacAddress(int if_index, in6_addr_t ip, macaddr_t o_mac) {
+  if (!inited || !bench_ipv6) {
+    return HAL_ERR_CALLED_BEFORE_INIT;
+  }
+  if (if_index >= N_IFACE_ON_BOARD || if_index < 0) {
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+
+  if (ip.addr[0] == 0xff) {
+    o_mac[0] = 0x33;
+    o_mac[1] = 0x33;
+    memcpy(&o_mac[2], &ip.addr[12], 4);
+    return 0;
+  }
+
+  // every neighbor answers at once
+  o_mac[0] = 0x02;
+  o_mac[1] = 0x00;
+  memcpy(&o_mac[2], &ip.addr[12], 4);
+  return 0;
+}
+
+int HAL_SendIPPacketToNexthop(int if_index, uint8_t *buffer, size_t length,
+                              in_addr_t nexthop) {
+  // ARP never misses, nothing needs to wait
+  macaddr_t dst_mac;
+  int res = HAL_ArpGetMacAddress(if_index, nexthop, dst_mac);
+  if (res != 0) {
+    return res;
+  }
+  return HAL_SendIPPacket(if_index, buffer, length, dst_mac);
+}
+
+int HAL_SendPacket(int if_index, hal_packet_t *packet, macaddr_t dst_mac) {
+  // sending only counts the packet, nothing is copied
+  return HAL_SendPacketCopy(if_index, packet, dst_mac);
+}
+
+int HAL_SendPacketToNexthop(int if_index, hal_packet_t *packet,
+                            in_addr_t nexthop) {
+  macaddr_t dst_mac;
+  int res = HAL_ArpGetMacAddress(if_index, nexthop, dst_mac);
+  if (res != 0) {
+    HAL_FreePacket(packet);
+    return res;
+  }
+  return HAL_SendPacket(if_index, packet, dst_mac);
+}
+
+int HAL_GetInterfaceMacAddress(int if_index, macaddr_t o_mac) {
+  if (!inited) {
+    return HAL_ERR_CALLED_BEFORE_INIT;
+  }
+  if (if_index >= N_IFACE_ON_BOARD || if_index < 0) {
+    return HAL_ERR_IFACE_NOT_EXIST;
+  }
+
+  memcpy(o_mac, interface_mac[if_index], sizeof(macaddr_t));
+  return 0;
+}
+
+int HAL_ReceiveIPPacket(int if_index_mask, uint8_t *buffer, size_t length,
+                        macaddr_t src_mac, macaddr_t dst_mac, int64_t timeout,
+                        int *if_index) {
+  if (!inited) {
+    return HAL_ERR_CALLED_BEFORE_INIT;
+  }
+  if ((if_index_mask & ((1 << N_IFACE_ON_BOARD) - 1)) == 0 ||
+      (timeout < 0 && timeout != -1) || (if_index == NULL)) {
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+
+  // round robin over the requested interfaces
+  do {
+    bench_port = (bench_port + 1) % N_IFACE_ON_BOARD;
+  } while ((if_index_mask & (1 << bench_port)) == 0);
+  int port = bench_port;
+
+  if (bench_rip_sent < bench_rip.size()) {
+    // routes first, the time spent learning them is not measured
+    const std::vector<uint8_t> &packet = bench_rip[bench_rip_sent];
+    port = bench_rip_if[bench_rip_sent++];
+    in_addr_t src = HAL_BenchNeighbor(port);
+    size_t real_length = length > packet.size() ? packet.size() : length;
+    memcpy(buffer, packet.data(), real_length);
+    HAL_ArpGetMacAddress(port, src, src_mac);
+    uint8_t multicast_mac[6] = {0x01, 0x00, 0x5e, 0x00, 0x00, 0x09};
+    memcpy(dst_mac, multicast_mac, sizeof(macaddr_t));
+    *if_index = port;
+    return packet.size();
+  }
+
+  if (bench_received == bench_packets) {
+    if (!bench_reported) {
+      HAL_BenchReport();
+      bench_reported = true;
+    }
+    return HAL_ERR_EOF;
+  }
+  if (bench_received == 0) {
+    bench_begin = HAL_BenchNanos();
+  }
+
+  if (bench_ipv6 && !bench_pool6.empty()) {
+    const in6_addr_t &dst6 = bench_pool6[bench_received & (BENCH_POOL_SIZE - 1)];
+    bench_received++;
+    size_t length6 = bench_length < 48 ? 48 : bench_length;
+    size_t real_length = length > length6 ? length6 : length;
+    memcpy(buffer, bench_template6, real_length);
+    if (real_length >= 40) {
+      memcpy(&buffer[24], dst6.addr, 16);
+    }
+    // the MAC HAL_NdGetMacAddress would report for 2001:db8::2
+    macaddr_t neighbor = {0x02, 0x00, 0, 0, 0, 0x02};
+    memcpy(src_mac, neighbor, sizeof(macaddr_t));
+    memcpy(dst_mac, interface_mac[port], sizeof(macaddr_t));
+    *if_index = port;
+    return length6;
+  }
+
+  in_addr_t src = HAL_BenchNeighbor(port);
+  in_addr_t dst = bench_pool[bench_received & (BENCH_POOL_SIZE - 1)];
+  bench_received++;
+  size_t real_length = length > bench_length ? bench_length : length;
+  memcpy(buffer, bench_template, real_length);
+  if (real_length >= 20) {
+    memcpy(&buffer[12], &src, sizeof(in_addr_t));
+    memcpy(&buffer[16], &dst, sizeof(in_addr_t));
+    uint32_t sum = bench_sum;
+    const uint8_t *addrs = &buffer[12];
+    for (int i = 0; i < 8; i += 2) {
+      sum += (addrs[i] << 8) | addrs[i + 1];
+    }
+    while (sum >> 16) {
+      sum = (sum & 0xffff) + (sum >> 16);
+    }
+    buffer[10] = ~sum >> 8;
+    buffer[11] = ~sum;
+  }
+  // the neighbor's MAC as HAL_ArpGetMacAddress would report it
+  src_mac[0] = 0x02;
+  src_mac[1] = 0x00;
+  memcpy(&src_mac[2], &src, sizeof(in_addr_t));
+  memcpy(dst_mac, interface_mac[port], sizeof(macaddr_t));
+  *if_index = port;
+  return bench_length;
+}
+
+int HAL_SendIPPacket(int if_index, uint8_t *buffer, size_t length,
+                     macaddr_t dst_mac) {
+  if (!inited) {
+    return HAL_ERR_CALLED_BEFORE_INIT;
+  }
+  if (if_index >= N_IFACE_ON_BOARD || if_index < 0) {
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+  // counted, not copied
+  bench_tx_packets[if_index]++;
+  bench_tx_bytes[if_index] += length;
+  return 0;
+}
+}
@@ -1,7 +1,11 @@
 #include "router_hal.h"
+#include "router_hal_arp.h"
 #include "router_hal_common.h"
+#include "router_hal_nd.h"
+#include "router_hal_pool.h"
 #include <stdio.h>
 
+#include <errno.h>
 #include <ifaddrs.h>
 #include <linux/if_packet.h>
 #include <map>
@@ -33,8 +37,115 @@ macaddr_t interface_mac[N_IFACE_ON_BOARD] = {0};
 pcap_t *pcap_in_handles[N_IFACE_ON_BOARD];
 pcap_t *pcap_out_handles[N_IFACE_ON_BOARD];
 
-std::map<std::pair<in_addr_t, int>, macaddr_t> arp_table;
+// neighbor maintenance, all in milliseconds
+// a neighbor is reachable for this long after we last heard from it
+const uint64_t ARP_REACHABLE_TIME = 30000;
+// neighbors in use are refreshed this long before they become stale
+const uint64_t ARP_REFRESH_TIME = 5000;
+// interval between two probes of the same neighbor
+const uint64_t ARP_PROBE_INTERVAL = 1000;
+// neighbors not heard from for this long are removed
+const uint64_t ARP_EXPIRE_TIME = 60000;
+// how often the neighbor table is scanned
+const uint64_t ARP_MAINTAIN_INTERVAL = 200;
+
+struct ArpEntry {
+  macaddr_t mac;
+  uint64_t confirmed; // last time we heard from the neighbor
+  uint64_t used;      // last time it was needed to send a packet
+  uint64_t probed;    // last time we probed it
+  bool permanent;     // our own interfaces never expire
+};
+
+std::map<std::pair<in_addr_t, int>, ArpEntry> arp_table;
 std::map<std::pair<in_addr_t, int>, uint64_t> arp_timer;
+// coarse clock for the neighbor table, updated by HAL_ReceiveIPPacket
+uint64_t arp_now = 0;
+uint64_t arp_last_maintain = 0;
+
+// send an arp request for ip, unicast to dst_mac or broadcast if it is NULL
+static void HAL_ArpSendRequest(int if_index, in_addr_t ip,
+                               const uint8_t *dst_mac) {
+  uint8_t buffer[64] = {0};
+  // dst mac
+  if (dst_mac) {
+    memcpy(buffer, dst_mac, sizeof(macaddr_t));
+  } else {
+    for (int i = 0; i < 6; i++) {
+      buffer[i] = 0xff;
+    }
+  }
+  // src mac
+  macaddr_t mac;
+  HAL_GetInterfaceMacAddress(if_index, mac);
+  memcpy(&buffer[6], mac, sizeof(macaddr_t));
+  // ARP
+  buffer[12] = 0x08;
+  buffer[13] = 0x06;
+  // hardware type
+  buffer[15] = 0x01;
+  // protocol type
+  buffer[16] = 0x08;
+  // hardware size
+  buffer[18] = 0x06;
+  // protocol size
+  buffer[19] = 0x04;
+  // opcode
+  buffer[21] = 0x01;
+  // sender
+  memcpy(&buffer[22], mac, sizeof(macaddr_t));
+  memcpy(&buffer[28], &interface_addrs[if_index], sizeof(in_addr_t));
+  // target
+  if (dst_mac) {
+    memcpy(&buffer[32], dst_mac, sizeof(macaddr_t));
+  }
+  memcpy(&buffer[38], &ip, sizeof(in_addr_t));
+
+  pcap_inject(pcap_out_handles[if_index], buffer, sizeof(buffer));
+}
+
+// refresh neighbors in use before they go stale, remove dead ones
+static void HAL_ArpMaintain(uint64_t now) {
+  arp_now = now;
+  if (now < arp_last_maintain + ARP_MAINTAIN_INTERVAL) {
+    return;
+  }
+  arp_last_maintain = now;
+
+  for (auto it = arp_table.begin(); it != arp_table.end();) {
+    in_addr_t ip = it->first.first;
+    int if_index = it->first.second;
+    ArpEntry &entry = it->second;
+    if (entry.permanent) {
+      ++it;
+      continue;
+    }
+    if (now > entry.confirmed + ARP_EXPIRE_TIME) {
+      // the next lookup misses and resolves it again
+      if (debugEnabled) {
+        fprintf(stderr, "HAL_ArpMaintain: MAC address of %s expired\n",
+                inet_ntoa(in_addr{ip}));
+      }
+      it = arp_table.erase(it);
+      continue;
+    }
+    bool in_use = now < entry.used + ARP_REACHABLE_TIME;
+    bool refresh = now + ARP_REFRESH_TIME > entry.confirmed + ARP_REACHABLE_TIME;
+    if (in_use && refresh && now >= entry.probed + ARP_PROBE_INTERVAL &&
+        pcap_out_handles[if_index]) {
+      // keep using the old MAC meanwhile; unicast first, broadcast once
+      // stale in case the neighbor changed its MAC address
+      bool stale = now > entry.confirmed + ARP_REACHABLE_TIME;
+      if (debugEnabled) {
+        fprintf(stderr, "HAL_ArpMaintain: refreshing MAC address of %s\n",
+                inet_ntoa(in_addr{ip}));
+      }
+      HAL_ArpSendRequest(if_index, ip, stale ? NULL : entry.mac);
+      entry.probed = now;
+    }
+    ++it;
+  }
+}
 
 extern "C" {
 int HAL_Init(int debug, in_addr_t if_addrs[N_IFACE_ON_BOARD]) {
@@ -62,8 +173,9 @@ int HAL_Init(int debug, in_addr_t if_addrs[N_IFACE_ON_BOARD]) {
         memcpy(interface_mac[i],
                ((struct sockaddr_ll *)ifa->ifa_addr)->sll_addr,
                sizeof(macaddr_t));
-        memcpy(arp_table[std::pair<in_addr_t, int>(if_addrs[i], i)],
-               interface_mac[i], sizeof(macaddr_t));
+        ArpEntry &entry = arp_table[std::pair<in_addr_t, int>(if_addrs[i], i)];
+        memcpy(entry.mac, interface_mac[i], sizeof(macaddr_t));
+        entry.permanent = true;
         if (debugEnabled) {
           fprintf(stderr, "HAL_Init: found MAC addr of interface %s\n",
                   interfaces[i]);
@@ -99,6 +211,7 @@ int HAL_Init(int debug, in_addr_t if_addrs[N_IFACE_ON_BOARD]) {
 
   memcpy(interface_addrs, if_addrs, sizeof(interface_addrs));
 
+  arp_now = HAL_GetTicks();
   inited = true;
   // send igmp to join RIP multicast group
   for (int i = 0; i < N_IFACE_ON_BOARD; i++) {
@@ -138,7 +251,8 @@ int HAL_ArpGetMacAddress(int if_index, in_addr_t ip, macaddr_t o_mac) {
   // lookup arp table
   auto it = arp_table.find(std::pair<in_addr_t, int>(ip, if_index));
   if (it != arp_table.end()) {
-    memcpy(o_mac, it->second, sizeof(macaddr_t));
+    it->second.used = arp_now;
+    memcpy(o_mac, it->second.mac, sizeof(macaddr_t));
     return 0;
   } else if (pcap_out_handles[if_index] &&
              arp_timer[std::pair<in_addr_t, int>(ip, if_index)] + 1000 <
@@ -152,39 +266,67 @@ int HAL_ArpGetMacAddress(int if_index, in_addr_t ip, macaddr_t o_mac) {
           "HAL_ArpGetMacAddress: asking for ip address %s with arp request\n",
           inet_ntoa(in_addr{ip}));
     }
-    uint8_t buffer[64] = {0};
-    // dst mac
-    for (int i = 0; i < 6; i++) {
-      buffer[i] = 0xff;
-    }
-    // src mac
-    macaddr_t mac;
-    HAL_GetInterfaceMacAddress(if_index, mac);
-    memcpy(&buffer[6], mac, sizeof(macaddr_t));
-    // ARP
-    buffer[12] = 0x08;
-    buffer[13] = 0x06;
-    // hardware type
-    buffer[15] = 0x01;
-    // protocol type
-    buffer[16] = 0x08;
-    // hardware size
-    buffer[18] = 0x06;
-    // protocol size
-    buffer[19] = 0x04;
-    // opcode
-    buffer[21] = 0x01;
-    // sender
-    memcpy(&buffer[22], mac, sizeof(macaddr_t));
-    memcpy(&buffer[28], &interface_addrs[if_index], sizeof(in_addr_t));
-    // target
-    memcpy(&buffer[38], &ip, sizeof(in_addr_t));
-
-    pcap_inject(pcap_out_handles[if_index], buffer, sizeof(buffer));
+    HAL_ArpSendRequest(if_index, ip, NULL);
   }
   return HAL_ERR_IP_NOT_EXIST;
 }
 
+int HAL_ArpKeepAlive(int if_index, in_addr_t ip) {
+  if (!inited) {
+    return HAL_ERR_CALLED_BEFORE_INIT;
+  }
+  macaddr_t mac;
+  arp_now = HAL_GetTicks();
+  // marks it as used, or starts resolving it
+  return HAL_ArpGetMacAddress(if_index, ip, mac);
+}
+
+int HAL_ArpGetEntries(arpentry_t *o_entries, int max) {
+  if (!inited) {
+    return HAL_ERR_CALLED_BEFORE_INIT;
+  }
+  if (max < 0 || (max > 0 && o_entries == NULL)) {
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+  int n = 0;
+  for (auto it = arp_table.begin(); it != arp_table.end() && n < max; ++it) {
+    if (it->second.permanent) {
+      continue;
+    }
+    o_entries[n].ip = it->first.first;
+    o_entries[n].if_index = it->first.second;
+    memcpy(o_entries[n].mac, it->second.mac, sizeof(macaddr_t));
+    n++;
+  }
+  return n;
+}
+
+int HAL_ArpAddEntry(int if_index, in_addr_t ip, macaddr_t mac) {
+  if (!inited) {
+    return HAL_ERR_CALLED_BEFORE_INIT;
+  }
+  if (if_index >= N_IFACE_ON_BOARD || if_index < 0) {
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+  std::pair<in_addr_t, int> key(ip, if_index);
+  if (arp_table.find(key) != arp_table.end()) {
+    return 0;
+  }
+  arp_now = HAL_GetTicks();
+  ArpEntry &entry = arp_table[key];
+  memcpy(entry.mac, mac, sizeof(macaddr_t));
+  entry.confirmed = arp_now;
+  entry.used = arp_now;
+  entry.probed = arp_now;
+  entry.permanent = false;
+  // not heard from since we started, ask it directly; the reply confirms the
+  // entry, silence lets it expire as usual
+  if (pcap_out_handles[if_index]) {
+    HAL_ArpSendRequest(if_index, ip, mac);
+  }
+  return 0;
+}
+
 int HAL_GetInterfaceMacAddress(int if_index, macaddr_t o_mac) {
   if (!inited) {
     return HAL_ERR_CALLED_BEFORE_INIT;
@@ -223,11 +365,12 @@ int HAL_ReceiveIPPacket(int if_index_mask, uint8_t *buffer, size_t length,
   }
 
   int64_t begin = HAL_GetTicks();
-  int64_t current_time = 0;
+  int64_t current_time = begin;
   // Round robin
   int current_port = 0;
   struct pcap_pkthdr hdr;
   do {
+    HAL_ArpMaintain(current_time);
     if ((if_index_mask & (1 << current_port)) == 0 ||
         !pcap_in_handles[current_port]) {
       current_port = (current_port + 1) % N_IFACE_ON_BOARD;
@@ -240,9 +383,18 @@ int HAL_ReceiveIPPacket(int if_index_mask, uint8_t *buffer, size_t length,
             0) {
       // skip outbound
       continue;
-    } else if (packet && hdr.caplen >= IP_OFFSET && packet[12] == 0x08 &&
-               packet[13] == 0x00) {
-      // IPv4
+    } else if (packet && hdr.caplen >= IP_OFFSET && packet[12] == 0x86 &&
+               packet[13] == 0xdd &&
+               (!nd_enabled ||
+                HAL_NdInput(current_port, &packet[IP_OFFSET],
+                            hdr.caplen - IP_OFFSET, &packet[6],
+                            HAL_GetTicks()))) {
+      // IPv6 while it is off, or neighbor discovery
+      continue;
+    } else if (packet && hdr.caplen >= IP_OFFSET &&
+               ((packet[12] == 0x08 && packet[13] == 0x00) ||
+                (packet[12] == 0x86 && packet[13] == 0xdd))) {
+      // IPv4 or IPv6
       // TODO: what if len != caplen
       // Beware: might be larger than MTU because of offloading
       size_t ip_len = hdr.caplen - IP_OFFSET;
@@ -260,15 +412,42 @@ int HAL_ReceiveIPPacket(int if_index_mask, uint8_t *buffer, size_t length,
       memcpy(mac, &packet[22], sizeof(macaddr_t));
       in_addr_t ip;
       memcpy(&ip, &packet[28], sizeof(in_addr_t));
-      memcpy(arp_table[std::pair<in_addr_t, int>(ip, current_port)], mac,
-             sizeof(macaddr_t));
-      if (debugEnabled) {
-        fprintf(stderr, "HAL_ReceiveIPPacket: learned MAC address of %s\n",
-                inet_ntoa(in_addr{ip}));
-      }
-
       in_addr_t dst_ip;
       memcpy(&dst_ip, &packet[38], sizeof(in_addr_t));
+
+      // gratuitous arp announces the sender's own address
+      bool gratuitous = ip == dst_ip;
+      std::pair<in_addr_t, int> key(ip, current_port);
+      auto it = arp_table.find(key);
+      if (ip == interface_addrs[current_port] || ip == 0) {
+        // address conflict or probe, never overwrite our own entry
+        if (debugEnabled && ip != 0) {
+          fprintf(stderr,
+                  "HAL_ReceiveIPPacket: %s is claimed by another host\n",
+                  inet_ntoa(in_addr{ip}));
+        }
+      } else if (gratuitous && it == arp_table.end()) {
+        // only update neighbors we already know
+      } else {
+        if (debugEnabled) {
+          if (it == arp_table.end()) {
+            fprintf(stderr, "HAL_ReceiveIPPacket: learned MAC address of %s\n",
+                    inet_ntoa(in_addr{ip}));
+          } else if (memcmp(it->second.mac, mac, sizeof(macaddr_t)) != 0) {
+            fprintf(stderr,
+                    "HAL_ReceiveIPPacket: MAC address of %s changed%s\n",
+                    inet_ntoa(in_addr{ip}),
+                    gratuitous ? " (gratuitous arp)" : "");
+          }
+        }
+        ArpEntry &entry = arp_table[key];
+        memcpy(entry.mac, mac, sizeof(macaddr_t));
+        entry.confirmed = current_time;
+        // send the packets that were waiting for it
+        HAL_ArpExpirePending(current_time);
+        HAL_ArpFlushPending(current_port, ip, mac);
+      }
+
       // ask me: reply
       if (dst_ip == interface_addrs[current_port] && packet[21] == 0x01) {
         // reply
@@ -315,8 +494,7 @@ int HAL_ReceiveIPPacket(int if_index_mask, uint8_t *buffer, size_t length,
   return 0;
 }
 
-int HAL_SendIPPacket(int if_index, uint8_t *buffer, size_t length,
-                     macaddr_t dst_mac) {
+static int HAL_CheckSend(int if_index) {
   if (!inited) {
     return HAL_ERR_CALLED_BEFORE_INIT;
   }
@@ -326,24 +504,57 @@ int HAL_SendIPPacket(int if_index, uint8_t *buffer, size_t length,
   if (!pcap_out_handles[if_index]) {
     return HAL_ERR_IFACE_NOT_EXIST;
   }
-  uint8_t *eth_buffer = (uint8_t *)malloc(length + IP_OFFSET);
+  return 0;
+}
+
+// writes the Ethernet header into the IP_OFFSET bytes before packet and sends
+// the frame
+static int HAL_SendFrame(int if_index, uint8_t *packet, size_t length,
+                         macaddr_t dst_mac) {
+  uint8_t *eth_buffer = packet - IP_OFFSET;
   memcpy(eth_buffer, dst_mac, sizeof(macaddr_t));
   memcpy(&eth_buffer[6], interface_mac[if_index], sizeof(macaddr_t));
-  // IPv4
-  eth_buffer[12] = 0x08;
-  eth_buffer[13] = 0x00;
-  memcpy(&eth_buffer[IP_OFFSET], buffer, length);
+  if (length > 0 && (packet[0] >> 4) == 6) {
+    // IPv6
+    eth_buffer[12] = 0x86;
+    eth_buffer[13] = 0xdd;
+  } else {
+    // IPv4
+    eth_buffer[12] = 0x08;
+    eth_buffer[13] = 0x00;
+  }
   if (pcap_inject(pcap_out_handles[if_index], eth_buffer, length + IP_OFFSET) >=
       0) {
-    free(eth_buffer);
     return 0;
   } else {
     if (debugEnabled) {
-      fprintf(stderr, "HAL_SendIPPacket: pcap_inject failed with %s\n",
+      fprintf(stderr, "HAL_SendFrame: pcap_inject failed with %s\n",
               pcap_geterr(pcap_out_handles[if_index]));
     }
-    free(eth_buffer);
     return HAL_ERR_UNKNOWN;
   }
 }
+
+int HAL_SendIPPacket(int if_index, uint8_t *buffer, size_t length,
+                     macaddr_t dst_mac) {
+  int res = HAL_CheckSend(if_index);
+  if (res != 0) {
+    return res;
+  }
+  uint8_t *eth_buffer = (uint8_t *)malloc(length + IP_OFFSET);
+  memcpy(&eth_buffer[IP_OFFSET], buffer, length);
+  res = HAL_SendFrame(if_index, &eth_buffer[IP_OFFSET], length, dst_mac);
+  free(eth_buffer);
+  return res;
+}
+
+int HAL_SendPacket(int if_index, hal_packet_t *packet, macaddr_t dst_mac) {
+  int res = HAL_CheckSend(if_index);
+  if (res == 0) {
+    // the header goes into the headroom, the packet itself is not copied
+    res = HAL_SendFrame(if_index, packet->data, packet->length, dst_mac);
+  }
+  HAL_FreePacket(packet);
+  return res;
+}
 }
\ No newline at end of file
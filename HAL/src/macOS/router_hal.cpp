@@ -1,5 +1,8 @@
 #include "router_hal.h"
+#include "router_hal_arp.h"
 #include "router_hal_common.h"
+#include "router_hal_nd.h"
+#include "router_hal_pool.h"
 #include <stdio.h>
 
 #include <ifaddrs.h>
@@ -229,6 +232,48 @@ int HAL_ArpGetMacAddress(int if_index, in_addr_t ip, macaddr_t o_mac) {
   return HAL_ERR_IP_NOT_EXIST;
 }
 
+int HAL_ArpKeepAlive(int if_index, in_addr_t ip) {
+  // no neighbor maintenance here, just make sure it gets resolved
+  macaddr_t mac;
+  return HAL_ArpGetMacAddress(if_index, ip, mac);
+}
+
+int HAL_ArpGetEntries(arpentry_t *o_entries, int max) {
+  if (!inited) {
+    return HAL_ERR_CALLED_BEFORE_INIT;
+  }
+  if (max < 0 || (max > 0 && o_entries == NULL)) {
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+  int n = 0;
+  for (auto it = arp_table.begin(); it != arp_table.end() && n < max; ++it) {
+    // our own interfaces are in the table too
+    if (it->first.first == interface_addrs[it->first.second]) {
+      continue;
+    }
+    o_entries[n].ip = it->first.first;
+    o_entries[n].if_index = it->first.second;
+    memcpy(o_entries[n].mac, &it->second, sizeof(macaddr_t));
+    n++;
+  }
+  return n;
+}
+
+int HAL_ArpAddEntry(int if_index, in_addr_t ip, macaddr_t mac) {
+  if (!inited) {
+    return HAL_ERR_CALLED_BEFORE_INIT;
+  }
+  if (if_index >= N_IFACE_ON_BOARD || if_index < 0) {
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+  std::pair<in_addr_t, int> key(ip, if_index);
+  if (arp_table.find(key) == arp_table.end()) {
+    // no neighbor maintenance here, it stays until a reply overwrites it
+    memcpy(&arp_table[key], mac, sizeof(macaddr_t));
+  }
+  return 0;
+}
+
 int HAL_GetInterfaceMacAddress(int if_index, macaddr_t o_mac) {
   if (!inited) {
     return HAL_ERR_CALLED_BEFORE_INIT;
@@ -284,9 +329,18 @@ int HAL_ReceiveIPPacket(int if_index_mask, uint8_t *buffer, size_t length,
             0) {
       // skip outbound
       continue;
-    } else if (packet && hdr.caplen >= IP_OFFSET && packet[12] == 0x08 &&
-               packet[13] == 0x00) {
-      // IPv4
+    } else if (packet && hdr.caplen >= IP_OFFSET && packet[12] == 0x86 &&
+               packet[13] == 0xdd &&
+               (!nd_enabled ||
+                HAL_NdInput(current_port, &packet[IP_OFFSET],
+                            hdr.caplen - IP_OFFSET, &packet[6],
+                            HAL_GetTicks()))) {
+      // IPv6 while it is off, or neighbor discovery
+      continue;
+    } else if (packet && hdr.caplen >= IP_OFFSET &&
+               ((packet[12] == 0x08 && packet[13] == 0x00) ||
+                (packet[12] == 0x86 && packet[13] == 0xdd))) {
+      // IPv4 or IPv6
       // TODO: what if len != caplen
       size_t ip_len = hdr.caplen - IP_OFFSET;
       size_t real_length = length > ip_len ? ip_len : length;
@@ -304,6 +358,9 @@ int HAL_ReceiveIPPacket(int if_index_mask, uint8_t *buffer, size_t length,
       memcpy(&ip, &packet[28], sizeof(in_addr_t));
       memcpy(&arp_table[std::pair<in_addr_t, int>(ip, current_port)], mac,
              sizeof(macaddr_t));
+      // send the packets that were waiting for it
+      HAL_ArpExpirePending(HAL_GetTicks());
+      HAL_ArpFlushPending(current_port, ip, mac);
       if (debugEnabled) {
         struct in_addr addr;
         addr.s_addr = ip;
@@ -359,8 +416,7 @@ int HAL_ReceiveIPPacket(int if_index_mask, uint8_t *buffer, size_t length,
   return 0;
 }
 
-int HAL_SendIPPacket(int if_index, uint8_t *buffer, size_t length,
-                     macaddr_t dst_mac) {
+static int HAL_CheckSend(int if_index) {
   if (!inited) {
     return HAL_ERR_CALLED_BEFORE_INIT;
   }
@@ -370,24 +426,57 @@ int HAL_SendIPPacket(int if_index, uint8_t *buffer, size_t length,
   if (!pcap_out_handles[if_index]) {
     return HAL_ERR_IFACE_NOT_EXIST;
   }
-  uint8_t *eth_buffer = (uint8_t *)malloc(length + IP_OFFSET);
+  return 0;
+}
+
+// writes the Ethernet header into the IP_OFFSET bytes before packet and sends
+// the frame
+static int HAL_SendFrame(int if_index, uint8_t *packet, size_t length,
+                         macaddr_t dst_mac) {
+  uint8_t *eth_buffer = packet - IP_OFFSET;
   memcpy(eth_buffer, dst_mac, sizeof(macaddr_t));
   memcpy(&eth_buffer[6], interface_mac[if_index], sizeof(macaddr_t));
-  // IPv4
-  eth_buffer[12] = 0x08;
-  eth_buffer[13] = 0x00;
-  memcpy(&eth_buffer[IP_OFFSET], buffer, length);
+  if (length > 0 && (packet[0] >> 4) == 6) {
+    // IPv6
+    eth_buffer[12] = 0x86;
+    eth_buffer[13] = 0xdd;
+  } else {
+    // IPv4
+    eth_buffer[12] = 0x08;
+    eth_buffer[13] = 0x00;
+  }
   if (pcap_inject(pcap_out_handles[if_index], eth_buffer, length + IP_OFFSET) >=
       0) {
-    free(eth_buffer);
     return 0;
   } else {
     if (debugEnabled) {
-      fprintf(stderr, "HAL_SendIPPacket: pcap_inject failed with %s\n",
+      fprintf(stderr, "HAL_SendFrame: pcap_inject failed with %s\n",
               pcap_geterr(pcap_out_handles[if_index]));
     }
-    free(eth_buffer);
     return HAL_ERR_UNKNOWN;
   }
 }
+
+int HAL_SendIPPacket(int if_index, uint8_t *buffer, size_t length,
+                     macaddr_t dst_mac) {
+  int res = HAL_CheckSend(if_index);
+  if (res != 0) {
+    return res;
+  }
+  uint8_t *eth_buffer = (uint8_t *)malloc(length + IP_OFFSET);
+  memcpy(&eth_buffer[IP_OFFSET], buffer, length);
+  res = HAL_SendFrame(if_index, &eth_buffer[IP_OFFSET], length, dst_mac);
+  free(eth_buffer);
+  return res;
+}
+
+int HAL_SendPacket(int if_index, hal_packet_t *packet, macaddr_t dst_mac) {
+  int res = HAL_CheckSend(if_index);
+  if (res == 0) {
+    // the header goes into the headroom, the packet itself is not copied
+    res = HAL_SendFrame(if_index, packet->data, packet->length, dst_mac);
+  }
+  HAL_FreePacket(packet);
+  return res;
+}
 }
\ No newline at end of file
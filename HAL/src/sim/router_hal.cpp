@@ -0,0 +1,1372 @@
+#include "router_hal.h"
+#include "router_hal_pool.h"
+#include <stdio.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <algorithm>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <new>
+#include <pthread.h>
+#include <queue>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <time.h>
+#include <unordered_map>
+#include <vector>
+
+// many routers in one process: every router runs the boilerplate main (built
+// as router_main) in its own thread, and the interfaces are connected by
+// in-memory links read from a topology file:
+//
+//   # comment
+//   router <name> [<if0 addr> [<if1 addr> ...]]
+//   link <name>[:<if>] <name>[:<if>] [<latency ms> [<loss>]]
+//   routes <name>:<if> <count> [<prefix length>]
+//   down <seconds> <name>:<if>
+//   up <seconds> <name>:<if>
+//   withdraw <seconds> <name>:<if>
+//
+// routers are also created by the first link that names them. interfaces
+// without an address get one: both ends of a link share a /24 (the one of
+// the other end if that was given, 10.x.y.0/24 otherwise), unconnected
+// interfaces get a /24 of their own out of 100.64.0.0/10.
+//
+// routes puts a RIP neighbor on an unconnected interface that announces
+// <count> prefixes (/24 by default, taken from 32.0.0.0 on) every 30 seconds.
+// down and up cut and restore the link of an interface at the given time,
+// withdraw makes the neighbor announce its prefixes with metric 16 once and
+// go quiet.
+//
+// usage: ./boilerplate <topology file> [<seconds>]
+// when the time is up every router gets EOF, then traffic, RIP volume, CPU
+// time, peak heap usage and the time of the last new RIP advertisement are
+// reported. the events split the run into phases. from the links up and the
+// neighbors still announcing in a phase, each router should end up with the
+// /24 of every interface and the announced prefixes it can reach in fewer
+// than 16 hops, and nothing else. a phase has converged once the FIB of every
+// router holds exactly that and keeps it to the end of the phase; it reports
+// when that happened, how many routers were still wrong at its end and how
+// many RIP bytes were sent. the FIB is probed with query of lookup.cpp: every
+// prefix it should hold must resolve, and every other prefix of the topology
+// must miss. routes are not counted, so an aggregated FIB is judged the same.
+//
+// time is virtual unless HAL_SIM_CLOCK=real: routers take no time to process
+// a packet, and once all of them wait in HAL_ReceiveIPPacket the clock jumps
+// to the next timeout or packet delivery, so hours of RIP timers take
+// seconds. with the real clock the simulation runs at wall clock speed.
+
+// stack of each router thread
+const size_t SIM_STACK_SIZE = 512 * 1024;
+const uint16_t RIP_PORT = 520;
+const int SIM_RIP_ENTRIES = 25;
+const uint64_t SIM_RIP_PERIOD = 30 * 1000000; // us
+// a RIP packet not sent for this long is new again when it comes back
+const uint64_t SIM_RIP_REFRESH = 35 * 1000000; // us
+// routes of this metric are unreachable, the metric grows by one per hop
+const int SIM_RIP_INFINITY = 16;
+// a FIB found right is probed again after this long even if its route count
+// did not change
+const uint64_t SIM_PROBE_INTERVAL = 1000000; // us
+// in front of every block from operator new: owner and size
+const size_t SIM_HEAP_HEADER = 16;
+
+enum SimFrameKind {
+  SIM_FRAME_DATA,
+  // events of the topology file, delivered to the router they concern
+  SIM_FRAME_SPEAK,
+  SIM_FRAME_DOWN,
+  SIM_FRAME_UP,
+  SIM_FRAME_WITHDRAW,
+};
+
+struct SimFrame {
+  uint64_t deliver_at; // us
+  uint64_t seq;
+  SimFrameKind kind;
+  int if_index;
+  size_t length;
+  uint8_t *data;
+  macaddr_t src_mac;
+  macaddr_t dst_mac;
+};
+
+struct SimFrameLater {
+  bool operator()(const SimFrame &a, const SimFrame &b) const {
+    return a.deliver_at > b.deliver_at ||
+           (a.deliver_at == b.deliver_at && a.seq > b.seq);
+  }
+};
+
+struct SimPort {
+  int peer; // router index, -1 when unconnected
+  int peer_if;
+  uint64_t latency; // us
+  double loss;
+  bool explicit_addr;
+  std::atomic<bool> down;
+  // contents of the RIP packets sent on this port -> when last sent
+  std::unordered_map<uint64_t, uint64_t> rip_sent;
+  // RIP neighbor of the routes line
+  uint32_t speaker_routes;
+  uint32_t speaker_first; // host byte order
+  uint32_t speaker_len;
+  bool speaker_withdrawn;
+};
+
+struct SimRouter {
+  std::string name;
+  int index;
+  in_addr_t addrs[N_IFACE_ON_BOARD];
+  macaddr_t macs[N_IFACE_ON_BOARD];
+  SimPort ports[N_IFACE_ON_BOARD];
+  std::string argv_addrs[N_IFACE_ON_BOARD];
+  bool inited;
+  int debug;
+  // link local and global address of each interface once IPv6 is on
+  bool ipv6;
+  in6_addr_t addrs6[N_IFACE_ON_BOARD][2];
+
+  // frames on their way to this router, guarded by *lock: the router's own
+  // mutex with the real clock, sim_clock_mutex with the virtual one
+  std::mutex own_mutex;
+  std::mutex *lock;
+  std::condition_variable cond;
+  std::priority_queue<SimFrame, std::vector<SimFrame>, SimFrameLater> inbox;
+  uint64_t seq;
+
+  // virtual clock: waiting in HAL_ReceiveIPPacket until wake_at
+  bool blocked;
+  uint64_t wake_at;
+  uint64_t wake_gen;
+
+  // written by the router's own thread only
+  uint64_t tx_frames, tx_bytes;
+  uint64_t rx_frames, rx_bytes;
+  uint64_t rip_frames, rip_bytes;
+  uint64_t lost;
+  uint64_t last_rip_change; // us, 0 when never
+  std::vector<uint64_t> phase_rip_bytes;
+  // prefixes the FIB should hold in each phase, big endian
+  std::vector<std::vector<uint32_t>> expected;
+  // the other prefixes of the topology, which it should not
+  std::vector<std::vector<uint32_t>> unexpected;
+  // last probe of the FIB: its phase, route count, whether it was right, since
+  // when and when it was looked up
+  size_t fib_phase;
+  uint32_t fib_count;
+  bool fib_ok;
+  bool fib_dirty; // the router ran since the last probe
+  uint64_t fib_since;
+  uint64_t fib_checked;
+  // the same at the end of each phase
+  std::vector<bool> phase_fib_ok;
+  std::vector<uint64_t> phase_fib_since;
+  // operator new of this router's thread and the bytes handed out by the
+  // arenas it created, which the range FIB builder thread also cuts from
+  std::atomic<int64_t> heap_bytes;
+  std::atomic<int64_t> heap_peak;
+  uint64_t cpu_ns;
+  uint64_t random;
+  int exit_code;
+};
+
+std::vector<SimRouter *> sim_routers;
+size_t sim_links = 0;
+uint64_t sim_begin = 0; // CLOCK_MONOTONIC, us
+uint64_t sim_end = 0;   // us after sim_begin
+thread_local SimRouter *sim_self = NULL;
+// whose heap operator new charges, NULL inside the HAL
+thread_local SimRouter *sim_heap_owner = NULL;
+
+// phases begin at 0 and at every down, up or withdraw
+std::vector<uint64_t> sim_phases;
+std::vector<std::string> sim_phase_names;
+// next prefix handed to a RIP neighbor, host byte order
+uint32_t sim_next_prefix = 0x20000000;
+
+static void HAL_SimCharge(SimRouter *owner, int64_t size) {
+  int64_t bytes = owner->heap_bytes += size;
+  int64_t peak = owner->heap_peak.load(std::memory_order_relaxed);
+  while (bytes > peak && !owner->heap_peak.compare_exchange_weak(peak, bytes)) {
+  }
+}
+
+// declared in router_hal_arena.h: arenas are charged to the router whose
+// thread created them, the packet pool of the HAL to nobody
+static void *HAL_SimArenaOwner() { return sim_heap_owner; }
+
+static void HAL_SimArenaCharge(void *owner, int64_t bytes) {
+  if (owner) {
+    HAL_SimCharge((SimRouter *)owner, bytes);
+  }
+}
+
+// keeps the HAL's own allocations off the router's heap usage
+struct SimHeapPause {
+  SimRouter *owner;
+  SimHeapPause() : owner(sim_heap_owner) { sim_heap_owner = NULL; }
+  ~SimHeapPause() { sim_heap_owner = owner; }
+};
+
+// virtual clock
+struct SimWakeup {
+  uint64_t wake_at;
+  uint64_t gen; // stale once the router's wake_gen moved on
+  int router;
+  bool operator>(const SimWakeup &other) const {
+    return wake_at > other.wake_at;
+  }
+};
+bool sim_virtual = true;
+std::atomic<uint64_t> sim_now(0);
+std::mutex sim_clock_mutex;
+// routers that are not blocked, the clock only moves when this is zero
+int sim_active = 0;
+std::priority_queue<SimWakeup, std::vector<SimWakeup>, std::greater<SimWakeup>>
+    sim_wakeups;
+
+extern int router_main(int argc, char *argv[]);
+// the FIB of the calling router thread, from lookup.cpp
+extern uint32_t routeCount();
+extern bool query(uint32_t addr, uint32_t *nexthop, uint32_t *if_index);
+
+static uint64_t HAL_SimClock() {
+  struct timespec tp = {0};
+  clock_gettime(CLOCK_MONOTONIC, &tp);
+  return (uint64_t)tp.tv_sec * 1000000 + tp.tv_nsec / 1000;
+}
+
+// microseconds since the simulation started
+static uint64_t HAL_SimNow() {
+  if (sim_virtual) {
+    return sim_now.load(std::memory_order_acquire);
+  }
+  return HAL_SimClock() - sim_begin;
+}
+
+// called with sim_clock_mutex held
+static void HAL_SimWake(SimRouter *router) {
+  router->blocked = false;
+  sim_active++;
+  router->cond.notify_one();
+}
+
+// called with sim_clock_mutex held when no router is active: move the clock
+// to the earliest wakeup and release every router due by then
+static void HAL_SimAdvance() {
+  while (!sim_wakeups.empty()) {
+    const SimWakeup &top = sim_wakeups.top();
+    SimRouter *router = sim_routers[top.router];
+    if (router->blocked && router->wake_gen == top.gen &&
+        router->wake_at == top.wake_at) {
+      break;
+    }
+    sim_wakeups.pop();
+  }
+  if (sim_wakeups.empty()) {
+    // every router has finished
+    return;
+  }
+  if (sim_wakeups.top().wake_at > sim_now.load()) {
+    sim_now.store(sim_wakeups.top().wake_at, std::memory_order_release);
+  }
+  while (!sim_wakeups.empty() && sim_wakeups.top().wake_at <= sim_now.load()) {
+    SimWakeup wakeup = sim_wakeups.top();
+    sim_wakeups.pop();
+    SimRouter *router = sim_routers[wakeup.router];
+    if (router->blocked && router->wake_gen == wakeup.gen &&
+        router->wake_at == wakeup.wake_at) {
+      HAL_SimWake(router);
+    }
+  }
+}
+
+// block the calling router until wake_at or until a frame arrives earlier
+static void HAL_SimBlock(SimRouter *router, std::unique_lock<std::mutex> &lock,
+                         uint64_t wake_at) {
+  router->blocked = true;
+  router->wake_at = wake_at;
+  router->wake_gen++;
+  SimWakeup wakeup = {wake_at, router->wake_gen, router->index};
+  sim_wakeups.push(wakeup);
+  if (--sim_active == 0) {
+    HAL_SimAdvance();
+  }
+  router->cond.wait(lock, [router] { return !router->blocked; });
+}
+
+// a frame for peer becomes deliverable at deliver_at
+static void HAL_SimSchedule(SimRouter *peer, uint64_t deliver_at) {
+  if (!peer->blocked || deliver_at >= peer->wake_at) {
+    return;
+  }
+  if (deliver_at <= sim_now.load()) {
+    HAL_SimWake(peer);
+    return;
+  }
+  peer->wake_at = deliver_at;
+  SimWakeup wakeup = {deliver_at, peer->wake_gen, peer->index};
+  sim_wakeups.push(wakeup);
+}
+
+static size_t HAL_SimPhase(uint64_t now) {
+  return std::upper_bound(sim_phases.begin(), sim_phases.end(), now) -
+         sim_phases.begin() - 1;
+}
+
+// called on the router's own thread: compare its FIB with what it should
+// hold now. every expected prefix is looked up and must resolve, every
+// unexpected one must miss. a FIB that was right is taken to stay right while
+// its route count does not change, for at most SIM_PROBE_INTERVAL
+static void HAL_SimProbe(SimRouter *router, uint64_t now) {
+  size_t phase = HAL_SimPhase(now);
+  const std::vector<uint32_t> &expected = router->expected[phase];
+  const std::vector<uint32_t> &unexpected = router->unexpected[phase];
+  uint32_t count = routeCount();
+  bool ok = router->fib_ok;
+  if (phase != router->fib_phase || count != router->fib_count ||
+      (router->fib_dirty &&
+       (!ok || now >= router->fib_checked + SIM_PROBE_INTERVAL))) {
+    uint32_t nexthop, if_index;
+    ok = true;
+    for (size_t i = 0; ok && i < expected.size(); i++) {
+      ok = query(expected[i], &nexthop, &if_index);
+    }
+    for (size_t i = 0; ok && i < unexpected.size(); i++) {
+      ok = !query(unexpected[i], &nexthop, &if_index);
+    }
+    router->fib_checked = now;
+  }
+  if (phase != router->fib_phase) {
+    // the router has not run since the phase began
+    router->fib_phase = phase;
+    router->fib_since = sim_phases[phase];
+  } else if (ok && !router->fib_ok) {
+    router->fib_since = now;
+  }
+  router->fib_ok = ok;
+  router->fib_count = count;
+  router->fib_dirty = false;
+  router->phase_fib_ok[phase] = ok;
+  router->phase_fib_since[phase] = router->fib_since;
+}
+
+static uint16_t HAL_SimChecksum(const uint8_t *header) {
+  uint32_t sum = 0;
+  for (int i = 0; i < 20; i += 2) {
+    sum += (header[i] << 8) | header[i + 1];
+  }
+  while (sum >> 16) {
+    sum = (sum & 0xffff) + (sum >> 16);
+  }
+  return ~sum;
+}
+
+// called with router->lock held: the RIP neighbor on if_index announces its
+// prefixes, the responses are received right away
+static void HAL_SimSpeak(SimRouter *router, int if_index, uint8_t metric,
+                         uint64_t now) {
+  SimPort &port = router->ports[if_index];
+  if (port.down) {
+    return;
+  }
+  uint32_t host = (router->addrs[if_index] >> 24) == 1 ? 2 : 1;
+  in_addr_t src = (router->addrs[if_index] & 0x00ffffff) | host << 24;
+  uint32_t mask = htonl(~0u << (32 - port.speaker_len));
+  uint32_t step = port.speaker_len == 32 ? 1 : 1u << (32 - port.speaker_len);
+  for (uint32_t begin = 0; begin < port.speaker_routes;
+       begin += SIM_RIP_ENTRIES) {
+    uint32_t count = port.speaker_routes - begin;
+    if (count > SIM_RIP_ENTRIES) {
+      count = SIM_RIP_ENTRIES;
+    }
+    SimFrame frame;
+    frame.deliver_at = now;
+    frame.seq = router->seq++;
+    frame.kind = SIM_FRAME_DATA;
+    frame.if_index = if_index;
+    frame.length = 20 + 8 + 4 + 20 * count;
+    frame.data = (uint8_t *)calloc(frame.length, 1);
+    uint8_t *p = frame.data;
+    // IP
+    p[0] = 0x45;
+    p[2] = frame.length >> 8;
+    p[3] = frame.length;
+    p[8] = 1;
+    p[9] = 17;
+    memcpy(&p[12], &src, sizeof(in_addr_t));
+    p[16] = 224;
+    p[19] = 9;
+    uint16_t checksum = HAL_SimChecksum(p);
+    p[10] = checksum >> 8;
+    p[11] = checksum;
+    // UDP, no checksum
+    p[20] = p[22] = 0x02;
+    p[21] = p[23] = 0x08;
+    p[24] = (frame.length - 20) >> 8;
+    p[25] = frame.length - 20;
+    // RIP response, version 2
+    p[28] = 2;
+    p[29] = 2;
+    for (uint32_t j = 0; j < count; j++) {
+      uint8_t *entry = &p[32 + 20 * j];
+      uint32_t addr = htonl(port.speaker_first + (begin + j) * step);
+      entry[1] = 2;
+      memcpy(&entry[4], &addr, sizeof(uint32_t));
+      memcpy(&entry[8], &mask, sizeof(uint32_t));
+      memcpy(&entry[12], &src, sizeof(in_addr_t));
+      entry[19] = metric;
+    }
+    macaddr_t src_mac = {2, 1, (uint8_t)(router->index >> 8),
+                         (uint8_t)router->index, 0, (uint8_t)if_index};
+    macaddr_t dst_mac = {0x01, 0x00, 0x5e, 0x00, 0x00, 0x09};
+    memcpy(frame.src_mac, src_mac, sizeof(macaddr_t));
+    memcpy(frame.dst_mac, dst_mac, sizeof(macaddr_t));
+    router->inbox.push(frame);
+  }
+}
+
+// called with router->lock held when an event of the topology file is due
+static void HAL_SimEvent(SimRouter *router, const SimFrame &event,
+                         uint64_t now) {
+  SimPort &port = router->ports[event.if_index];
+  switch (event.kind) {
+  case SIM_FRAME_SPEAK:
+    if (!port.speaker_withdrawn) {
+      HAL_SimSpeak(router, event.if_index, 1, now);
+      SimFrame next = event;
+      next.deliver_at = now + SIM_RIP_PERIOD;
+      next.seq = router->seq++;
+      router->inbox.push(next);
+    }
+    break;
+  case SIM_FRAME_WITHDRAW:
+    if (!port.speaker_withdrawn) {
+      port.speaker_withdrawn = true;
+      HAL_SimSpeak(router, event.if_index, 16, now);
+    }
+    break;
+  case SIM_FRAME_DOWN:
+  case SIM_FRAME_UP:
+    // frames still on the wire are dropped on arrival
+    port.down = event.kind == SIM_FRAME_DOWN;
+    if (port.peer >= 0) {
+      sim_routers[port.peer]->ports[port.peer_if].down =
+          event.kind == SIM_FRAME_DOWN;
+    }
+    break;
+  default:
+    break;
+  }
+}
+
+static double HAL_SimRandom(SimRouter *router) {
+  // xorshift64*
+  router->random ^= router->random >> 12;
+  router->random ^= router->random << 25;
+  router->random ^= router->random >> 27;
+  return (router->random * 0x2545f4914f6cdd1dull >> 11) / (double)(1ull << 53);
+}
+
+static uint64_t HAL_SimHash(const uint8_t *data, size_t length) {
+  // FNV-1a
+  uint64_t hash = 0xcbf29ce484222325ull;
+  for (size_t i = 0; i < length; i++) {
+    hash = (hash ^ data[i]) * 0x100000001b3ull;
+  }
+  return hash;
+}
+
+static SimRouter *HAL_SimRouter(std::map<std::string, int> &names,
+                                const std::string &name) {
+  auto it = names.find(name);
+  if (it != names.end()) {
+    return sim_routers[it->second];
+  }
+  SimRouter *router = new SimRouter();
+  router->name = name;
+  router->index = sim_routers.size();
+  for (int i = 0; i < N_IFACE_ON_BOARD; i++) {
+    router->addrs[i] = 0;
+    router->ports[i].peer = -1;
+    router->ports[i].peer_if = -1;
+    router->ports[i].latency = 0;
+    router->ports[i].loss = 0;
+    router->ports[i].explicit_addr = false;
+    router->ports[i].down = false;
+    router->ports[i].speaker_routes = 0;
+    router->ports[i].speaker_first = 0;
+    router->ports[i].speaker_len = 0;
+    router->ports[i].speaker_withdrawn = false;
+    macaddr_t mac = {2, 0, (uint8_t)(router->index >> 8),
+                     (uint8_t)router->index, 0, (uint8_t)i};
+    memcpy(router->macs[i], mac, sizeof(macaddr_t));
+  }
+  router->inited = false;
+  router->debug = 0;
+  router->ipv6 = false;
+  router->seq = 0;
+  router->lock = &router->own_mutex;
+  router->blocked = false;
+  router->wake_at = 0;
+  router->wake_gen = 0;
+  router->tx_frames = router->tx_bytes = 0;
+  router->rx_frames = router->rx_bytes = 0;
+  router->rip_frames = router->rip_bytes = 0;
+  router->lost = 0;
+  router->last_rip_change = 0;
+  router->fib_phase = SIZE_MAX;
+  router->fib_count = 0;
+  router->fib_ok = false;
+  router->fib_dirty = true;
+  router->fib_since = 0;
+  router->fib_checked = 0;
+  router->heap_bytes = 0;
+  router->heap_peak = 0;
+  router->cpu_ns = 0;
+  router->random = 0x9e3779b97f4a7c15ull * (router->index + 1);
+  router->exit_code = 0;
+  names[name] = router->index;
+  sim_routers.push_back(router);
+  return router;
+}
+
+// "name" or "name:if", if_index is -1 when not given
+static std::string HAL_SimEndpoint(const char *token, int *if_index) {
+  std::string name = token;
+  *if_index = -1;
+  size_t colon = name.find(':');
+  if (colon != std::string::npos) {
+    *if_index = atoi(name.c_str() + colon + 1);
+    name = name.substr(0, colon);
+  }
+  return name;
+}
+
+static bool HAL_SimLoadTopology(const char *path) {
+  FILE *fp = fopen(path, "r");
+  if (!fp) {
+    fprintf(stderr, "SIM: cannot open topology %s\n", path);
+    return false;
+  }
+  std::map<std::string, int> names;
+  // (router, if) pairs of every link
+  std::vector<std::pair<std::pair<int, int>, std::pair<int, int>>> links;
+  // down, up and withdraw
+  struct SimEvent {
+    uint64_t at;
+    SimFrameKind kind;
+    int router;
+    int if_index;
+  };
+  std::vector<SimEvent> events;
+  char line[1024];
+  int line_no = 0;
+  bool ok = true;
+  while (ok && fgets(line, sizeof(line), fp)) {
+    line_no++;
+    char *comment = strchr(line, '#');
+    if (comment) {
+      *comment = '\0';
+    }
+    std::vector<char *> tokens;
+    for (char *token = strtok(line, " \t\r\n"); token;
+         token = strtok(NULL, " \t\r\n")) {
+      tokens.push_back(token);
+    }
+    if (tokens.empty()) {
+      continue;
+    }
+    if (strcmp(tokens[0], "router") == 0 && tokens.size() >= 2 &&
+        tokens.size() <= 2 + N_IFACE_ON_BOARD) {
+      SimRouter *router = HAL_SimRouter(names, tokens[1]);
+      for (size_t i = 2; i < tokens.size(); i++) {
+        struct in_addr addr;
+        if (inet_aton(tokens[i], &addr) == 0) {
+          ok = false;
+          break;
+        }
+        router->addrs[i - 2] = addr.s_addr;
+        router->ports[i - 2].explicit_addr = true;
+      }
+    } else if (strcmp(tokens[0], "link") == 0 && tokens.size() >= 3 &&
+               tokens.size() <= 5) {
+      int ends[2][2];
+      for (int e = 0; e < 2; e++) {
+        int if_index;
+        std::string name = HAL_SimEndpoint(tokens[1 + e], &if_index);
+        SimRouter *router = HAL_SimRouter(names, name);
+        if (if_index < 0) {
+          // first free interface
+          for (int i = 0; i < N_IFACE_ON_BOARD && if_index < 0; i++) {
+            if (router->ports[i].peer < 0 &&
+                !(e == 1 && ends[0][0] == router->index && ends[0][1] == i)) {
+              if_index = i;
+            }
+          }
+        }
+        if (if_index < 0 || if_index >= N_IFACE_ON_BOARD ||
+            router->ports[if_index].peer >= 0) {
+          ok = false;
+          break;
+        }
+        ends[e][0] = router->index;
+        ends[e][1] = if_index;
+      }
+      if (!ok) {
+        break;
+      }
+      uint64_t latency = tokens.size() > 3 ? atof(tokens[3]) * 1000 : 0;
+      double loss = tokens.size() > 4 ? atof(tokens[4]) : 0;
+      for (int e = 0; e < 2; e++) {
+        SimPort &port = sim_routers[ends[e][0]]->ports[ends[e][1]];
+        port.peer = ends[1 - e][0];
+        port.peer_if = ends[1 - e][1];
+        port.latency = latency;
+        port.loss = loss;
+      }
+      links.push_back(std::make_pair(std::make_pair(ends[0][0], ends[0][1]),
+                                     std::make_pair(ends[1][0], ends[1][1])));
+    } else if (strcmp(tokens[0], "routes") == 0 && tokens.size() >= 3 &&
+               tokens.size() <= 4) {
+      int if_index;
+      std::string name = HAL_SimEndpoint(tokens[1], &if_index);
+      SimRouter *router = HAL_SimRouter(names, name);
+      int count = atoi(tokens[2]);
+      int len = tokens.size() > 3 ? atoi(tokens[3]) : 24;
+      if (if_index < 0 || if_index >= N_IFACE_ON_BOARD || count <= 0 ||
+          len <= 0 || len > 32) {
+        ok = false;
+        break;
+      }
+      // aligned to the prefix length, below 224.0.0.0
+      uint64_t step = 1ull << (32 - len);
+      uint64_t first = (sim_next_prefix + step - 1) & ~(step - 1);
+      if (first + count * step > 0xe0000000ull) {
+        ok = false;
+        break;
+      }
+      SimPort &port = router->ports[if_index];
+      port.speaker_routes = count;
+      port.speaker_first = first;
+      port.speaker_len = len;
+      sim_next_prefix = first + count * step;
+    } else if ((strcmp(tokens[0], "down") == 0 ||
+                strcmp(tokens[0], "up") == 0 ||
+                strcmp(tokens[0], "withdraw") == 0) &&
+               tokens.size() == 3) {
+      SimEvent event;
+      std::string name = HAL_SimEndpoint(tokens[2], &event.if_index);
+      event.router = HAL_SimRouter(names, name)->index;
+      event.at = atof(tokens[1]) * 1000000;
+      event.kind = tokens[0][0] == 'd'   ? SIM_FRAME_DOWN
+                   : tokens[0][0] == 'u' ? SIM_FRAME_UP
+                                         : SIM_FRAME_WITHDRAW;
+      if (event.if_index < 0 || event.if_index >= N_IFACE_ON_BOARD) {
+        ok = false;
+        break;
+      }
+      events.push_back(event);
+    } else {
+      ok = false;
+    }
+  }
+  fclose(fp);
+  if (!ok) {
+    fprintf(stderr, "SIM: %s:%d: bad line\n", path, line_no);
+    return false;
+  }
+
+  // addresses of link ends
+  for (size_t k = 0; k < links.size(); k++) {
+    SimRouter *a = sim_routers[links[k].first.first];
+    SimRouter *b = sim_routers[links[k].second.first];
+    int a_if = links[k].first.second, b_if = links[k].second.second;
+    bool a_set = a->ports[a_if].explicit_addr;
+    bool b_set = b->ports[b_if].explicit_addr;
+    // big endian
+    in_addr_t subnet = 0x0a | (uint32_t)(k >> 8 & 0xff) << 8 |
+                       (uint32_t)(k & 0xff) << 16;
+    if (a_set && !b_set) {
+      uint32_t host = (a->addrs[a_if] >> 24) == 1 ? 2 : 1;
+      b->addrs[b_if] = (a->addrs[a_if] & 0x00ffffff) | host << 24;
+    } else if (!a_set && b_set) {
+      uint32_t host = (b->addrs[b_if] >> 24) == 1 ? 2 : 1;
+      a->addrs[a_if] = (b->addrs[b_if] & 0x00ffffff) | host << 24;
+    } else if (!a_set && !b_set) {
+      a->addrs[a_if] = subnet | 1 << 24;
+      b->addrs[b_if] = subnet | 2 << 24;
+    }
+  }
+  // and of everything left
+  for (auto router : sim_routers) {
+    for (int i = 0; i < N_IFACE_ON_BOARD; i++) {
+      if (router->addrs[i] == 0) {
+        uint32_t u = router->index * N_IFACE_ON_BOARD + i;
+        router->addrs[i] = (uint32_t)(100 | (64 + (u >> 8 & 0x3f)) << 8 |
+                                      (u & 0xff) << 16 | 1 << 24);
+      }
+      router->argv_addrs[i] = inet_ntoa(in_addr{router->addrs[i]});
+    }
+  }
+  sim_links = links.size();
+
+  // RIP neighbors are only on unconnected interfaces
+  for (auto router : sim_routers) {
+    for (int i = 0; i < N_IFACE_ON_BOARD; i++) {
+      if (router->ports[i].speaker_routes > 0) {
+        if (router->ports[i].peer >= 0) {
+          fprintf(stderr, "SIM: %s:%d has a link and a RIP neighbor\n",
+                  router->name.c_str(), i);
+          return false;
+        }
+        SimFrame speak;
+        memset(&speak, 0, sizeof(speak));
+        speak.kind = SIM_FRAME_SPEAK;
+        speak.if_index = i;
+        speak.seq = router->seq++;
+        router->inbox.push(speak);
+      }
+    }
+  }
+  std::stable_sort(events.begin(), events.end(),
+                   [](const SimEvent &a, const SimEvent &b) {
+                     return a.at < b.at;
+                   });
+  sim_phases.push_back(0);
+  sim_phase_names.push_back("start");
+  for (auto &event : events) {
+    SimRouter *router = sim_routers[event.router];
+    const SimPort &port = router->ports[event.if_index];
+    const char *what = event.kind == SIM_FRAME_DOWN ? "down"
+                       : event.kind == SIM_FRAME_UP ? "up"
+                                                    : "withdraw";
+    if (event.kind == SIM_FRAME_WITHDRAW ? port.speaker_routes == 0
+                                         : port.peer < 0) {
+      fprintf(stderr, "SIM: nothing to %s on %s:%d\n", what,
+              router->name.c_str(), event.if_index);
+      return false;
+    }
+    std::string name =
+        std::string(what) + " " + router->name + ":" +
+        std::to_string(event.if_index);
+    if (event.at == sim_phases.back()) {
+      sim_phase_names.back() += ", " + name;
+    } else {
+      sim_phases.push_back(event.at);
+      sim_phase_names.push_back(name);
+    }
+    SimFrame frame;
+    memset(&frame, 0, sizeof(frame));
+    frame.deliver_at = event.at;
+    frame.seq = router->seq++;
+    frame.kind = event.kind;
+    frame.if_index = event.if_index;
+    router->inbox.push(frame);
+  }
+  for (auto router : sim_routers) {
+    router->phase_rip_bytes.assign(sim_phases.size(), 0);
+    router->phase_fib_ok.assign(sim_phases.size(), false);
+    router->phase_fib_since.assign(sim_phases.size(), 0);
+  }
+
+  // every prefix of the topology, and what the FIB of every router should
+  // hold of it in each phase
+  size_t n = sim_routers.size();
+  std::vector<uint32_t> known;
+  for (size_t a = 0; a < n; a++) {
+    const SimRouter *owner = sim_routers[a];
+    for (int i = 0; i < N_IFACE_ON_BOARD; i++) {
+      known.push_back(owner->addrs[i] & 0x00ffffff);
+      const SimPort &port = owner->ports[i];
+      uint32_t step = port.speaker_len == 32 ? 1 : 1u << (32 - port.speaker_len);
+      for (uint32_t j = 0; j < port.speaker_routes; j++) {
+        known.push_back(htonl(port.speaker_first + j * step));
+      }
+    }
+  }
+  std::sort(known.begin(), known.end());
+  known.erase(std::unique(known.begin(), known.end()), known.end());
+  std::vector<bool> cut(n * N_IFACE_ON_BOARD, false);
+  std::vector<bool> withdrawn(n * N_IFACE_ON_BOARD, false);
+  size_t next_event = 0;
+  for (size_t k = 0; k < sim_phases.size(); k++) {
+    for (; next_event < events.size() && events[next_event].at <= sim_phases[k];
+         next_event++) {
+      const SimEvent &event = events[next_event];
+      const SimPort &port = sim_routers[event.router]->ports[event.if_index];
+      if (event.kind == SIM_FRAME_WITHDRAW) {
+        withdrawn[event.router * N_IFACE_ON_BOARD + event.if_index] = true;
+      } else {
+        bool down = event.kind == SIM_FRAME_DOWN;
+        cut[event.router * N_IFACE_ON_BOARD + event.if_index] = down;
+        cut[port.peer * N_IFACE_ON_BOARD + port.peer_if] = down;
+      }
+    }
+    // hops between every two routers over the links that are up
+    std::vector<int> hops(n * n, -1);
+    for (size_t a = 0; a < n; a++) {
+      std::vector<int> queue(1, a);
+      hops[a * n + a] = 0;
+      for (size_t q = 0; q < queue.size(); q++) {
+        int r = queue[q];
+        for (int i = 0; i < N_IFACE_ON_BOARD; i++) {
+          const SimPort &port = sim_routers[r]->ports[i];
+          if (port.peer >= 0 && !cut[r * N_IFACE_ON_BOARD + i] &&
+              hops[a * n + port.peer] < 0) {
+            hops[a * n + port.peer] = hops[a * n + r] + 1;
+            queue.push_back(port.peer);
+          }
+        }
+      }
+    }
+    for (size_t r = 0; r < n; r++) {
+      std::vector<uint32_t> expected;
+      for (size_t a = 0; a < n; a++) {
+        int h = hops[a * n + r];
+        if (h < 0) {
+          continue;
+        }
+        const SimRouter *owner = sim_routers[a];
+        for (int i = 0; i < N_IFACE_ON_BOARD; i++) {
+          // the /24 of every interface, metric 0 where it is attached
+          if (h < SIM_RIP_INFINITY) {
+            expected.push_back(owner->addrs[i] & 0x00ffffff);
+          }
+          // the prefixes of a neighbor, metric 1 on the router it talks to
+          const SimPort &port = owner->ports[i];
+          if (port.speaker_routes == 0 || withdrawn[a * N_IFACE_ON_BOARD + i] ||
+              h + 1 >= SIM_RIP_INFINITY) {
+            continue;
+          }
+          uint32_t step = port.speaker_len == 32 ? 1 : 1u << (32 - port.speaker_len);
+          for (uint32_t j = 0; j < port.speaker_routes; j++) {
+            expected.push_back(htonl(port.speaker_first + j * step));
+          }
+        }
+      }
+      // both ends of a link share its /24
+      std::sort(expected.begin(), expected.end());
+      expected.erase(std::unique(expected.begin(), expected.end()),
+                     expected.end());
+      std::vector<uint32_t> unexpected;
+      std::set_difference(known.begin(), known.end(), expected.begin(),
+                          expected.end(), std::back_inserter(unexpected));
+      sim_routers[r]->expected.push_back(expected);
+      sim_routers[r]->unexpected.push_back(unexpected);
+    }
+  }
+  return true;
+}
+
+static void *HAL_SimThread(void *arg) {
+  SimRouter *router = (SimRouter *)arg;
+  sim_self = router;
+  char *argv[2 + N_IFACE_ON_BOARD];
+  argv[0] = (char *)router->name.c_str();
+  for (int i = 0; i < N_IFACE_ON_BOARD; i++) {
+    argv[1 + i] = (char *)router->argv_addrs[i].c_str();
+  }
+  argv[1 + N_IFACE_ON_BOARD] = NULL;
+  sim_heap_owner = router;
+  router->exit_code = router_main(1 + N_IFACE_ON_BOARD, argv);
+  sim_heap_owner = NULL;
+
+  struct timespec tp = {0};
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &tp);
+  router->cpu_ns = (uint64_t)tp.tv_sec * 1000000000 + tp.tv_nsec;
+  if (sim_virtual) {
+    // the clock must not wait for a router that is gone
+    std::lock_guard<std::mutex> lock(sim_clock_mutex);
+    if (--sim_active == 0) {
+      HAL_SimAdvance();
+    }
+  }
+  return NULL;
+}
+
+static void HAL_SimReport(FILE *fp, double wall) {
+  uint64_t tx_frames = 0, tx_bytes = 0, rip_frames = 0, rip_bytes = 0,
+           lost = 0, last_change = 0, cpu_ns = 0;
+  for (auto router : sim_routers) {
+    tx_frames += router->tx_frames;
+    tx_bytes += router->tx_bytes;
+    rip_frames += router->rip_frames;
+    rip_bytes += router->rip_bytes;
+    lost += router->lost;
+    cpu_ns += router->cpu_ns;
+    if (router->last_rip_change > last_change) {
+      last_change = router->last_rip_change;
+    }
+  }
+  fprintf(fp, "SIM: %zu routers, %zu links, %.3f s (%s clock, %.3f s wall)\n",
+          sim_routers.size(), sim_links, sim_end / 1e6,
+          sim_virtual ? "virtual" : "real", wall);
+  fprintf(fp, "SIM: last new RIP advertisement at %.3f s\n",
+          last_change / 1e6);
+  fprintf(fp,
+          "SIM: sent %llu frames (%llu bytes), %llu RIP frames (%llu "
+          "bytes), %llu lost, %.3f s CPU\n",
+          (unsigned long long)tx_frames, (unsigned long long)tx_bytes,
+          (unsigned long long)rip_frames, (unsigned long long)rip_bytes,
+          (unsigned long long)lost, cpu_ns / 1e9);
+  fprintf(fp, "SIM: phase start_s converged_s wrong rip_bytes event\n");
+  for (size_t k = 0; k < sim_phases.size(); k++) {
+    uint64_t converged_at = sim_phases[k], phase_rip_bytes = 0;
+    size_t wrong = 0;
+    for (auto router : sim_routers) {
+      if (!router->phase_fib_ok[k]) {
+        wrong++;
+      } else if (router->phase_fib_since[k] > converged_at) {
+        converged_at = router->phase_fib_since[k];
+      }
+      phase_rip_bytes += router->phase_rip_bytes[k];
+    }
+    char converged[32] = "-";
+    if (wrong == 0) {
+      snprintf(converged, sizeof(converged), "%.3f",
+               (converged_at - sim_phases[k]) / 1e6);
+    }
+    fprintf(fp, "SIM: %zu %.3f %s %zu %llu %s\n", k, sim_phases[k] / 1e6,
+            converged, wrong, (unsigned long long)phase_rip_bytes,
+            sim_phase_names[k].c_str());
+  }
+  fprintf(fp, "SIM: router tx_frames tx_bytes rip_frames rip_bytes "
+              "rx_frames rx_bytes lost last_change_s cpu_ms heap_peak exit\n");
+  for (auto router : sim_routers) {
+    fprintf(fp,
+            "SIM: %s %llu %llu %llu %llu %llu %llu %llu %.3f %.3f %lld %d\n",
+            router->name.c_str(), (unsigned long long)router->tx_frames,
+            (unsigned long long)router->tx_bytes,
+            (unsigned long long)router->rip_frames,
+            (unsigned long long)router->rip_bytes,
+            (unsigned long long)router->rx_frames,
+            (unsigned long long)router->rx_bytes,
+            (unsigned long long)router->lost, router->last_rip_change / 1e6,
+            router->cpu_ns / 1e6, (long long)router->heap_peak.load(),
+            router->exit_code);
+  }
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    fprintf(stderr, "Usage: %s <topology file> [<seconds>]\n", argv[0]);
+    return 1;
+  }
+  if (!HAL_SimLoadTopology(argv[1])) {
+    return 1;
+  }
+  double seconds = argc > 2 ? atof(argv[2]) : 30;
+  const char *clock = getenv("HAL_SIM_CLOCK");
+  if (clock && strcmp(clock, "real") == 0) {
+    sim_virtual = false;
+  } else if (clock && clock[0] && strcmp(clock, "virtual") != 0) {
+    fprintf(stderr, "SIM: unknown HAL_SIM_CLOCK %s\n", clock);
+    return 1;
+  }
+  if (sim_virtual) {
+    for (auto router : sim_routers) {
+      router->lock = &sim_clock_mutex;
+    }
+    sim_active = sim_routers.size();
+  }
+  sim_begin = HAL_SimClock();
+  sim_end = seconds * 1000000;
+
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  pthread_attr_setstacksize(&attr, SIM_STACK_SIZE);
+  std::vector<pthread_t> threads(sim_routers.size());
+  for (size_t i = 0; i < sim_routers.size(); i++) {
+    if (pthread_create(&threads[i], &attr, HAL_SimThread, sim_routers[i]) !=
+        0) {
+      fprintf(stderr, "SIM: cannot start router %s\n",
+              sim_routers[i]->name.c_str());
+      return 1;
+    }
+  }
+  pthread_attr_destroy(&attr);
+  for (size_t i = 0; i < threads.size(); i++) {
+    pthread_join(threads[i], NULL);
+  }
+  HAL_SimReport(stderr, (HAL_SimClock() - sim_begin) / 1e6);
+  return 0;
+}
+
+extern "C" {
+int HAL_Init(int debug, in_addr_t if_addrs[N_IFACE_ON_BOARD]) {
+  SimRouter *router = sim_self;
+  if (router == NULL) {
+    return HAL_ERR_NOT_SUPPORTED;
+  }
+  if (router->inited) {
+    return 0;
+  }
+  // every router asks for debugging, only do it on request
+  router->debug = getenv("HAL_SIM_DEBUG") != NULL && debug;
+  for (int i = 0; i < N_IFACE_ON_BOARD; i++) {
+    if (if_addrs[i] != router->addrs[i] && router->debug) {
+      fprintf(stderr, "HAL_Init: %s if %d uses %s, not the topology address\n",
+              router->name.c_str(), i, inet_ntoa(in_addr{if_addrs[i]}));
+    }
+    router->addrs[i] = if_addrs[i];
+  }
+  router->inited = true;
+  return 0;
+}
+
+uint64_t HAL_GetTicks() { return HAL_SimNow() / 1000; }
+
+int HAL_ArpGetMacAddress(int if_index, in_addr_t ip, macaddr_t o_mac) {
+  SimRouter *router = sim_self;
+  if (router == NULL || !router->inited) {
+    return HAL_ERR_CALLED_BEFORE_INIT;
+  }
+  if (if_index >= N_IFACE_ON_BOARD || if_index < 0) {
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+
+  if ((ip & 0xe0) == 0xe0) {
+    uint8_t multicasting_mac[6] = {0x01, 0, 0x5e, (uint8_t)((ip >> 8) & 0x7f), (uint8_t)(ip >> 16), (uint8_t)(ip >> 24)};
+    memcpy(o_mac, multicasting_mac, sizeof(macaddr_t));
+    return 0;
+  }
+
+  // links are point to point, the only neighbor answers at once
+  const SimPort &port = router->ports[if_index];
+  if (port.peer >= 0 && sim_routers[port.peer]->addrs[port.peer_if] == ip) {
+    memcpy(o_mac, sim_routers[port.peer]->macs[port.peer_if],
+           sizeof(macaddr_t));
+    return 0;
+  }
+  if (router->debug) {
+    fprintf(stderr, "HAL_ArpGetMacAddress: %s has no neighbor %s on if %d\n",
+            router->name.c_str(), inet_ntoa(in_addr{ip}), if_index);
+  }
+  return HAL_ERR_IP_NOT_EXIST;
+}
+
+int HAL_ArpKeepAlive(int if_index, in_addr_t ip) {
+  macaddr_t mac;
+  return HAL_ArpGetMacAddress(if_index, ip, mac);
+}
+
+int HAL_ArpGetEntries(arpentry_t *o_entries, int max) {
+  SimRouter *router = sim_self;
+  if (router == NULL || !router->inited) {
+    return HAL_ERR_CALLED_BEFORE_INIT;
+  }
+  if (max < 0 || (max > 0 && o_entries == NULL)) {
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+  // the only neighbor of a link answers at once, there is no table to save
+  return 0;
+}
+
+int HAL_ArpAddEntry(int if_index, in_addr_t ip, macaddr_t mac) {
+  SimRouter *router = sim_self;
+  if (router == NULL || !router->inited) {
+    return HAL_ERR_CALLED_BEFORE_INIT;
+  }
+  if (if_index >= N_IFACE_ON_BOARD || if_index < 0) {
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+  return 0;
+}
+
+int HAL_InitIPv6(const in6_addr_t if_addrs[N_IFACE_ON_BOARD]) {
+  SimRouter *router = sim_self;
+  if (router == NULL || !router->inited) {
+    return HAL_ERR_CALLED_BEFORE_INIT;
+  }
+  for (int i = 0; i < N_IFACE_ON_BOARD; i++) {
+    // fe80::/64 with the EUI-64 interface identifier
+    const uint8_t *mac = router->macs[i];
+    uint8_t ll[16] = {0xfe, 0x80, 0, 0, 0, 0, 0, 0, (uint8_t)(mac[0] ^ 0x02),
+                      mac[1], mac[2], 0xff, 0xfe, mac[3], mac[4], mac[5]};
+    memcpy(router->addrs6[i][0].addr, ll, sizeof(ll));
+    router->addrs6[i][1] = if_addrs[i];
+  }
+  router->ipv6 = true;
+  return 0;
+}
+
+int HAL_NdGetMacAddress(int if_index, in6_addr_t ip, macaddr_t o_mac) {
+  SimRouter *router = sim_self;
+  if (router == NULL || !router->inited || !router->ipv6) {
+    return HAL_ERR_CALLED_BEFORE_INIT;
+  }
+  if (if_index >= N_IFACE_ON_BOARD || if_index < 0) {
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+
+  if (ip.addr[0] == 0xff) {
+    o_mac[0] = 0x33;
+    o_mac[1] = 0x33;
+    memcpy(&o_mac[2], &ip.addr[12], 4);
+    return 0;
+  }
+
+  // as with ARP, the only neighbor answers at once
+  const SimPort &port = router->ports[if_index];
+  if (port.peer >= 0) {
+    SimRouter *peer = sim_routers[port.peer];
+    for (int j = 0; peer->ipv6 && j < 2; j++) {
+      if (memcmp(peer->addrs6[port.peer_if][j].addr, ip.addr, 16) == 0) {
+        memcpy(o_mac, peer->macs[port.peer_if], sizeof(macaddr_t));
+        return 0;
+      }
+    }
+  }
+  return HAL_ERR_IP_NOT_EXIST;
+}
+
+int HAL_SendIPPacketToNexthop(int if_index, uint8_t *buffer, size_t length,
+                              in_addr_t nexthop) {
+  macaddr_t dst_mac;
+  int res = HAL_ArpGetMacAddress(if_index, nexthop, dst_mac);
+  if (res != 0) {
+    return res;
+  }
+  return HAL_SendIPPacket(if_index, buffer, length, dst_mac);
+}
+
+int HAL_SendPacket(int if_index, hal_packet_t *packet, macaddr_t dst_mac) {
+  // the link takes its own copy, the pool belongs to this router
+  return HAL_SendPacketCopy(if_index, packet, dst_mac);
+}
+
+int HAL_SendPacketToNexthop(int if_index, hal_packet_t *packet,
+                            in_addr_t nexthop) {
+  macaddr_t dst_mac;
+  int res = HAL_ArpGetMacAddress(if_index, nexthop, dst_mac);
+  if (res != 0) {
+    HAL_FreePacket(packet);
+    return res;
+  }
+  return HAL_SendPacket(if_index, packet, dst_mac);
+}
+
+int HAL_GetInterfaceMacAddress(int if_index, macaddr_t o_mac) {
+  SimRouter *router = sim_self;
+  if (router == NULL || !router->inited) {
+    return HAL_ERR_CALLED_BEFORE_INIT;
+  }
+  if (if_index >= N_IFACE_ON_BOARD || if_index < 0) {
+    return HAL_ERR_IFACE_NOT_EXIST;
+  }
+
+  memcpy(o_mac, router->macs[if_index], sizeof(macaddr_t));
+  return 0;
+}
+
+int HAL_ReceiveIPPacket(int if_index_mask, uint8_t *buffer, size_t length,
+                        macaddr_t src_mac, macaddr_t dst_mac, int64_t timeout,
+                        int *if_index) {
+  SimRouter *router = sim_self;
+  if (router == NULL || !router->inited) {
+    return HAL_ERR_CALLED_BEFORE_INIT;
+  }
+  if ((if_index_mask & ((1 << N_IFACE_ON_BOARD) - 1)) == 0 ||
+      (timeout < 0 && timeout != -1) || (if_index == NULL)) {
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+
+  SimHeapPause pause;
+  uint64_t now = HAL_SimNow();
+  uint64_t deadline = timeout == -1 ? sim_end : now + timeout * 1000;
+  // the FIB may have changed since the last call
+  router->fib_dirty = true;
+  std::unique_lock<std::mutex> lock(*router->lock);
+  while (1) {
+    now = HAL_SimNow();
+    HAL_SimProbe(router, now);
+    if (now >= sim_end) {
+      return HAL_ERR_EOF;
+    }
+    if (!router->inbox.empty() && router->inbox.top().deliver_at <= now) {
+      SimFrame frame = router->inbox.top();
+      router->inbox.pop();
+      if (frame.kind != SIM_FRAME_DATA) {
+        HAL_SimEvent(router, frame, now);
+        continue;
+      }
+      if ((if_index_mask & (1 << frame.if_index)) == 0 ||
+          router->ports[frame.if_index].down ||
+          (frame.length > 0 && (frame.data[0] >> 4) == 6 && !router->ipv6)) {
+        // nobody listens on that interface, the link went down, or IPv6 is
+        // off
+        free(frame.data);
+        continue;
+      }
+      lock.unlock();
+      size_t real_length = length > frame.length ? frame.length : length;
+      memcpy(buffer, frame.data, real_length);
+      memcpy(src_mac, frame.src_mac, sizeof(macaddr_t));
+      memcpy(dst_mac, frame.dst_mac, sizeof(macaddr_t));
+      *if_index = frame.if_index;
+      free(frame.data);
+      router->rx_frames++;
+      router->rx_bytes += frame.length;
+      return frame.length;
+    }
+    if (now >= deadline) {
+      return 0;
+    }
+    uint64_t wake = deadline < sim_end ? deadline : sim_end;
+    if (!router->inbox.empty() && router->inbox.top().deliver_at < wake) {
+      wake = router->inbox.top().deliver_at;
+    }
+    if (sim_virtual) {
+      HAL_SimBlock(router, lock, wake);
+    } else {
+      router->cond.wait_for(lock, std::chrono::microseconds(wake - now));
+    }
+  }
+}
+
+int HAL_SendIPPacket(int if_index, uint8_t *buffer, size_t length,
+                     macaddr_t dst_mac) {
+  SimRouter *router = sim_self;
+  if (router == NULL || !router->inited) {
+    return HAL_ERR_CALLED_BEFORE_INIT;
+  }
+  if (if_index >= N_IFACE_ON_BOARD || if_index < 0) {
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+  SimHeapPause pause;
+  uint64_t now = HAL_SimNow();
+  router->tx_frames++;
+  router->tx_bytes += length;
+
+  SimPort &port = router->ports[if_index];
+  // RIP: UDP to port 520
+  if (length >= 20 && (buffer[0] >> 4) == 4 && buffer[9] == 17) {
+    size_t header_length = (buffer[0] & 0xf) * 4;
+    if (length >= header_length + 8 &&
+        ((buffer[header_length + 2] << 8) | buffer[header_length + 3]) ==
+            RIP_PORT) {
+      size_t phase = HAL_SimPhase(now);
+      router->rip_frames++;
+      router->rip_bytes += length;
+      router->phase_rip_bytes[phase] += length;
+      // routers saying something new, see last_change_s
+      uint64_t hash = HAL_SimHash(&buffer[header_length + 8],
+                                  length - header_length - 8);
+      auto it = port.rip_sent.find(hash);
+      if (it == port.rip_sent.end() || now - it->second > SIM_RIP_REFRESH) {
+        router->last_rip_change = now;
+      }
+      port.rip_sent[hash] = now;
+    }
+  }
+
+  if (port.peer < 0) {
+    // nothing is plugged in
+    return 0;
+  }
+  if (port.down) {
+    router->lost++;
+    return 0;
+  }
+  SimRouter *peer = sim_routers[port.peer];
+  if (!(dst_mac[0] & 1) &&
+      memcmp(dst_mac, peer->macs[port.peer_if], sizeof(macaddr_t)) != 0) {
+    // not for the neighbor, the frame is ignored on the other side
+    router->lost++;
+    return 0;
+  }
+  if (port.loss > 0 && HAL_SimRandom(router) < port.loss) {
+    router->lost++;
+    return 0;
+  }
+
+  SimFrame frame;
+  frame.deliver_at = now + port.latency;
+  frame.kind = SIM_FRAME_DATA;
+  frame.if_index = port.peer_if;
+  frame.length = length;
+  frame.data = (uint8_t *)malloc(length);
+  memcpy(frame.data, buffer, length);
+  memcpy(frame.src_mac, router->macs[if_index], sizeof(macaddr_t));
+  memcpy(frame.dst_mac, dst_mac, sizeof(macaddr_t));
+  {
+    std::lock_guard<std::mutex> lock(*peer->lock);
+    frame.seq = peer->seq++;
+    peer->inbox.push(frame);
+    if (sim_virtual) {
+      HAL_SimSchedule(peer, frame.deliver_at);
+    }
+  }
+  if (!sim_virtual) {
+    peer->cond.notify_one();
+  }
+  return 0;
+}
+}
+
+// operator new of a router thread is charged to that router, which with its
+// arenas gives its peak heap usage (routing tables and all) in the report
+static void *HAL_SimAlloc(size_t size) {
+  uint8_t *block = (uint8_t *)malloc(SIM_HEAP_HEADER + size);
+  if (block == NULL) {
+    return NULL;
+  }
+  SimRouter *owner = sim_heap_owner;
+  memcpy(block, &owner, sizeof(owner));
+  memcpy(block + sizeof(owner), &size, sizeof(size));
+  if (owner) {
+    HAL_SimCharge(owner, size);
+  }
+  return block + SIM_HEAP_HEADER;
+}
+
+static void HAL_SimFree(void *ptr) {
+  if (ptr == NULL) {
+    return;
+  }
+  uint8_t *block = (uint8_t *)ptr - SIM_HEAP_HEADER;
+  SimRouter *owner;
+  size_t size;
+  memcpy(&owner, block, sizeof(owner));
+  memcpy(&size, block + sizeof(owner), sizeof(size));
+  if (owner) {
+    owner->heap_bytes -= size;
+  }
+  free(block);
+}
+
+void *operator new(size_t size) {
+  void *ptr = HAL_SimAlloc(size);
+  if (ptr == NULL) {
+    throw std::bad_alloc();
+  }
+  return ptr;
+}
+
+void *operator new[](size_t size) { return operator new(size); }
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept {
+  return HAL_SimAlloc(size);
+}
+
+void *operator new[](size_t size, const std::nothrow_t &) noexcept {
+  return HAL_SimAlloc(size);
+}
+
+void operator delete(void *ptr) noexcept { HAL_SimFree(ptr); }
+
+void operator delete[](void *ptr) noexcept { HAL_SimFree(ptr); }
+
+void operator delete(void *ptr, const std::nothrow_t &) noexcept {
+  HAL_SimFree(ptr);
+}
+
+void operator delete[](void *ptr, const std::nothrow_t &) noexcept {
+  HAL_SimFree(ptr);
+}
@@ -1,8 +1,12 @@
 #include "router_hal.h"
+#include "router_hal_arp.h"
+#include "router_hal_nd.h"
+#include "router_hal_pool.h"
+#include "pcap_reader.h"
+#include "pcap_writer.h"
 #include <stdio.h>
 
 #include <map>
-#include <pcap.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
@@ -11,17 +15,17 @@
 const int IP_OFFSET = 18; // 6 + 6 + 4 + 2
 
 bool inited = false;
-bool outputInited = false;
 int debugEnabled = 0;
 in_addr_t interface_addrs[N_IFACE_ON_BOARD] = {0};
 macaddr_t interface_mac[N_IFACE_ON_BOARD] = {0};
 
-// input
-pcap_t *pcap_handle;
+// input, HAL_STDIO_INPUT names a capture file, stdin otherwise
+PcapReader pcap_reader;
 
-// output
-pcap_t *pcap_out_handle;
-pcap_dumper_t *pcap_dumper;
+// output, written to stdout in large chunks, flushed at EOF and at exit
+PcapWriter pcap_writer;
+
+static void HAL_FlushOutput() { pcap_writer.flush(); }
 
 // workaround for clang
 struct macaddr_wrap {
@@ -45,17 +49,24 @@ int HAL_Init(int debug, in_addr_t if_addrs[N_IFACE_ON_BOARD]) {
            interface_mac[i], sizeof(macaddr_t));
   }
 
-  char error_buffer[PCAP_ERRBUF_SIZE];
-
   // input
-  pcap_handle = pcap_open_offline("-", error_buffer);
-  if (!pcap_handle) {
+  const char *input = getenv("HAL_STDIO_INPUT");
+  if (input == NULL || input[0] == '\0') {
+    input = "-";
+  }
+  if (!pcap_reader.open(input)) {
     if (debugEnabled) {
-      fprintf(stderr, "pcap_open_offline failed with %s", error_buffer);
+      fprintf(stderr, "HAL_Init: cannot read capture from %s\n", input);
     }
     return HAL_ERR_UNKNOWN;
   }
 
+  // output
+  if (!pcap_writer.open(STDOUT_FILENO)) {
+    return HAL_ERR_UNKNOWN;
+  }
+  atexit(HAL_FlushOutput);
+
   memcpy(interface_addrs, if_addrs, sizeof(interface_addrs));
 
   inited = true;
@@ -128,23 +139,51 @@ int HAL_ArpGetMacAddress(int if_index, in_addr_t ip, macaddr_t o_mac) {
     // target
     memcpy(&buffer[42], &ip, sizeof(in_addr_t));
 
-    struct pcap_pkthdr header;
-    header.caplen = header.len = sizeof(buffer);
+    pcap_writer.write(buffer, sizeof(buffer));
+  }
+  return HAL_ERR_IP_NOT_EXIST;
+}
 
-    struct timespec tp = {0};
-    clock_gettime(CLOCK_MONOTONIC, &tp);
-    header.ts.tv_sec = tp.tv_sec;
-    header.ts.tv_usec = tp.tv_nsec / 1000;
+int HAL_ArpKeepAlive(int if_index, in_addr_t ip) {
+  // no neighbor maintenance here, just make sure it gets resolved
+  macaddr_t mac;
+  return HAL_ArpGetMacAddress(if_index, ip, mac);
+}
 
-    if (!outputInited) {
-      // output
-      pcap_out_handle = pcap_open_dead(DLT_EN10MB, 0x40000);
-      pcap_dumper = pcap_dump_open(pcap_out_handle, "-");
-      outputInited = true;
+int HAL_ArpGetEntries(arpentry_t *o_entries, int max) {
+  if (!inited) {
+    return HAL_ERR_CALLED_BEFORE_INIT;
+  }
+  if (max < 0 || (max > 0 && o_entries == NULL)) {
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+  int n = 0;
+  for (auto it = arp_table.begin(); it != arp_table.end() && n < max; ++it) {
+    // our own interfaces are in the table too
+    if (it->first.first == interface_addrs[it->first.second]) {
+      continue;
     }
-    pcap_dump((u_char *)pcap_dumper, &header, buffer);
+    o_entries[n].ip = it->first.first;
+    o_entries[n].if_index = it->first.second;
+    memcpy(o_entries[n].mac, &it->second, sizeof(macaddr_t));
+    n++;
   }
-  return HAL_ERR_IP_NOT_EXIST;
+  return n;
+}
+
+int HAL_ArpAddEntry(int if_index, in_addr_t ip, macaddr_t mac) {
+  if (!inited) {
+    return HAL_ERR_CALLED_BEFORE_INIT;
+  }
+  if (if_index >= N_IFACE_ON_BOARD || if_index < 0) {
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+  std::pair<in_addr_t, int> key(ip, if_index);
+  if (arp_table.find(key) == arp_table.end()) {
+    // no neighbor maintenance here, it stays until a reply overwrites it
+    memcpy(&arp_table[key], mac, sizeof(macaddr_t));
+  }
+  return 0;
 }
 
 int HAL_GetInterfaceMacAddress(int if_index, macaddr_t o_mac) {
@@ -173,33 +212,39 @@ int HAL_ReceiveIPPacket(int if_index_mask, uint8_t *buffer, size_t length,
   int64_t begin = HAL_GetTicks();
   int64_t current_time = 0;
 
-  struct pcap_pkthdr *hdr;
-  const u_char *packet;
+  PcapFrame frame;
   do {
-    int res = pcap_next_ex(pcap_handle, &hdr, &packet);
-    if (res == PCAP_ERROR_BREAK) {
+    if (!pcap_reader.next(&frame)) {
+      pcap_writer.flush();
       return HAL_ERR_EOF;
-    } else if (res != 1) {
-      // retry
-      continue;
     }
+    // points into the mapped capture, nothing is copied until the IP packet
+    const uint8_t *packet = frame.data;
 
     // check 802.1Q
-    if (packet && hdr->caplen >= IP_OFFSET && packet[12] == 0x81 &&
+    if (frame.caplen >= IP_OFFSET && packet[12] == 0x81 &&
         packet[13] == 0x00 && packet[14] == 0x00 && packet[15] >= 0 &&
         packet[15] < N_IFACE_ON_BOARD) {
       int current_port = packet[15];
-      if (packet[16] == 0x08 && packet[17] == 0x00) {
-        // IPv4
+      if (packet[16] == 0x86 && packet[17] == 0xdd &&
+          (!nd_enabled ||
+           HAL_NdInput(current_port, &packet[IP_OFFSET],
+                       frame.caplen - IP_OFFSET, &packet[6], HAL_GetTicks()))) {
+        // IPv6 while it is off, or neighbor discovery
+        continue;
+      } else if ((packet[16] == 0x08 && packet[17] == 0x00) ||
+                 (packet[16] == 0x86 && packet[17] == 0xdd)) {
+        // IPv4 or IPv6
         // assuming len == caplen
-        size_t ip_len = hdr->caplen - IP_OFFSET;
+        size_t ip_len = frame.caplen - IP_OFFSET;
         size_t real_length = length > ip_len ? ip_len : length;
         memcpy(buffer, &packet[IP_OFFSET], real_length);
         memcpy(dst_mac, &packet[0], sizeof(macaddr_t));
         memcpy(src_mac, &packet[6], sizeof(macaddr_t));
         *if_index = current_port;
         return ip_len;
-      } else if (packet[16] == 0x08 && packet[17] == 0x06) {
+      } else if (packet[16] == 0x08 && packet[17] == 0x06 &&
+                 frame.caplen >= 46) {
         // ARP
         macaddr_t mac;
         memcpy(mac, &packet[26], sizeof(macaddr_t));
@@ -208,6 +253,9 @@ int HAL_ReceiveIPPacket(int if_index_mask, uint8_t *buffer, size_t length,
 
         memcpy(&arp_table[std::pair<in_addr_t, int>(ip, current_port)], mac,
                sizeof(macaddr_t));
+        // send the packets that were waiting for it
+        HAL_ArpExpirePending(HAL_GetTicks());
+        HAL_ArpFlushPending(current_port, ip, mac);
         if (debugEnabled) {
           struct in_addr addr;
           addr.s_addr = ip;
@@ -251,21 +299,7 @@ int HAL_ReceiveIPPacket(int if_index_mask, uint8_t *buffer, size_t length,
           memcpy(&buffer[36], &packet[22], sizeof(macaddr_t));
           memcpy(&buffer[42], &packet[28], sizeof(in_addr_t));
 
-          struct pcap_pkthdr header;
-          header.caplen = header.len = sizeof(buffer);
-
-          struct timespec tp = {0};
-          clock_gettime(CLOCK_MONOTONIC, &tp);
-          header.ts.tv_sec = tp.tv_sec;
-          header.ts.tv_usec = tp.tv_nsec / 1000;
-
-          if (!outputInited) {
-            // output
-            pcap_out_handle = pcap_open_dead(DLT_EN10MB, 0x40000);
-            pcap_dumper = pcap_dump_open(pcap_out_handle, "-");
-            outputInited = true;
-          }
-          pcap_dump((u_char *)pcap_dumper, &header, buffer);
+          pcap_writer.write(buffer, sizeof(buffer));
 
           if (debugEnabled) {
             struct in_addr addr;
@@ -291,7 +325,11 @@ int HAL_SendIPPacket(int if_index, uint8_t *buffer, size_t length,
   if (if_index >= N_IFACE_ON_BOARD || if_index < 0) {
     return HAL_ERR_INVALID_PARAMETER;
   }
-  uint8_t *eth_buffer = (uint8_t *)malloc(length + IP_OFFSET);
+  // the frame is built in place in the output buffer
+  uint8_t *eth_buffer = pcap_writer.reserve(length + IP_OFFSET);
+  if (eth_buffer == NULL) {
+    return HAL_ERR_INVALID_PARAMETER;
+  }
   memcpy(eth_buffer, dst_mac, sizeof(macaddr_t));
   memcpy(&eth_buffer[6], interface_mac[if_index], sizeof(macaddr_t));
   // VLAN
@@ -299,26 +337,21 @@ int HAL_SendIPPacket(int if_index, uint8_t *buffer, size_t length,
   eth_buffer[13] = 0x00;
   eth_buffer[14] = 0x00;
   eth_buffer[15] = if_index;
-  // IPv4
-  eth_buffer[16] = 0x08;
-  eth_buffer[17] = 0x00;
-  memcpy(&eth_buffer[IP_OFFSET], buffer, length);
-  struct pcap_pkthdr header;
-  header.caplen = header.len = length + IP_OFFSET;
-
-  struct timespec tp = {0};
-  clock_gettime(CLOCK_MONOTONIC, &tp);
-  header.ts.tv_sec = tp.tv_sec;
-  header.ts.tv_usec = tp.tv_nsec / 1000;
-
-  if (!outputInited) {
-    // output
-    pcap_out_handle = pcap_open_dead(DLT_EN10MB, 0x40000);
-    pcap_dumper = pcap_dump_open(pcap_out_handle, "-");
-    outputInited = true;
+  if (length > 0 && (buffer[0] >> 4) == 6) {
+    // IPv6
+    eth_buffer[16] = 0x86;
+    eth_buffer[17] = 0xdd;
+  } else {
+    // IPv4
+    eth_buffer[16] = 0x08;
+    eth_buffer[17] = 0x00;
   }
-  pcap_dump((u_char *)pcap_dumper, &header, eth_buffer);
-  free(eth_buffer);
+  memcpy(&eth_buffer[IP_OFFSET], buffer, length);
   return 0;
 }
+
+int HAL_SendPacket(int if_index, hal_packet_t *packet, macaddr_t dst_mac) {
+  // the output buffer takes a copy anyway
+  return HAL_SendPacketCopy(if_index, packet, dst_mac);
+}
 }
\ No newline at end of file
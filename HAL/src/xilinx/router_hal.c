@@ -1,4 +1,5 @@
 #include "router_hal.h"
+#include "router_hal_pool.h"
 #include "xaxidma.h"
 #include "xaxiethernet.h"
 #include "xil_printf.h"
@@ -267,6 +268,66 @@ int HAL_ArpGetMacAddress(int if_index, in_addr_t ip, macaddr_t o_mac) {
   return HAL_ERR_IP_NOT_EXIST;
 }
 
+int HAL_ArpKeepAlive(int if_index, in_addr_t ip) {
+  // no neighbor maintenance here, just make sure it gets resolved
+  macaddr_t mac;
+  return HAL_ArpGetMacAddress(if_index, ip, mac);
+}
+
+int HAL_ArpGetEntries(arpentry_t *o_entries, int max) {
+  if (!inited) {
+    return HAL_ERR_CALLED_BEFORE_INIT;
+  }
+  if (max < 0 || (max > 0 && o_entries == NULL)) {
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+  int n = 0;
+  for (int i = 0; i < ARP_TABLE_SIZE && n < max; i++) {
+    // unused slots are zero
+    if (arpTable[i].ip == 0) {
+      continue;
+    }
+    o_entries[n].ip = arpTable[i].ip;
+    o_entries[n].if_index = arpTable[i].if_index;
+    memcpy(o_entries[n].mac, arpTable[i].mac, sizeof(macaddr_t));
+    n++;
+  }
+  return n;
+}
+
+int HAL_ArpAddEntry(int if_index, in_addr_t ip, macaddr_t mac) {
+  if (!inited) {
+    return HAL_ERR_CALLED_BEFORE_INIT;
+  }
+  if (if_index >= N_IFACE_ON_BOARD || if_index < 0) {
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+  for (int i = 0; i < ARP_TABLE_SIZE; i++) {
+    if (arpTable[i].if_index == if_index && arpTable[i].ip == ip) {
+      return 0;
+    }
+  }
+  // oldest at the end, as in HAL_ReceiveIPPacket
+  memmove(&arpTable[1], arpTable,
+          (ARP_TABLE_SIZE - 1) * sizeof(struct ArpTableEntry));
+  arpTable[0].if_index = if_index;
+  memcpy(arpTable[0].mac, mac, sizeof(macaddr_t));
+  arpTable[0].ip = ip;
+  return 0;
+}
+
+int HAL_InitIPv6(const in6_addr_t if_addrs[N_IFACE_ON_BOARD]) {
+  if (!inited) {
+    return HAL_ERR_CALLED_BEFORE_INIT;
+  }
+  // only IPv4 and ARP frames are handled here
+  return HAL_ERR_NOT_SUPPORTED;
+}
+
+int HAL_NdGetMacAddress(int if_index, in6_addr_t ip, macaddr_t o_mac) {
+  return HAL_ERR_NOT_SUPPORTED;
+}
+
 int HAL_GetInterfaceMacAddress(int if_index, macaddr_t o_mac) {
   if (!inited) {
     return HAL_ERR_CALLED_BEFORE_INIT;
@@ -448,3 +509,30 @@ int HAL_SendIPPacket(int if_index, uint8_t *buffer, size_t length,
   XAxiDma_BdRingToHw(txRing, 1, bd);
   return 0;
 }
+
+int HAL_SendIPPacketToNexthop(int if_index, uint8_t *buffer, size_t length,
+                              in_addr_t nexthop) {
+  // no pending queue on this platform: send if resolved, drop otherwise
+  macaddr_t dst_mac;
+  int res = HAL_ArpGetMacAddress(if_index, nexthop, dst_mac);
+  if (res != 0) {
+    return res;
+  }
+  return HAL_SendIPPacket(if_index, buffer, length, dst_mac);
+}
+
+int HAL_SendPacket(int if_index, hal_packet_t *packet, macaddr_t dst_mac) {
+  // the packet is copied into a DMA buffer
+  return HAL_SendPacketCopy(if_index, packet, dst_mac);
+}
+
+int HAL_SendPacketToNexthop(int if_index, hal_packet_t *packet,
+                            in_addr_t nexthop) {
+  macaddr_t dst_mac;
+  int res = HAL_ArpGetMacAddress(if_index, nexthop, dst_mac);
+  if (res != 0) {
+    HAL_FreePacket(packet);
+    return res;
+  }
+  return HAL_SendPacket(if_index, packet, dst_mac);
+}
@@ -0,0 +1,334 @@
+#include "aggregate.h"
+#include "router_hal.h"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <map>
+#include <stdint.h>
+#include <utility>
+#include <vector>
+
+extern bool update(bool insert, RoutingTableEntry entry);
+extern uint32_t bulkLoad(const RoutingTableEntry *entries, uint32_t count);
+
+// ORTC on a binary trie of the routes. Pass 1 of the paper (pushing routes
+// down to the leaves) is implicit: a node with one child has a virtual leaf
+// on the other side that inherits the route above it. Pass 2 computes for
+// every node the set of nexthops that can cover its subtree, bottom up:
+// the intersection of its children's sets, or their union if that is empty.
+// Pass 3 walks down and installs a prefix wherever the nexthop chosen above
+// is not in a node's set. Nexthop 0 means no route; any set containing it is
+// just {0}, so no prefix ever covers a hole.
+
+struct AggNode {
+  AggNode *child[2];
+  AggNode *parent;
+  uint32_t prefix; // host byte order
+  uint32_t len;
+  uint32_t route;  // nexthop id of the route at this prefix, 0 if none
+  uint32_t choice; // nexthop chosen above at the last pass 3
+  bool dirty;      // set changed since the last pass 3
+  std::vector<uint32_t> set;
+};
+
+const uint32_t AGG_UNKNOWN = 0xffffffff;
+
+ROUTER_LOCAL AggNode *agg_root = NULL;
+ROUTER_LOCAL uint32_t agg_routes = 0;
+// nexthop ids, an entry with the same nexthop, if_index, metric and ECMP group
+// is one id
+ROUTER_LOCAL std::map<std::pair<std::pair<uint32_t, uint32_t>,
+                                std::pair<uint32_t, uint32_t>>,
+                      uint32_t>
+    agg_ids;
+ROUTER_LOCAL std::vector<RoutingTableEntry> agg_nexthops;
+// what is in the routing table now: (prefix, len) -> nexthop id
+ROUTER_LOCAL std::map<std::pair<uint32_t, uint32_t>, uint32_t> agg_fib;
+// removed from agg_fib before pass 3, deleted after it unless set again
+ROUTER_LOCAL std::map<std::pair<uint32_t, uint32_t>, uint32_t> agg_stale;
+// collects the result instead of sending it to update, for aggregateLoad
+ROUTER_LOCAL bool agg_loading = false;
+
+static uint32_t nexthopId(const RoutingTableEntry &entry) {
+  if (agg_nexthops.empty()) {
+    agg_nexthops.push_back(RoutingTableEntry()); // 0 is no route
+  }
+  auto key = std::make_pair(std::make_pair(entry.nexthop, entry.if_index),
+                            std::make_pair(entry.metric, entry.group));
+  auto it = agg_ids.find(key);
+  if (it != agg_ids.end()) {
+    return it->second;
+  }
+  uint32_t id = agg_nexthops.size();
+  agg_ids[key] = id;
+  agg_nexthops.push_back(entry);
+  return id;
+}
+
+static AggNode *newNode(AggNode *parent, uint32_t prefix, uint32_t len) {
+  AggNode *node = new AggNode;
+  node->child[0] = node->child[1] = NULL;
+  node->parent = parent;
+  node->prefix = prefix;
+  node->len = len;
+  node->route = 0;
+  node->choice = AGG_UNKNOWN;
+  node->dirty = true;
+  return node;
+}
+
+static uint32_t childPrefix(const AggNode *node, int side) {
+  return node->prefix | ((uint32_t)side << (31 - node->len));
+}
+
+static uint32_t inherited(const AggNode *node) {
+  for (const AggNode *p = node->parent; p; p = p->parent) {
+    if (p->route) {
+      return p->route;
+    }
+  }
+  return 0;
+}
+
+static std::vector<uint32_t> combine(const std::vector<uint32_t> &a,
+                                     const std::vector<uint32_t> &b) {
+  std::vector<uint32_t> res;
+  if (a[0] == 0 || b[0] == 0) {
+    // a hole below, nothing may cover it
+    res.push_back(0);
+    return res;
+  }
+  std::set_intersection(a.begin(), a.end(), b.begin(), b.end(),
+                        std::back_inserter(res));
+  if (res.empty()) {
+    std::set_union(a.begin(), a.end(), b.begin(), b.end(),
+                   std::back_inserter(res));
+  }
+  return res;
+}
+
+// pass 2 from the children's sets, a missing child is a leaf with own
+static void computeSet(AggNode *node, uint32_t own) {
+  std::vector<uint32_t> leaf(1, own);
+  if (!node->child[0] && !node->child[1]) {
+    node->set = leaf;
+  } else {
+    node->set = combine(node->child[0] ? node->child[0]->set : leaf,
+                        node->child[1] ? node->child[1]->set : leaf);
+  }
+  node->dirty = true;
+}
+
+// pass 2 for the subtree of node; subtrees with a route of their own do not
+// depend on anything above them and keep their sets unless all is set
+static void recompute(AggNode *node, uint32_t inh, bool top, bool all) {
+  if (node->route && !top && !all) {
+    return;
+  }
+  uint32_t own = node->route ? node->route : inh;
+  for (int side = 0; side < 2; side++) {
+    if (node->child[side]) {
+      recompute(node->child[side], own, false, all);
+    }
+  }
+  computeSet(node, own);
+}
+
+static void emit(bool insert, uint32_t prefix, uint32_t len, uint32_t id) {
+  if (agg_loading) {
+    return;
+  }
+  RoutingTableEntry entry = agg_nexthops[id];
+  entry.addr = htonl(prefix);
+  entry.len = len;
+  entry.time_stamp = 0;
+  update(insert, entry);
+}
+
+static void setOutput(uint32_t prefix, uint32_t len, uint32_t id) {
+  std::pair<uint32_t, uint32_t> key(prefix, len);
+  uint32_t old = 0;
+  auto it = agg_fib.find(key);
+  if (it != agg_fib.end()) {
+    old = it->second;
+  } else {
+    auto stale = agg_stale.find(key);
+    if (stale != agg_stale.end()) {
+      // still in the routing table
+      old = stale->second;
+      agg_fib[key] = old;
+      agg_stale.erase(stale);
+    }
+  }
+  if (old == id) {
+    return;
+  }
+  if (id) {
+    agg_fib[key] = id;
+    emit(true, prefix, len, id);
+  } else {
+    agg_fib.erase(key);
+    emit(false, prefix, len, old);
+  }
+}
+
+// pass 3; subtrees whose sets and inherited choice did not change are skipped
+static void install(AggNode *node, uint32_t above, uint32_t inh) {
+  const std::vector<uint32_t> &set = node->set;
+  bool keep = std::binary_search(set.begin(), set.end(), above);
+  uint32_t choice = keep ? above : set[0];
+  if (!node->dirty && node->choice == above) {
+    return;
+  }
+  node->dirty = false;
+  node->choice = above;
+  setOutput(node->prefix, node->len, keep ? 0 : choice);
+
+  uint32_t own = node->route ? node->route : inh;
+  bool leaf = !node->child[0] && !node->child[1];
+  for (int side = 0; side < 2; side++) {
+    if (node->child[side]) {
+      install(node->child[side], choice, own);
+    } else if (!leaf) {
+      setOutput(childPrefix(node, side), node->len + 1,
+                own == choice ? 0 : own);
+    }
+  }
+}
+
+// everything agg_fib has strictly inside node, or inside and at node
+static void markStale(const AggNode *node, bool self) {
+  uint64_t end = (uint64_t)node->prefix + (1ULL << (32 - node->len));
+  auto it = agg_fib.lower_bound(std::make_pair(node->prefix, node->len));
+  while (it != agg_fib.end() && it->first.first < end) {
+    if (self || it->first.second != node->len) {
+      agg_stale[it->first] = it->second;
+      it = agg_fib.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+static void finish() {
+  install(agg_root, 0, 0);
+  for (auto it = agg_stale.begin(); it != agg_stale.end(); ++it) {
+    emit(false, it->first.first, it->first.second, it->second);
+  }
+  agg_stale.clear();
+}
+
+static void freeTree(AggNode *node) {
+  if (node) {
+    freeTree(node->child[0]);
+    freeTree(node->child[1]);
+    delete node;
+  }
+}
+
+// finds the node of the prefix, creating the path to it if asked to
+static AggNode *findNode(uint32_t prefix, uint32_t len, bool create) {
+  if (agg_root == NULL) {
+    if (!create) {
+      return NULL;
+    }
+    agg_root = newNode(NULL, 0, 0);
+  }
+  AggNode *node = agg_root;
+  for (uint32_t depth = 0; depth < len; depth++) {
+    int side = (prefix >> (31 - depth)) & 1;
+    if (!node->child[side]) {
+      if (!create) {
+        return NULL;
+      }
+      node->child[side] = newNode(node, childPrefix(node, side), depth + 1);
+    }
+    node = node->child[side];
+  }
+  return node;
+}
+
+static uint32_t hostPrefix(const RoutingTableEntry &entry) {
+  uint32_t prefix = ntohl(entry.addr);
+  return entry.len == 0 ? 0 : prefix & (0xffffffffu << (32 - entry.len));
+}
+
+void aggregateUpdate(bool insert, RoutingTableEntry entry) {
+  uint32_t prefix = hostPrefix(entry);
+  AggNode *node = findNode(prefix, entry.len, insert);
+  if (node == NULL || (!insert && node->route == 0)) {
+    return;
+  }
+  if (insert) {
+    if (node->route == 0) {
+      agg_routes++;
+    }
+    node->route = nexthopId(entry);
+  } else {
+    node->route = 0;
+    agg_routes--;
+  }
+
+  // drop nodes left with neither a route nor children
+  AggNode *start = node;
+  if (!insert && !node->child[0] && !node->child[1] && node != agg_root) {
+    AggNode *gone = node;
+    AggNode *parent = gone->parent;
+    while (parent != agg_root && parent->route == 0 &&
+           !(parent->child[0] && parent->child[1])) {
+      gone = parent;
+      parent = parent->parent;
+    }
+    parent->child[gone == parent->child[1]] = NULL;
+    if (parent->child[0] || parent->child[1]) {
+      // becomes a virtual leaf of parent
+      markStale(gone, true);
+    } else {
+      // parent is a leaf now and has no virtual children
+      markStale(parent, false);
+    }
+    freeTree(gone);
+    start = parent;
+  }
+
+  // pass 2 below the change, then up to the root
+  recompute(start, inherited(start), true, false);
+  for (AggNode *p = start->parent; p; p = p->parent) {
+    computeSet(p, p->route ? p->route : inherited(p));
+  }
+  finish();
+}
+
+uint32_t aggregateLoad(const RoutingTableEntry *entries, uint32_t count) {
+  freeTree(agg_root);
+  agg_root = NULL;
+  agg_routes = 0;
+  agg_fib.clear();
+  agg_stale.clear();
+  for (uint32_t i = 0; i < count; i++) {
+    AggNode *node = findNode(hostPrefix(entries[i]), entries[i].len, true);
+    if (node->route == 0) {
+      agg_routes++;
+    }
+    node->route = nexthopId(entries[i]);
+  }
+  if (agg_root == NULL) {
+    return bulkLoad(NULL, 0);
+  }
+  recompute(agg_root, 0, true, true);
+  agg_loading = true;
+  finish();
+  agg_loading = false;
+
+  std::vector<RoutingTableEntry> fib;
+  fib.reserve(agg_fib.size());
+  for (auto it = agg_fib.begin(); it != agg_fib.end(); ++it) {
+    RoutingTableEntry entry = agg_nexthops[it->second];
+    entry.addr = htonl(it->first.first);
+    entry.len = it->first.second;
+    entry.time_stamp = 0;
+    fib.push_back(entry);
+  }
+  return bulkLoad(fib.data(), fib.size());
+}
+
+uint32_t aggregateCount() { return agg_routes; }
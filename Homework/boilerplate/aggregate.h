@@ -0,0 +1,34 @@
+#ifndef __ROUTER_AGGREGATE_H__
+#define __ROUTER_AGGREGATE_H__
+
+#include "router.h"
+#include <stdint.h>
+
+/*
+  FIB 聚合，位于 RIB 和 lookup.cpp 的路由表之间，可选。
+
+  用 ORTC（Draves 等，Constructing Optimal IP Routing Tables）求出转发行为
+  完全相同的最少前缀集合：相邻的、嵌套的前缀只要 nexthop 、 if_index 、
+  metric 和 ECMP 组都相同就可以合并。路由变化时只重算受影响的部分，
+  再把聚合结果的变化通过 update 下发给路由表。
+  没有路由的地址在聚合后仍然没有路由：覆盖了空洞的前缀不会参与合并，
+  所以不需要黑洞路由。
+*/
+
+/**
+ * @brief 加入、替换或删除一条 RIB 选出的路由，删除时按照 addr 和 len 匹配
+ */
+void aggregateUpdate(bool insert, RoutingTableEntry entry);
+
+/**
+ * @brief 用一组路由整体替换聚合前的路由，并用 bulkLoad 装入聚合结果
+ * @return 聚合后的表项数
+ */
+uint32_t aggregateLoad(const RoutingTableEntry *entries, uint32_t count);
+
+/**
+ * 聚合前的路由数
+ */
+uint32_t aggregateCount();
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef __ROUTER_ARENA_H__
+#define __ROUTER_ARENA_H__
+
+#include "router_hal.h"
+#include <stddef.h>
+#include <new>
+
+/*
+  路由表的内存分配。
+
+  RIB 和 IPv6 路由表的 STL 容器用 ArenaAllocator 从同一个 arena
+  （见 HAL_ArenaCreate ）中分配，表项落在大页上，查表时 TLB 不容易缺失；
+  同样大小的节点释放后由 arena 直接复用，哈希表的桶数组这样更大的块释放后也会
+  切给之后的分配，所以 ribLoad 反复重建 RIB 不会让 arena 一直增长。lookup.cpp 中的 IPv4 路由表有自己
+  的 arena ，bulkLoad 重建时整体释放。
+*/
+
+/**
+ * 路由表共用的 arena ，每台路由器一个，第一次使用时创建
+ */
+inline hal_arena_t *routeArena() {
+  static ROUTER_LOCAL hal_arena_t *arena = NULL;
+  if (arena == NULL) {
+    arena = HAL_ArenaCreate(0);
+  }
+  return arena;
+}
+
+/**
+ * 从 routeArena 分配内存的 STL 分配器
+ */
+template <class T> struct ArenaAllocator {
+  typedef T value_type;
+
+  ArenaAllocator() {}
+  template <class U> ArenaAllocator(const ArenaAllocator<U> &) {}
+
+  T *allocate(size_t n) {
+    hal_arena_t *arena = routeArena();
+    void *p = arena ? HAL_ArenaAlloc(arena, n * sizeof(T)) : NULL;
+    if (p == NULL) {
+      throw std::bad_alloc();
+    }
+    return static_cast<T *>(p);
+  }
+
+  void deallocate(T *p, size_t n) {
+    HAL_ArenaFree(routeArena(), p, n * sizeof(T));
+  }
+};
+
+template <class T, class U>
+bool operator==(const ArenaAllocator<T> &, const ArenaAllocator<U> &) {
+  return true;
+}
+
+template <class T, class U>
+bool operator!=(const ArenaAllocator<T> &, const ArenaAllocator<U> &) {
+  return false;
+}
+
+#endif
@@ -0,0 +1,163 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+
+# RIP 收敛测试：用 sim 后端在线形、环形、网格和实验拓扑上运行 boilerplate，
+# 注入一定数量的路由，再依次断开链路、恢复链路、撤销注入的路由，
+# 报告每个阶段的收敛时间、RIP 流量和每台路由器的堆内存峰值。
+# 收敛指每台路由器的 FIB 恰好含有按当时的拓扑应该到达的前缀，并保持到阶段结束；
+# 到阶段结束还没有收敛的，报告 FIB 不对的路由器数。
+#
+# 用法：python3 convergence.py [--topology line,ring,grid,lab] [--size 8]
+#       [--routes 100] [--json out.json]
+# 会先执行 make clean 和 make BACKEND=SIM boilerplate ，加 --no-build 跳过。
+
+import argparse
+import json
+import os
+import subprocess
+import sys
+import tempfile
+
+TOPOLOGIES = ['line', 'ring', 'grid', 'lab']
+
+
+def line(n):
+    lines = ['link r{}:1 r{}:0 5'.format(i, i + 1) for i in range(n - 1)]
+    # 路由从一端注入，断开中间的链路
+    return lines, 'r0:0', 'r{}:1'.format(n // 2 - 1)
+
+
+def ring(n):
+    lines = ['link r{}:1 r{}:0 5'.format(i, (i + 1) % n) for i in range(n)]
+    return lines, 'r0:2', 'r0:1'
+
+
+def grid(n):
+    lines = []
+    for r in range(n):
+        for c in range(n):
+            if c + 1 < n:
+                lines.append('link g{}_{}:0 g{}_{}:1 5'.format(r, c, r, c + 1))
+            if r + 1 < n:
+                lines.append('link g{}_{}:2 g{}_{}:3 5'.format(r, c, r + 1, c))
+    return lines, 'g0_0:1', 'g0_0:0'
+
+
+def lab(n):
+    path = os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                        'topology', 'lab.txt')
+    lines = [line.rstrip('\n') for line in open(path, 'r')]
+    # PC1 所在的网口上注入路由，断开 R2 和 R3 之间的链路
+    return lines, 'r1:0', 'r2:1'
+
+
+def parse_report(text):
+    report = {'phases': [], 'routers': {}}
+    table = None
+    for line in text.splitlines():
+        if not line.startswith('SIM: '):
+            continue
+        fields = line[5:].split()
+        if fields[0] == 'phase' or fields[0] == 'router':
+            table = fields
+        elif fields[1:2] == ['routers,']:
+            report['routers_count'] = int(fields[0])
+            report['seconds'] = float(fields[4])
+            report['wall'] = float(fields[8])
+        elif fields[0] == 'sent':
+            report['rip_bytes'] = int(fields[8][1:])
+        elif table and table[0] == 'phase' and fields[0].isdigit():
+            report['phases'].append({
+                'start': float(fields[1]),
+                'converged': None if fields[2] == '-' else float(fields[2]),
+                'wrong': int(fields[3]),
+                'rip_bytes': int(fields[4]),
+                'event': ' '.join(fields[5:]),
+            })
+        elif table and table[0] == 'router' and len(fields) == len(table):
+            row = dict(zip(table[1:], fields[1:]))
+            report['routers'][fields[0]] = {
+                'rip_bytes': int(row['rip_bytes']),
+                'heap_peak': int(row['heap_peak']),
+                'exit': int(row['exit']),
+            }
+    return report
+
+
+def run(name, args):
+    links, inject, cut = globals()[name](args.size)
+    t = args.phase
+    lines = links + [
+        'routes {} {} {}'.format(inject, args.routes, args.len),
+        'down {} {}'.format(t, cut),
+        'up {} {}'.format(2 * t, cut),
+        'withdraw {} {}'.format(3 * t, inject),
+    ]
+    with tempfile.NamedTemporaryFile('w', suffix='.txt', delete=False) as f:
+        f.write('\n'.join(lines) + '\n')
+        path = f.name
+    env = dict(os.environ, HAL_SIM_CLOCK='virtual')
+    try:
+        p = subprocess.run(['./boilerplate', path, str(4 * t)], env=env,
+                           stdout=subprocess.DEVNULL, stderr=subprocess.PIPE,
+                           universal_newlines=True)
+    finally:
+        os.unlink(path)
+    report = parse_report(p.stderr)
+    if p.returncode != 0 or not report['phases']:
+        sys.stderr.write(p.stderr)
+        raise RuntimeError('{} failed'.format(name))
+    return report
+
+
+def print_report(name, report):
+    heap = sorted(r['heap_peak'] for r in report['routers'].values())
+    print('{}: {} routers, {:.0f} s in {:.3f} s, {} RIP bytes, heap peak '
+          'max {} KB, median {} KB'.format(
+              name, report['routers_count'], report['seconds'],
+              report['wall'], report['rip_bytes'], heap[-1] // 1024,
+              heap[len(heap) // 2] // 1024))
+    for phase in report['phases']:
+        converged = '{} wrong'.format(phase['wrong']) \
+            if phase['converged'] is None else \
+            '{:.3f} s'.format(phase['converged'])
+        print('  {:>8.1f} s  {:<24} converged {:>10}  {} RIP bytes'.format(
+            phase['start'], phase['event'], converged, phase['rip_bytes']))
+
+
+if __name__ == '__main__':
+
+    if sys.version_info[0] != 3:
+        print("Plz use python3")
+        sys.exit()
+
+    parser = argparse.ArgumentParser(description='RIP convergence benchmark')
+    parser.add_argument('--topology', default=','.join(TOPOLOGIES),
+                        help='comma separated, of ' + ', '.join(TOPOLOGIES))
+    parser.add_argument('--size', type=int, default=8,
+                        help='routers of line and ring, side of grid')
+    parser.add_argument('--routes', type=int, default=100,
+                        help='routes injected by the external neighbor')
+    parser.add_argument('--len', type=int, default=24,
+                        help='prefix length of the injected routes')
+    parser.add_argument('--phase', type=int, default=300,
+                        help='seconds between events')
+    parser.add_argument('--json', help='also write the results here')
+    parser.add_argument('--no-build', action='store_true')
+    args = parser.parse_args()
+
+    os.chdir(os.path.dirname(os.path.abspath(__file__)))
+    if not args.no_build:
+        subprocess.check_call(['make', '-s', 'clean'])
+        subprocess.check_call(['make', '-s', 'BACKEND=SIM', 'boilerplate'])
+
+    results = {}
+    for name in args.topology.split(','):
+        if name not in TOPOLOGIES:
+            parser.error('unknown topology ' + name)
+        results[name] = run(name, args)
+        print_report(name, results[name])
+
+    if args.json:
+        json.dump({'args': vars(args), 'results': results},
+                  open(args.json, 'w'), indent=2)
@@ -0,0 +1,137 @@
+#include "ecmp.h"
+#include "router_hal.h"
+#include <algorithm>
+#include <map>
+#include <utility>
+#include <vector>
+#ifdef __SSE4_2__
+#include <nmmintrin.h>
+#endif
+
+struct EcmpGroup {
+  uint32_t count;
+  EcmpPath paths[ECMP_MAX_PATHS];
+  uint32_t keys[ECMP_MAX_PATHS]; // hash of each path, mixed with the flow's
+};
+
+typedef std::vector<std::pair<uint32_t, uint32_t>> EcmpMembers;
+
+// group 0 is unused, it means a single path
+ROUTER_LOCAL std::vector<EcmpGroup> ecmp_groups(1);
+ROUTER_LOCAL std::map<EcmpMembers, uint32_t> ecmp_ids;
+ROUTER_LOCAL uint32_t ecmp_seed = 0;
+
+#ifdef __SSE4_2__
+static uint32_t crc32c(uint32_t crc, uint32_t word) {
+  return _mm_crc32_u32(crc, word);
+}
+#else
+static const uint32_t *crc32cTable() {
+  static uint32_t table[256];
+  for (uint32_t i = 0; i < 256; i++) {
+    uint32_t crc = i;
+    for (int bit = 0; bit < 8; bit++) {
+      crc = (crc >> 1) ^ (crc & 1 ? 0x82f63b78 : 0);
+    }
+    table[i] = crc;
+  }
+  return table;
+}
+
+// same result as the SSE4.2 instruction
+static uint32_t crc32c(uint32_t crc, uint32_t word) {
+  // filled once, also when the sim backend runs many routers
+  static const uint32_t *table = crc32cTable();
+  for (int i = 0; i < 4; i++) {
+    crc = table[(crc ^ word) & 0xff] ^ (crc >> 8);
+    word >>= 8;
+  }
+  return crc;
+}
+#endif
+
+// murmur3 finalizer, so that a single changed bit changes every weight
+static uint32_t mix(uint32_t x) {
+  x ^= x >> 16;
+  x *= 0x85ebca6b;
+  x ^= x >> 13;
+  x *= 0xc2b2ae35;
+  x ^= x >> 16;
+  return x;
+}
+
+uint32_t ecmpGroup(const EcmpPath *paths, uint32_t count) {
+  if (count <= 1) {
+    return 0;
+  }
+  count = std::min(count, (uint32_t)ECMP_MAX_PATHS);
+  EcmpMembers members;
+  for (uint32_t i = 0; i < count; i++) {
+    members.push_back(std::make_pair(paths[i].nexthop, paths[i].if_index));
+  }
+  std::sort(members.begin(), members.end());
+  auto it = ecmp_ids.find(members);
+  if (it != ecmp_ids.end()) {
+    return it->second;
+  }
+
+  EcmpGroup group;
+  group.count = count;
+  for (uint32_t i = 0; i < count; i++) {
+    group.paths[i].nexthop = members[i].first;
+    group.paths[i].if_index = members[i].second;
+    // depends only on the path, a flow keeps it in every group it is in
+    group.keys[i] = crc32c(crc32c(0, members[i].first), members[i].second);
+  }
+  uint32_t id = ecmp_groups.size();
+  ecmp_groups.push_back(group);
+  ecmp_ids[members] = id;
+  return id;
+}
+
+bool ecmpSelect(uint32_t group, uint32_t hash, uint32_t *nexthop,
+                uint32_t *if_index) {
+  if (group == 0 || group >= ecmp_groups.size()) {
+    return false;
+  }
+  const EcmpGroup &g = ecmp_groups[group];
+  // the path with the highest weight wins
+  uint32_t best = 0;
+  uint32_t best_weight = mix(hash ^ g.keys[0]);
+  for (uint32_t i = 1; i < g.count; i++) {
+    uint32_t weight = mix(hash ^ g.keys[i]);
+    if (weight > best_weight) {
+      best = i;
+      best_weight = weight;
+    }
+  }
+  *nexthop = g.paths[best].nexthop;
+  *if_index = g.paths[best].if_index;
+  return true;
+}
+
+uint32_t ecmpFlowHash(const uint8_t *packet, size_t len) {
+  if (len < 20) {
+    return ecmp_seed;
+  }
+  uint32_t src = (uint32_t)packet[12] << 24 | packet[13] << 16 |
+                 packet[14] << 8 | packet[15];
+  uint32_t dst = (uint32_t)packet[16] << 24 | packet[17] << 16 |
+                 packet[18] << 8 | packet[19];
+  uint8_t protocol = packet[9];
+  uint32_t ports = 0;
+  size_t header_len = (packet[0] & 0xf) * 4;
+  // MF or a fragment offset: only the first fragment has the ports
+  bool fragment = ((packet[6] & 0x3f) | packet[7]) != 0;
+  if ((protocol == 6 || protocol == 17) && !fragment &&
+      len >= header_len + 4) {
+    const uint8_t *l4 = packet + header_len;
+    ports = (uint32_t)l4[0] << 24 | l4[1] << 16 | l4[2] << 8 | l4[3];
+  }
+  uint32_t crc = crc32c(ecmp_seed, src);
+  crc = crc32c(crc, dst);
+  crc = crc32c(crc, ports);
+  return crc32c(crc, protocol);
+}
+
+void ecmpSetSeed(uint32_t seed) { ecmp_seed = seed; }
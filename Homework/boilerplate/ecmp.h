@@ -0,0 +1,58 @@
+#ifndef __ROUTER_ECMP_H__
+#define __ROUTER_ECMP_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+  等价多路径（ECMP）。
+
+  一个前缀有多条 metric 相同的最优路径时，RIB 把它们做成一个组，
+  FIB 表项的 nexthop 和 if_index 是其中的一条，group 是组的编号。
+  转发时对 IPv4 头部的五元组求 CRC32C ，按照它在组内选一条路径：
+  同一个流的包总是走同一条路径，不会乱序。
+  选择用最高随机权重（rendezvous）哈希，组里少了一条路径时，
+  只有原来走这条路径的流会换路径。
+  组按照成员的集合去重，只增不减，邻居的组合不会很多。
+*/
+
+#define ECMP_MAX_PATHS 8
+
+typedef struct {
+  uint32_t nexthop; // 大端序，为 0 时是直连路由
+  uint32_t if_index;
+} EcmpPath;
+
+/**
+ * @brief 取得由这些路径组成的组，和顺序无关
+ * @param paths 路径数组，最多 ECMP_MAX_PATHS 条
+ * @param count 路径数
+ * @return 组的编号，只有一条路径时返回 0
+ */
+uint32_t ecmpGroup(const EcmpPath *paths, uint32_t count);
+
+/**
+ * @brief 在组内按照流的哈希值选一条路径
+ * @param group 组的编号
+ * @param hash ecmpFlowHash 的结果
+ * @param nexthop 选中路径的 nexthop 写入这里
+ * @param if_index 选中路径的 if_index 写入这里
+ * @return 组不存在时返回 false ，nexthop 和 if_index 不变
+ */
+bool ecmpSelect(uint32_t group, uint32_t hash, uint32_t *nexthop,
+                uint32_t *if_index);
+
+/**
+ * @brief 对 IPv4 包的源地址、目的地址、协议号和 TCP/UDP 端口求 CRC32C
+ *
+ * 分片的包不看端口，同一个包的各个分片结果相同。
+ */
+uint32_t ecmpFlowHash(const uint8_t *packet, size_t len);
+
+/**
+ * @brief 设置哈希的种子。各个路由器用不同的种子，
+ * 下一级的路由器不会因为收到的流哈希值都相同而只用一条路径
+ */
+void ecmpSetSeed(uint32_t seed);
+
+#endif
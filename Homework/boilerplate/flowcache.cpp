@@ -0,0 +1,120 @@
+#include "flowcache.h"
+#include "arena.h"
+#include <stdint.h>
+#include <string.h>
+
+// log2(FLOW_CACHE_SETS * FLOW_CACHE_WAYS)
+const uint32_t FLOW_CACHE_BITS = 12;
+
+// one cache line; the set is empty unless its generation is the current one
+struct alignas(64) FlowCacheSet {
+  uint32_t generation;
+  uint8_t valid; // bit i: way i holds a destination
+  uint8_t if_index[FLOW_CACHE_WAYS];
+  uint32_t addr[FLOW_CACHE_WAYS];
+  uint32_t nexthop[FLOW_CACHE_WAYS];
+  uint32_t group[FLOW_CACHE_WAYS];
+};
+
+ROUTER_LOCAL FlowCacheSet *flow_sets = NULL;
+ROUTER_LOCAL uint32_t flow_ways = 0;
+// sets start at generation 0, which is never current
+ROUTER_LOCAL uint32_t flow_generation = 1;
+
+// Fibonacci hashing; the last octet of the address is in the high byte of
+// addr and the multiply carries it into the bits taken
+static uint32_t flowSlot(uint32_t addr) {
+  return (addr * 0x9e3779b1u) >> (32 - FLOW_CACHE_BITS);
+}
+
+bool flowCacheInit(uint32_t ways) {
+  if (ways != 0 && ways != 1 && ways != FLOW_CACHE_WAYS) {
+    return false;
+  }
+  if (ways && flow_sets == NULL) {
+    size_t size = FLOW_CACHE_SETS * sizeof(FlowCacheSet);
+    hal_arena_t *arena = routeArena();
+    // the arena only aligns to 16 bytes
+    uintptr_t p = arena ? (uintptr_t)HAL_ArenaAlloc(arena, size + 64) : 0;
+    if (p == 0) {
+      return false;
+    }
+    flow_sets = (FlowCacheSet *)((p + 63) & ~(uintptr_t)63);
+    memset(flow_sets, 0, size);
+  }
+  flow_ways = ways;
+  return true;
+}
+
+bool flowCacheEnabled() { return flow_ways != 0; }
+
+bool flowCacheLookup(uint32_t addr, RoutingTableEntry *entry) {
+  if (flow_ways == 0) {
+    return false;
+  }
+  uint32_t slot = flowSlot(addr);
+  FlowCacheSet &set = flow_sets[slot / FLOW_CACHE_WAYS];
+  if (set.generation != flow_generation) {
+    return false;
+  }
+  // direct mapped: each way of the set is a slot of its own
+  uint32_t first = flow_ways == 1 ? slot % FLOW_CACHE_WAYS : 0;
+  for (uint32_t way = first; way < first + flow_ways; way++) {
+    if (!(set.valid >> way & 1) || set.addr[way] != addr) {
+      continue;
+    }
+    entry->nexthop = set.nexthop[way];
+    entry->if_index = set.if_index[way];
+    entry->group = set.group[way];
+    if (flow_ways > 1 && way > 0) {
+      // move up past the way in front, which is then the one to go first;
+      // the ways in use always start at 0, so both are valid
+      uint32_t up = way - 1;
+      set.addr[way] = set.addr[up];
+      set.nexthop[way] = set.nexthop[up];
+      set.if_index[way] = set.if_index[up];
+      set.group[way] = set.group[up];
+      set.addr[up] = addr;
+      set.nexthop[up] = entry->nexthop;
+      set.if_index[up] = entry->if_index;
+      set.group[up] = entry->group;
+    }
+    return true;
+  }
+  return false;
+}
+
+void flowCacheInsert(uint32_t addr, const RoutingTableEntry &entry) {
+  if (flow_ways == 0) {
+    return;
+  }
+  uint32_t slot = flowSlot(addr);
+  FlowCacheSet &set = flow_sets[slot / FLOW_CACHE_WAYS];
+  if (set.generation != flow_generation) {
+    set.generation = flow_generation;
+    set.valid = 0;
+  }
+  uint32_t way = slot % FLOW_CACHE_WAYS;
+  if (flow_ways > 1) {
+    // the first free way, or the last one, which is the least used
+    way = 0;
+    while (way < FLOW_CACHE_WAYS - 1 && (set.valid >> way & 1)) {
+      way++;
+    }
+  }
+  set.valid |= 1 << way;
+  set.addr[way] = addr;
+  set.nexthop[way] = entry.nexthop;
+  set.if_index[way] = entry.if_index;
+  set.group[way] = entry.group;
+}
+
+void flowCacheInvalidate() {
+  if (++flow_generation == 0) {
+    // wrapped around, a set left alone since would look current again
+    if (flow_sets) {
+      memset(flow_sets, 0, FLOW_CACHE_SETS * sizeof(FlowCacheSet));
+    }
+    flow_generation = 1;
+  }
+}
@@ -0,0 +1,53 @@
+#ifndef __ROUTER_FLOWCACHE_H__
+#define __ROUTER_FLOWCACHE_H__
+
+#include "router.h"
+#include <stdint.h>
+
+/*
+  目的地址的精确匹配缓存，放在 FIB 的最长前缀匹配之前。
+
+  流量集中在少数目的地址上时，它们的查询结果（ nexthop 、 if_index 和 ECMP
+  组）留在缓存里，转发时只读一个缓存行，不用每次都走一遍 lookup.cpp 中的
+  路由表。缓存有 FLOW_CACHE_SETS 组，每组 FLOW_CACHE_WAYS 项，占一个缓存行，
+  可以作为 4 路组相联或直接映射使用。4 路时命中的项向组的前面移动一格，
+  新的目的地址替换最后一项，偶尔出现的目的地址挤不走常用的。
+
+  FIB 每次改变（ rib.cpp 下发增量或整体装入）都让代数加一，之前的项全部作废，
+  缓存不需要知道哪些前缀变了。只缓存查到的结果，查不到路由的报文每次都查 FIB 。
+*/
+
+#define FLOW_CACHE_SETS 1024
+#define FLOW_CACHE_WAYS 4
+
+/**
+ * @brief 打开缓存，在转发前调用一次
+ * @param ways 1 表示直接映射，FLOW_CACHE_WAYS 表示组相联，0 表示不用缓存
+ * @return 内存不足或 ways 不合法时返回 false ，缓存保持关闭
+ */
+bool flowCacheInit(uint32_t ways);
+
+/**
+ * 缓存是否打开
+ */
+bool flowCacheEnabled();
+
+/**
+ * @brief 查询目的地址
+ * @param addr 大端序的目的地址
+ * @param entry 命中时写入缓存的 nexthop 、 if_index 和 group ，其他字段不变
+ * @return 命中时返回 true ，缓存关闭时总是返回 false
+ */
+bool flowCacheLookup(uint32_t addr, RoutingTableEntry *entry);
+
+/**
+ * @brief 记下 FIB 对 addr 的查询结果
+ */
+void flowCacheInsert(uint32_t addr, const RoutingTableEntry &entry);
+
+/**
+ * @brief FIB 改变了，作废缓存中的所有项
+ */
+void flowCacheInvalidate();
+
+#endif
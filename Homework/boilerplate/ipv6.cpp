@@ -0,0 +1,75 @@
+#include "ipv6.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+bool forward6(uint8_t *packet, size_t len) {
+  if (len < 40 || (packet[0] >> 4) != 6) {
+    return false;
+  }
+  // payload length, the frame may carry padding after it
+  size_t payload = (packet[4] << 8) | packet[5];
+  if (40 + payload > len) {
+    return false;
+  }
+  // hop limit, no checksum to update
+  if (packet[7] <= 1) {
+    return false;
+  }
+  packet[7]--;
+  return true;
+}
+
+bool parsePrefix6(const char *text, in6_addr_t *addr, uint32_t *len) {
+  char buffer[INET6_ADDRSTRLEN + 4];
+  size_t n = strlen(text);
+  if (n >= sizeof(buffer)) {
+    return false;
+  }
+  memcpy(buffer, text, n + 1);
+  *len = 128;
+  char *slash = strchr(buffer, '/');
+  if (slash) {
+    char *end;
+    *slash = '\0';
+    unsigned long value = strtoul(slash + 1, &end, 10);
+    if (end == slash + 1 || *end != '\0' || value > 128) {
+      return false;
+    }
+    *len = value;
+  }
+  return inet_pton(AF_INET6, buffer, addr->addr) == 1;
+}
+
+int loadRoutes6(const char *path) {
+  FILE *fp = fopen(path, "r");
+  if (fp == NULL) {
+    return -1;
+  }
+  int n = 0;
+  char line[256];
+  while (fgets(line, sizeof(line), fp)) {
+    char prefix[64], nexthop[64] = "::";
+    unsigned int if_index;
+    int fields = sscanf(line, "%63s %u %63s", prefix, &if_index, nexthop);
+    if (fields < 2 || prefix[0] == '#' || if_index >= N_IFACE_ON_BOARD) {
+      continue;
+    }
+    RoutingTableEntry6 entry;
+    memset(&entry, 0, sizeof(entry));
+    uint32_t nexthop_len;
+    if (!parsePrefix6(prefix, &entry.addr, &entry.len) ||
+        !parsePrefix6(nexthop, &entry.nexthop, &nexthop_len) ||
+        nexthop_len != 128) {
+      fprintf(stderr, "Bad IPv6 route in %s: %s", path, line);
+      continue;
+    }
+    entry.if_index = if_index;
+    // metric 1, as for a route learned from a neighbor
+    entry.metric = htonl(1);
+    update6(true, entry);
+    n++;
+  }
+  fclose(fp);
+  return n;
+}
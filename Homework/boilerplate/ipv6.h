@@ -0,0 +1,70 @@
+#ifndef __ROUTER_IPV6_H__
+#define __ROUTER_IPV6_H__
+
+#include "router_hal.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+  IPv6 转发。
+
+  路由表是按前缀长度分级的多比特 trie（见 lookup6.cpp ）：第一级一次看地址的
+  前 16 位，之后每级 8 位。常见的 /32 、 /40 、 /48 、 /56 、 /64 都正好落在
+  某一级的末尾，每条只占一个表项；其他长度在所在的一级中展开成若干个表项。
+  经过的路由最长到 /48 时查询只需要读 5 个表项，到 /64 时 7 个。
+
+  路由只有直连路由和 ROUTER_IPV6_ROUTES 中的静态路由，没有 RIPng 。
+*/
+
+typedef struct {
+  in6_addr_t addr;    // 前缀，只有前 len 位可能非零
+  uint32_t len;       // 前缀长度，[0, 128]
+  uint32_t if_index;  // 出端口编号
+  in6_addr_t nexthop; // 下一跳，全零表示直连路由
+  uint32_t metric;
+  uint64_t time_stamp;
+} RoutingTableEntry6;
+
+/**
+ * @brief 插入/删除一条 IPv6 路由，和 IPv4 的 update 一样，插入时替换 addr 和
+ * len 都相同的表项，删除时按照 addr 和 len 匹配
+ * @return 插入总是返回 true ，删除时表中没有该表项则返回 false
+ */
+bool update6(bool insert, RoutingTableEntry6 entry);
+
+/**
+ * @brief 按照最长前缀匹配原则查询 IPv6 路由
+ * @param addr 需要查询的目标地址
+ * @param nexthop 如果查询到目标，把表项的 nexthop 写入
+ * @param if_index 如果查询到目标，把表项的 if_index 写入
+ * @return 查到则返回 true ，没查到则返回 false
+ */
+bool query6(const in6_addr_t *addr, in6_addr_t *nexthop, uint32_t *if_index);
+
+/**
+ * IPv6 路由表中的表项数
+ */
+uint32_t routeCount6();
+
+/**
+ * @brief 解析 "2001:db8::1/64" 形式的地址和前缀长度，没有 "/" 时长度为 128
+ * @return 格式错误时返回 false
+ */
+bool parsePrefix6(const char *text, in6_addr_t *addr, uint32_t *len);
+
+/**
+ * @brief 从文件中读入静态路由，每行一条 "前缀/长度 出端口 [下一跳]" ，
+ * 省略下一跳时是直连路由，# 开头的行是注释
+ * @return 读入的路由条数，文件无法打开时返回 -1
+ */
+int loadRoutes6(const char *path);
+
+/**
+ * @brief 转发 IPv6 报文前的检查和更新：长度和版本号正确且 hop limit 大于 1
+ * 时把 hop limit 减一并返回 true ，否则返回 false 。IPv6 头部没有校验和
+ * @param packet 收到的 IPv6 报文，原地更改
+ * @param len packet 的长度，单位为字节
+ */
+bool forward6(uint8_t *packet, size_t len);
+
+#endif
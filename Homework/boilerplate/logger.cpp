@@ -0,0 +1,278 @@
+#include "logger.h"
+#include "router_hal.h"
+#include <atomic>
+#include <signal.h>
+#include <string.h>
+#include <thread>
+#include <unistd.h>
+
+// must be a power of two
+#define LOG_QUEUE_SIZE 4096
+#define LOG_QUEUE_MASK (LOG_QUEUE_SIZE - 1)
+// how long the writer sleeps when the queue is empty, in microseconds
+#define LOG_IDLE_SLEEP 1000
+
+// bounded MPMC queue (Vyukov): a cell is free for the producer at position p
+// when seq == p, and holds a record for the consumer when seq == p + 1
+struct LogCell {
+  std::atomic<uint32_t> seq;
+  LogRecord record;
+};
+
+static LogCell log_queue[LOG_QUEUE_SIZE];
+static std::atomic<uint32_t> log_head(0);
+static uint32_t log_tail = 0; // writer thread only
+static std::atomic<uint64_t> log_dropped(0);
+static std::atomic<bool> log_running(false);
+static std::thread log_thread;
+static FILE *log_fp = NULL;
+static volatile sig_atomic_t log_table_requested = 0;
+
+struct LogLimit {
+  uint32_t per_second; // 0: unlimited
+  uint32_t burst;
+};
+
+// drops can happen once per packet, keep them from flooding the output
+static LogLimit log_limits[LOG_TYPE_COUNT] = {
+    {10, 20}, // LOG_BAD_CHECKSUM
+    {10, 20}, // LOG_NO_ARP
+    {10, 20}, // LOG_NO_ROUTE
+    {0, 0},   // LOG_TIMER
+    {0, 0},   // LOG_RIP_UPDATE
+    {0, 0},   // LOG_TABLE
+};
+
+// token bucket, kept per producer thread so that the check needs no atomics
+struct LogBucket {
+  uint64_t last_ticks;
+  uint64_t milli_tokens;
+  uint32_t suppressed;
+  bool inited;
+};
+static thread_local LogBucket log_buckets[LOG_TYPE_COUNT];
+
+// set up the queue before main(), so logEvent works even without logInit
+static struct LogQueueInit {
+  LogQueueInit() {
+    for (uint32_t i = 0; i < LOG_QUEUE_SIZE; i++) {
+      log_queue[i].seq.store(i, std::memory_order_relaxed);
+    }
+  }
+} log_queue_init;
+
+static bool logEnqueue(const LogRecord *record) {
+  uint32_t pos = log_head.load(std::memory_order_relaxed);
+  LogCell *cell;
+  while (1) {
+    cell = &log_queue[pos & LOG_QUEUE_MASK];
+    uint32_t seq = cell->seq.load(std::memory_order_acquire);
+    int32_t diff = (int32_t)(seq - pos);
+    if (diff == 0) {
+      if (log_head.compare_exchange_weak(pos, pos + 1,
+                                         std::memory_order_relaxed)) {
+        break;
+      }
+    } else if (diff < 0) {
+      // full
+      log_dropped.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    } else {
+      pos = log_head.load(std::memory_order_relaxed);
+    }
+  }
+  cell->record = *record;
+  cell->seq.store(pos + 1, std::memory_order_release);
+  return true;
+}
+
+static bool logDequeue(LogRecord *record) {
+  LogCell *cell = &log_queue[log_tail & LOG_QUEUE_MASK];
+  if (cell->seq.load(std::memory_order_acquire) != log_tail + 1) {
+    return false;
+  }
+  *record = cell->record;
+  cell->seq.store(log_tail + LOG_QUEUE_SIZE, std::memory_order_release);
+  log_tail++;
+  return true;
+}
+
+// returns false if the record should be suppressed
+static bool logAdmit(LogType type, uint64_t ticks, uint32_t *suppressed) {
+  const LogLimit &limit = log_limits[type];
+  LogBucket &bucket = log_buckets[type];
+  if (limit.per_second == 0) {
+    *suppressed = 0;
+    return true;
+  }
+  uint64_t capacity = (uint64_t)limit.burst * 1000;
+  if (!bucket.inited) {
+    bucket.milli_tokens = capacity;
+    bucket.last_ticks = ticks;
+    bucket.inited = true;
+  }
+  // refill: per_second tokens per 1000 ticks
+  bucket.milli_tokens += (ticks - bucket.last_ticks) * limit.per_second;
+  if (bucket.milli_tokens > capacity) {
+    bucket.milli_tokens = capacity;
+  }
+  bucket.last_ticks = ticks;
+  if (bucket.milli_tokens < 1000) {
+    bucket.suppressed++;
+    return false;
+  }
+  bucket.milli_tokens -= 1000;
+  *suppressed = bucket.suppressed;
+  bucket.suppressed = 0;
+  return true;
+}
+
+static void logPrintAddr(FILE *fp, uint32_t addr) {
+  // big endian
+  fprintf(fp, "%u.%u.%u.%u", addr & 0xff, (addr >> 8) & 0xff,
+          (addr >> 16) & 0xff, (addr >> 24) & 0xff);
+}
+
+static void logPrintRoute(FILE *fp, const RoutingTableEntry *entry) {
+  logPrintAddr(fp, entry->addr);
+  fprintf(fp, "/%d ", entry->len);
+  if (entry->nexthop != 0) {
+    fprintf(fp, "via ");
+    logPrintAddr(fp, entry->nexthop);
+    fprintf(fp, " ");
+  }
+  if (entry->if_index == 0) {
+    fprintf(fp, "dev r2r1 ");
+  } else if (entry->if_index == 1) {
+    fprintf(fp, "dev r2r3 ");
+  } else {
+    fprintf(fp, "dev eth%d ", entry->if_index + 1);
+  }
+  if (entry->nexthop == 0) {
+    fprintf(fp, "scope link");
+  }
+  fprintf(fp, "\n");
+}
+
+static void logFormat(FILE *fp, const LogRecord *record) {
+  fprintf(fp, "[%llu.%03llu] ", (unsigned long long)record->ticks / 1000,
+          (unsigned long long)record->ticks % 1000);
+  switch (record->type) {
+  case LOG_BAD_CHECKSUM:
+    fprintf(fp, "Invalid IP Checksum from ");
+    logPrintAddr(fp, record->args[0]);
+    break;
+  case LOG_NO_ARP:
+    fprintf(fp, "ARP not found for nexthop ");
+    logPrintAddr(fp, record->args[0]);
+    fprintf(fp, " on if %u", record->args[1]);
+    break;
+  case LOG_NO_ROUTE:
+    fprintf(fp, "IP not found for src ");
+    logPrintAddr(fp, record->args[0]);
+    fprintf(fp, " dst ");
+    logPrintAddr(fp, record->args[1]);
+    break;
+  case LOG_TIMER:
+    fprintf(fp, "5s Timer, %u routes", record->args[0]);
+    break;
+  case LOG_RIP_UPDATE:
+    fprintf(fp, "RIP updated %u routes, %u routes in table", record->args[0],
+            record->args[1]);
+    break;
+  case LOG_TABLE:
+    fprintf(fp, "Routing table, %u routes\n", record->args[0]);
+    for (uint32_t i = 0; i < record->args[0]; i++) {
+      logPrintRoute(fp, &record->routes[i]);
+    }
+    delete[] record->routes;
+    return;
+  default:
+    fprintf(fp, "Unknown log record %u", record->type);
+    break;
+  }
+  if (record->suppressed) {
+    fprintf(fp, " (%u similar messages suppressed)", record->suppressed);
+  }
+  fprintf(fp, "\n");
+}
+
+static void logWriter() {
+  LogRecord record;
+  while (1) {
+    bool idle = true;
+    while (logDequeue(&record)) {
+      logFormat(log_fp, &record);
+      idle = false;
+    }
+    if (!idle) {
+      fflush(log_fp);
+    } else if (!log_running.load(std::memory_order_acquire)) {
+      break;
+    } else {
+      usleep(LOG_IDLE_SLEEP);
+    }
+  }
+}
+
+void logInit(FILE *fp) {
+  // several routers may share the process (sim backend), only start one writer
+  bool running = false;
+  if (!log_running.compare_exchange_strong(running, true)) {
+    return;
+  }
+  log_fp = fp;
+  log_thread = std::thread(logWriter);
+}
+
+void logSetRateLimit(LogType type, uint32_t per_second, uint32_t burst) {
+  log_limits[type].per_second = per_second;
+  log_limits[type].burst = burst ? burst : 1;
+}
+
+bool logEvent(LogType type, uint32_t arg0, uint32_t arg1) {
+  LogRecord record;
+  record.ticks = HAL_GetTicks();
+  if (!logAdmit(type, record.ticks, &record.suppressed)) {
+    return false;
+  }
+  record.type = type;
+  record.args[0] = arg0;
+  record.args[1] = arg1;
+  record.routes = NULL;
+  return logEnqueue(&record);
+}
+
+bool logTable(RoutingTableEntry *routes, uint32_t n_routes) {
+  LogRecord record;
+  record.type = LOG_TABLE;
+  record.suppressed = 0;
+  record.ticks = HAL_GetTicks();
+  record.args[0] = n_routes;
+  record.args[1] = 0;
+  record.routes = routes;
+  if (!logEnqueue(&record)) {
+    delete[] routes;
+    return false;
+  }
+  return true;
+}
+
+void logRequestTable() { log_table_requested = 1; }
+
+bool logTableRequested() {
+  if (log_table_requested) {
+    log_table_requested = 0;
+    return true;
+  }
+  return false;
+}
+
+uint64_t logDropped() { return log_dropped.load(std::memory_order_relaxed); }
+
+void logShutdown() {
+  if (!log_running.exchange(false, std::memory_order_acq_rel)) {
+    return;
+  }
+  log_thread.join();
+}
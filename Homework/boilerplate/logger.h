@@ -0,0 +1,79 @@
+#ifndef __ROUTER_LOGGER_H__
+#define __ROUTER_LOGGER_H__
+
+#include "router.h"
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+  异步日志。
+
+  热路径上只把定长的二进制记录放进一个无锁的环形队列，格式化和 stdio 输出
+  都在后台的写线程里完成；队列满时直接丢弃记录而不是阻塞转发。
+  每种消息有独立的令牌桶限速，被限速吞掉的条数会附在下一条放行的记录上。
+*/
+
+enum LogType {
+  LOG_BAD_CHECKSUM, // args: src
+  LOG_NO_ARP,       // args: nexthop, if_index
+  LOG_NO_ROUTE,     // args: src, dst
+  LOG_TIMER,        // args: routes
+  LOG_RIP_UPDATE,   // args: updated, routes
+  LOG_TABLE,        // args: n_routes，路由表快照见 logTable
+  LOG_TYPE_COUNT,
+};
+
+typedef struct {
+  uint32_t type;
+  uint32_t suppressed; // 此前因限速而丢弃的同类记录数
+  uint64_t ticks;
+  uint32_t args[2];
+  RoutingTableEntry *routes; // LOG_TABLE 时有效，由写线程释放
+} LogRecord;
+
+/**
+ * @brief 启动后台写线程
+ * @param fp 日志输出的位置
+ */
+void logInit(FILE *fp);
+
+/**
+ * @brief 设置某类消息的限速
+ * @param per_second 每秒允许的条数，0 表示不限速
+ * @param burst 允许的突发条数
+ */
+void logSetRateLimit(LogType type, uint32_t per_second, uint32_t burst);
+
+/**
+ * @brief 记录一条消息，不会阻塞
+ * @return 记录进入队列则返回 true，被限速或队列满则返回 false
+ */
+bool logEvent(LogType type, uint32_t arg0 = 0, uint32_t arg1 = 0);
+
+/**
+ * @brief 把一份路由表快照交给写线程输出，routes 须由 new[] 分配，
+ * 所有权转移给日志线程
+ */
+bool logTable(RoutingTableEntry *routes, uint32_t n_routes);
+
+/**
+ * @brief 请求在主循环中输出一次路由表，可以在信号处理函数中调用
+ */
+void logRequestTable();
+
+/**
+ * @brief 检查并清除 logRequestTable 设置的请求
+ */
+bool logTableRequested();
+
+/**
+ * @brief 因队列满而丢弃的记录数
+ */
+uint64_t logDropped();
+
+/**
+ * @brief 输出队列中剩余的记录并停止写线程
+ */
+void logShutdown();
+
+#endif
@@ -0,0 +1,262 @@
+#include "ipv6.h"
+#include "arena.h"
+#include <functional>
+#include <map>
+#include <utility>
+#include <vector>
+
+// multibit trie with controlled prefix expansion. A node at depth d looks at
+// bits [d, d + stride) of the address; a route of length l with
+// d < l <= d + stride lives in that node, copied into the 2^(d + stride - l)
+// slots it covers, and a slot keeps the longest of the routes copied into it.
+// A lookup remembers the last route it passed on the way down, so a node never
+// holds the routes of the levels above it. ::/0 is kept aside.
+
+const uint32_t LPM6_ROOT_STRIDE = 16;
+const uint32_t LPM6_STRIDE = 8;
+const uint32_t LPM6_ROOT_SLOTS = 1 << LPM6_ROOT_STRIDE;
+const uint32_t LPM6_NODE_SLOTS = 1 << LPM6_STRIDE;
+const uint32_t LPM6_NONE = 0xffffffff;
+
+struct Lpm6Slot {
+  uint32_t child; // first slot of the child node, 0 if none (0 is the root)
+  uint32_t route; // index in lpm6_routes + 1, 0 if none
+};
+
+struct Lpm6Addr {
+  uint64_t hi, lo; // host byte order
+};
+
+typedef std::pair<std::pair<uint64_t, uint64_t>, uint32_t> Lpm6Key;
+
+// the slots and the routes live in routeArena, on hugepages where possible
+// the root, then nodes of LPM6_NODE_SLOTS slots; allocated with the first route
+ROUTER_LOCAL std::vector<Lpm6Slot, ArenaAllocator<Lpm6Slot>> lpm6_slots;
+// slots in use (with a child or a route) of each node below the root
+ROUTER_LOCAL std::vector<uint32_t> lpm6_used;
+ROUTER_LOCAL std::vector<uint32_t> lpm6_free_nodes;
+ROUTER_LOCAL std::vector<RoutingTableEntry6, ArenaAllocator<RoutingTableEntry6>>
+    lpm6_routes;
+ROUTER_LOCAL std::vector<uint32_t> lpm6_free_routes;
+// (prefix, len) -> index in lpm6_routes + 1
+ROUTER_LOCAL std::map<Lpm6Key, uint32_t, std::less<Lpm6Key>,
+                      ArenaAllocator<std::pair<const Lpm6Key, uint32_t>>>
+    lpm6_index;
+ROUTER_LOCAL uint32_t lpm6_default = 0;
+
+static Lpm6Addr lpm6Load(const uint8_t *addr) {
+  Lpm6Addr res = {0, 0};
+  for (int i = 0; i < 8; i++) {
+    res.hi = (res.hi << 8) | addr[i];
+    res.lo = (res.lo << 8) | addr[i + 8];
+  }
+  return res;
+}
+
+static Lpm6Addr lpm6Mask(Lpm6Addr addr, uint32_t len) {
+  if (len < 64) {
+    addr.hi = len == 0 ? 0 : addr.hi & (~0ULL << (64 - len));
+    addr.lo = 0;
+  } else if (len < 128) {
+    addr.lo = len == 64 ? 0 : addr.lo & (~0ULL << (128 - len));
+  }
+  return addr;
+}
+
+static Lpm6Key lpm6Key(Lpm6Addr prefix, uint32_t len) {
+  return Lpm6Key(std::make_pair(prefix.hi, prefix.lo), len);
+}
+
+static uint32_t lpm6Stride(uint32_t depth) {
+  return depth == 0 ? LPM6_ROOT_STRIDE : LPM6_STRIDE;
+}
+
+// depth of the node a route of length len (>= 1) lives in
+static uint32_t lpm6Depth(uint32_t len) {
+  if (len <= LPM6_ROOT_STRIDE) {
+    return 0;
+  }
+  return LPM6_ROOT_STRIDE +
+         (len - LPM6_ROOT_STRIDE - 1) / LPM6_STRIDE * LPM6_STRIDE;
+}
+
+// the slot index of addr in the node at depth; strides never cross the middle
+static uint32_t lpm6Index(Lpm6Addr addr, uint32_t depth) {
+  uint32_t stride = lpm6Stride(depth);
+  uint64_t half = depth < 64 ? addr.hi : addr.lo;
+  return (half >> (64 - depth % 64 - stride)) & ((1u << stride) - 1);
+}
+
+static uint32_t lpm6NodeOf(uint32_t slot) {
+  if (slot < LPM6_ROOT_SLOTS) {
+    return 0;
+  }
+  return slot - (slot - LPM6_ROOT_SLOTS) % LPM6_NODE_SLOTS;
+}
+
+static void lpm6Set(uint32_t slot, uint32_t child, uint32_t route) {
+  Lpm6Slot &s = lpm6_slots[slot];
+  bool was = s.child || s.route;
+  s.child = child;
+  s.route = route;
+  bool now = child || route;
+  if (slot >= LPM6_ROOT_SLOTS && was != now) {
+    uint32_t &used =
+        lpm6_used[(slot - LPM6_ROOT_SLOTS) / LPM6_NODE_SLOTS];
+    used = now ? used + 1 : used - 1;
+  }
+}
+
+static uint32_t lpm6AllocNode() {
+  if (!lpm6_free_nodes.empty()) {
+    uint32_t node = lpm6_free_nodes.back();
+    lpm6_free_nodes.pop_back();
+    return node;
+  }
+  uint32_t node = lpm6_slots.size();
+  lpm6_slots.resize(node + LPM6_NODE_SLOTS, Lpm6Slot());
+  lpm6_used.push_back(0);
+  return node;
+}
+
+// walks down to the node a route of length len lives in, creating the nodes on
+// the way if asked to; path gets the slots that were passed
+static uint32_t lpm6Walk(Lpm6Addr prefix, uint32_t len, bool create,
+                         std::vector<uint32_t> *path) {
+  uint32_t node = 0;
+  uint32_t depth = 0;
+  while (depth + lpm6Stride(depth) < len) {
+    uint32_t slot = node + lpm6Index(prefix, depth);
+    if (lpm6_slots[slot].child == 0) {
+      if (!create) {
+        return LPM6_NONE;
+      }
+      uint32_t child = lpm6AllocNode();
+      lpm6Set(slot, child, lpm6_slots[slot].route);
+    }
+    if (path) {
+      path->push_back(slot);
+    }
+    node = lpm6_slots[slot].child;
+    depth += lpm6Stride(depth);
+  }
+  return node;
+}
+
+static uint32_t lpm6AllocRoute(const RoutingTableEntry6 &entry) {
+  if (!lpm6_free_routes.empty()) {
+    uint32_t route = lpm6_free_routes.back();
+    lpm6_free_routes.pop_back();
+    lpm6_routes[route - 1] = entry;
+    return route;
+  }
+  lpm6_routes.push_back(entry);
+  return lpm6_routes.size();
+}
+
+bool update6(bool insert, RoutingTableEntry6 entry) {
+  if (entry.len > 128) {
+    return false;
+  }
+  Lpm6Addr prefix = lpm6Mask(lpm6Load(entry.addr.addr), entry.len);
+  Lpm6Key key = lpm6Key(prefix, entry.len);
+  auto it = lpm6_index.find(key);
+  if (lpm6_slots.empty()) {
+    lpm6_slots.resize(LPM6_ROOT_SLOTS, Lpm6Slot());
+  }
+
+  if (insert) {
+    if (it != lpm6_index.end()) {
+      // the slots stay, only what they point to changes
+      lpm6_routes[it->second - 1] = entry;
+      return true;
+    }
+    uint32_t route = lpm6AllocRoute(entry);
+    lpm6_index[key] = route;
+    if (entry.len == 0) {
+      lpm6_default = route;
+      return true;
+    }
+    uint32_t node = lpm6Walk(prefix, entry.len, true, NULL);
+    uint32_t depth = lpm6Depth(entry.len);
+    uint32_t first = node + lpm6Index(prefix, depth);
+    uint32_t count = 1u << (depth + lpm6Stride(depth) - entry.len);
+    for (uint32_t slot = first; slot < first + count; slot++) {
+      uint32_t old = lpm6_slots[slot].route;
+      if (old == 0 || lpm6_routes[old - 1].len <= entry.len) {
+        lpm6Set(slot, lpm6_slots[slot].child, route);
+      }
+    }
+    return true;
+  }
+
+  if (it == lpm6_index.end()) {
+    return false;
+  }
+  uint32_t route = it->second;
+  lpm6_index.erase(it);
+  lpm6_free_routes.push_back(route);
+  if (entry.len == 0) {
+    lpm6_default = 0;
+    return true;
+  }
+  std::vector<uint32_t> path;
+  uint32_t node = lpm6Walk(prefix, entry.len, false, &path);
+  uint32_t depth = lpm6Depth(entry.len);
+  // the slots go to the next longest route of the same node that covers them
+  uint32_t cover = 0;
+  for (uint32_t len = entry.len - 1; len > depth && cover == 0; len--) {
+    auto found = lpm6_index.find(lpm6Key(lpm6Mask(prefix, len), len));
+    if (found != lpm6_index.end()) {
+      cover = found->second;
+    }
+  }
+  uint32_t first = node + lpm6Index(prefix, depth);
+  uint32_t count = 1u << (depth + lpm6Stride(depth) - entry.len);
+  for (uint32_t slot = first; slot < first + count; slot++) {
+    if (lpm6_slots[slot].route == route) {
+      lpm6Set(slot, lpm6_slots[slot].child, cover);
+    }
+  }
+  // give back the nodes left empty, bottom up
+  while (node != 0 &&
+         lpm6_used[(node - LPM6_ROOT_SLOTS) / LPM6_NODE_SLOTS] == 0) {
+    lpm6_free_nodes.push_back(node);
+    uint32_t slot = path.back();
+    path.pop_back();
+    lpm6Set(slot, 0, lpm6_slots[slot].route);
+    node = lpm6NodeOf(slot);
+  }
+  return true;
+}
+
+bool query6(const in6_addr_t *addr, in6_addr_t *nexthop, uint32_t *if_index) {
+  uint32_t best = lpm6_default;
+  if (!lpm6_slots.empty()) {
+    Lpm6Addr a = lpm6Load(addr->addr);
+    const Lpm6Slot *slots = lpm6_slots.data();
+    const Lpm6Slot *slot = &slots[a.hi >> (64 - LPM6_ROOT_STRIDE)];
+    uint32_t depth = LPM6_ROOT_STRIDE;
+    while (1) {
+      if (slot->route) {
+        best = slot->route;
+      }
+      if (slot->child == 0) {
+        break;
+      }
+      uint64_t half = depth < 64 ? a.hi : a.lo;
+      slot = &slots[slot->child +
+                    ((half >> (56 - depth % 64)) & (LPM6_NODE_SLOTS - 1))];
+      depth += LPM6_STRIDE;
+    }
+  }
+  if (best == 0) {
+    return false;
+  }
+  const RoutingTableEntry6 &entry = lpm6_routes[best - 1];
+  *nexthop = entry.nexthop;
+  *if_index = entry.if_index;
+  return true;
+}
+
+uint32_t routeCount6() { return lpm6_index.size(); }
@@ -1,6 +1,16 @@
 #include "router_hal.h"
+#include "ecmp.h"
+#include "flowcache.h"
+#include "ipv6.h"
+#include "logger.h"
+#include "rangefib.h"
+#include "rib.h"
 #include "rip.h"
 #include "router.h"
+#include "snapshot.h"
+#include "stats.h"
+#include <arpa/inet.h>
+#include <signal.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -11,37 +21,401 @@ typedef uint32_t in_addr_t;
 extern bool validateIPChecksum(uint8_t *packet, size_t len);
 extern bool update(bool insert, RoutingTableEntry entry);
 extern bool query(uint32_t addr, uint32_t *nexthop, uint32_t *if_index);
+extern bool queryEntry(uint32_t addr, RoutingTableEntry *entry);
 extern bool forward(uint8_t *packet, size_t len);
 extern bool disassemble(const uint8_t *packet, uint32_t len, RipPacket *output);
 extern uint32_t assemble(const RipPacket *rip, uint8_t *buffer);
-extern void genRipPack(uint32_t if_index, RipPacket* rip);
+extern bool genRipPack(uint32_t if_index, RipPacket *rip, const void **cursor);
 extern uint16_t checkSum(uint8_t * packet);
-extern void printTable();
+extern uint32_t snapshotTable(RoutingTableEntry *output, uint32_t max);
+extern uint32_t routeCount();
 
 
+// 掩码是大端序
 uint32_t mask2len(uint32_t mask) {
-  for (uint32_t i  = 0; i < 32; i++) {
-    if (((mask + 1) >> i) & 0x1 == 1) {
-      return i ;
-    }
-  }
-  return 32;
+  uint32_t host = ntohl(mask);
+  return host ? 32 - __builtin_ctz(host) : 0;
 }
 
-uint8_t packet[2048];
-uint8_t output[2048];
+ROUTER_LOCAL uint8_t output[2048];
 // 0: 10.0.0.1
 // 1: 10.0.1.1
 // 2: 10.0.2.1
 // 3: 10.0.3.1
-// 你可以按需进行修改，注意端序
-in_addr_t addrs[N_IFACE_ON_BOARD] = {0x0203a8c0, 0x0104a8c0, 0x0102000a, 0x0103000a};
+// 你可以按需进行修改，注意端序，也可以在命令行上依次给出
+ROUTER_LOCAL in_addr_t addrs[N_IFACE_ON_BOARD] = {0x0203a8c0, 0x0104a8c0, 0x0102000a, 0x0103000a};
+// IPv6 的全局地址，由环境变量 ROUTER_IPV6 给出，全零表示没有
+ROUTER_LOCAL in6_addr_t addrs6[N_IFACE_ON_BOARD];
+
+// 发送 IP 报文并计入发送统计
+int sendIPPacket(int if_index, uint8_t *buffer, size_t length,
+                 macaddr_t dst_mac) {
+  int res = HAL_SendIPPacket(if_index, buffer, length, dst_mac);
+  if (res == 0) {
+    StatsCounters *stats = statsLocal();
+    statsAdd(&stats->iface[if_index].tx_packets, 1);
+    statsAdd(&stats->iface[if_index].tx_bytes, length);
+  }
+  return res;
+}
+
+// 发送缓冲池中的报文并计入发送统计，报文交给了 HAL ，之后不能再使用
+int sendPacket(int if_index, hal_packet_t *packet, macaddr_t dst_mac) {
+  size_t length = packet->length;
+  int res = HAL_SendPacket(if_index, packet, dst_mac);
+  if (res == 0) {
+    StatsCounters *stats = statsLocal();
+    statsAdd(&stats->iface[if_index].tx_packets, 1);
+    statsAdd(&stats->iface[if_index].tx_bytes, length);
+  }
+  return res;
+}
+
+// RIP 组播地址 224.0.0.9 （大端序）和它的 MAC 地址
+const in_addr_t RIP_MULTICAST_ADDR = 0x090000e0;
+macaddr_t rip_multicast_mac = {0x01, 0x00, 0x5e, 0x00, 0x00, 0x09};
+
+// 把 RIP 报文装进 IP 和 UDP ，从 if_index 发给 dst_addr
+void sendRip(uint32_t if_index, in_addr_t dst_addr, macaddr_t dst_mac,
+             const RipPacket *rip) {
+  // IP
+  output[0] = 0x45;
+  output[1] = 0x0; // type of sevice
+  output[2] = 0x0; // total length
+  output[3] = 0x0;
+  output[4] = 0x0; // identification
+  output[5] = 0x0;
+  output[6] = 0x0; // flags
+  output[7] = 0x0;
+  output[8] = 0x1;  // TTL
+  output[9] = 0x11; // protocal
+  output[10] = 0x0; // checksum
+  output[11] = 0x0;
+  memcpy(&output[12], &addrs[if_index], sizeof(in_addr_t)); // src addr
+  memcpy(&output[16], &dst_addr, sizeof(in_addr_t));        // dst addr
+  // UDP
+  // port = 520
+  output[20] = 0x02; // src port
+  output[21] = 0x08;
+  output[22] = 0x02; // dst port
+  output[23] = 0x08;
+  output[24] = 0x00; // length
+  output[25] = 0x00;
+  output[26] = 0x00; // checksum
+  output[27] = 0x00;
+  // RIP
+  uint32_t rip_len = assemble(rip, &output[20 + 8]);
+  // calc len for ip header and udp header
+  uint16_t ip_len = rip_len + 20 + 8;
+  uint16_t udp_len = rip_len + 8;
+  output[2] = ip_len >> 8;
+  output[3] = ip_len & 0xff;
+  output[24] = udp_len >> 8;
+  output[25] = udp_len & 0xff;
+  // checksum calculation for ip, the udp checksum is left zero
+  uint16_t checksum = checkSum(output);
+  output[10] = checksum & 0xff; // checkSum 按主机序求和，和 forward 一样按主机序写回
+  output[11] = checksum >> 8;
+  sendIPPacket(if_index, output, ip_len, dst_mac);
+}
+
+// 把 RIB 给出的不超过 RIP_MAX_ENTRY 个撤销了的前缀以 metric 16 通告出去
+void sendRipWithdrawn(uint32_t if_index, in_addr_t dst_addr,
+                      macaddr_t dst_mac, const RoutingTableEntry *routes,
+                      uint32_t count) {
+  RipPacket resp;
+  resp.command = 2;
+  resp.numEntries = count;
+  for (uint32_t i = 0; i < count; i++) {
+    resp.entries[i].addr = routes[i].addr;
+    resp.entries[i].mask = htonl(routes[i].len ? ~0u << (32 - routes[i].len) : 0);
+    resp.entries[i].nexthop = routes[i].nexthop;
+    resp.entries[i].metric = routes[i].metric;
+  }
+  sendRip(if_index, dst_addr, dst_mac, &resp);
+}
+
+// 聚合 FIB 时为 true ，RIP 通告 RIB 中的最优路由
+ROUTER_LOCAL bool rip_from_rib = false;
+
+// 和 genRipPack 一样，只是路由来自 ribBest
+void sendRipBest(uint32_t if_index, in_addr_t dst_addr, macaddr_t dst_mac) {
+  RoutingTableEntry best[RIP_MAX_ENTRY];
+  uint64_t position = 0;
+  uint32_t n;
+  do {
+    n = ribBest(best, RIP_MAX_ENTRY, &position);
+    RipPacket resp;
+    resp.command = 2;
+    resp.numEntries = 0;
+    for (uint32_t i = 0; i < n; i++) {
+      // poison reverse, direct routes on if_index are not sent at all
+      if (best[i].if_index == if_index && best[i].nexthop == 0) {
+        continue;
+      }
+      RipEntry &entry = resp.entries[resp.numEntries++];
+      entry.addr = best[i].addr;
+      entry.mask = htonl(best[i].len ? ~0u << (32 - best[i].len) : 0);
+      entry.nexthop = best[i].nexthop;
+      entry.metric = best[i].if_index == if_index
+                         ? htonl(RIB_INFINITY)
+                         : htonl(ntohl(best[i].metric) + 1);
+    }
+    if (resp.numEntries > 0) {
+      sendRip(if_index, dst_addr, dst_mac, &resp);
+    }
+  } while (n == RIP_MAX_ENTRY);
+}
+
+// 把路由表通告给 if_index 上的 dst_addr ，每 RIP_MAX_ENTRY 项一个报文，
+// 等待删除的前缀跟在后面
+void sendRipTable(uint32_t if_index, in_addr_t dst_addr, macaddr_t dst_mac) {
+  if (rip_from_rib) {
+    sendRipBest(if_index, dst_addr, dst_mac);
+  } else {
+    const void *cursor = NULL;
+    bool more;
+    do {
+      RipPacket resp;
+      more = genRipPack(if_index, &resp, &cursor);
+      resp.command = 2;
+      sendRip(if_index, dst_addr, dst_mac, &resp);
+    } while (more);
+  }
+  RoutingTableEntry withdrawn[RIP_MAX_ENTRY];
+  uint32_t position = 0;
+  uint32_t n;
+  do {
+    n = ribWithdrawn(withdrawn, RIP_MAX_ENTRY, &position);
+    if (n > 0) {
+      sendRipWithdrawn(if_index, dst_addr, dst_mac, withdrawn, n);
+    }
+  } while (n == RIP_MAX_ENTRY);
+}
+
+// 触发更新：最优路由刚刚消失的前缀马上以 metric 16 通告给所有接口，
+// ref. RFC2453 Section 3.10.1
+void sendTriggeredUpdate() {
+  RoutingTableEntry withdrawn[RIP_MAX_ENTRY];
+  uint32_t n;
+  do {
+    n = ribTakeWithdrawn(withdrawn, RIP_MAX_ENTRY);
+    for (int j = 0; n > 0 && j < N_IFACE_ON_BOARD; j++) {
+      sendRipWithdrawn(j, RIP_MULTICAST_ADDR, rip_multicast_mac, withdrawn, n);
+    }
+  } while (n == RIP_MAX_ENTRY);
+}
+
+// 打开 IPv6 ，config 是逗号分隔的各个端口的地址，如 "2001:db8::1/64,,fd00::1/64"
+// ，省略前缀长度时为 /64 ；加入这些地址的直连路由和 ROUTER_IPV6_ROUTES 中的静态路由
+int setupIPv6(const char *config) {
+  uint32_t lens[N_IFACE_ON_BOARD] = {0};
+  const char *p = config;
+  for (int i = 0; i < N_IFACE_ON_BOARD && *p; i++) {
+    const char *comma = strchr(p, ',');
+    size_t n = comma ? comma - p : strlen(p);
+    char text[64];
+    if (n > 0) {
+      if (n >= sizeof(text)) {
+        n = sizeof(text) - 1;
+      }
+      memcpy(text, p, n);
+      text[n] = '\0';
+      if (!parsePrefix6(text, &addrs6[i], &lens[i])) {
+        fprintf(stderr, "Bad IPv6 address for if %d: %s\n", i, text);
+        return -1;
+      }
+      if (strchr(text, '/') == NULL) {
+        lens[i] = 64;
+      }
+    }
+    p = comma ? comma + 1 : p + n;
+  }
+  int res = HAL_InitIPv6(addrs6);
+  if (res != 0) {
+    return res;
+  }
+  for (int i = 0; i < N_IFACE_ON_BOARD; i++) {
+    if (lens[i] == 0) {
+      continue;
+    }
+    RoutingTableEntry6 entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.addr = addrs6[i];
+    entry.len = lens[i];
+    entry.if_index = i;
+    update6(true, entry);
+  }
+  const char *routes = getenv("ROUTER_IPV6_ROUTES");
+  if (routes && routes[0]) {
+    int n = loadRoutes6(routes);
+    if (n < 0) {
+      fprintf(stderr, "Cannot read IPv6 routes from %s\n", routes);
+    } else {
+      fprintf(stderr, "Loaded %d IPv6 route(s) from %s\n", n, routes);
+    }
+  }
+  return 0;
+}
+
+// 转发一个 IPv6 报文；发给路由器自己的只有邻居发现，由 HAL 处理。
+// 返回 true 时报文已经交给了 HAL
+bool forwardIPv6(hal_packet_t *received, StatsCounters *stats) {
+  uint8_t *packet = received->data;
+  size_t len = received->length;
+  if (len < 40) {
+    statsAdd(&stats->drops[STATS_DROP_TRUNCATED], 1);
+    return false;
+  }
+  in6_addr_t dst;
+  memcpy(dst.addr, &packet[24], sizeof(dst.addr));
+  // multicast and link local never leave the link
+  if (dst.addr[0] == 0xff || (dst.addr[0] == 0xfe && (dst.addr[1] & 0xc0) == 0x80)) {
+    return false;
+  }
+  for (int i = 0; i < N_IFACE_ON_BOARD; i++) {
+    if (memcmp(dst.addr, addrs6[i].addr, sizeof(dst.addr)) == 0) {
+      return false;
+    }
+  }
+  if (!forward6(packet, len)) {
+    // hop limit used up or a bad header, dropped without an ICMPv6 error
+    statsAdd(&stats->drops[packet[7] <= 1 ? STATS_DROP_HOP_LIMIT
+                                          : STATS_DROP_TRUNCATED], 1);
+    return false;
+  }
+  in6_addr_t nexthop;
+  uint32_t dest_if;
+  statsAdd(&stats->lookups, 1);
+  if (!query6(&dst, &nexthop, &dest_if)) {
+    statsAdd(&stats->lookup_misses, 1);
+    statsAdd(&stats->drops[STATS_DROP_NO_ROUTE], 1);
+    return false;
+  }
+  bool direct = true;
+  for (int i = 0; i < 16; i++) {
+    direct = direct && nexthop.addr[i] == 0;
+  }
+  if (direct) {
+    nexthop = dst;
+  }
+  macaddr_t dst_mac;
+  if (HAL_NdGetMacAddress(dest_if, nexthop, dst_mac) != 0) {
+    // the HAL has sent an NS, the packets after the NA get through
+    statsAdd(&stats->drops[STATS_DROP_NO_ARP], 1);
+    return false;
+  }
+  // only the hop limit changed, the HAL sends this very buffer
+  if (sendPacket(dest_if, received, dst_mac) == 0) {
+    statsAdd(&stats->forwarded, 1);
+    statsAdd(&stats->forwarded6, 1);
+  }
+  return true;
+}
+
+// 查询 IPv4 路由，打开流缓存（见 flowcache.h ）时先查缓存，打开编译的 FIB
+// （见 rangefib.h ）且它没有过时时再查它，否则查 lookup.cpp ；
+// 不是 lookup.cpp 回答的 route 中只有 nexthop 、 if_index 和 group
+bool lookupRoute(uint32_t dst_addr, RoutingTableEntry *route,
+                 StatsCounters *stats) {
+  if (flowCacheEnabled()) {
+    if (flowCacheLookup(dst_addr, route)) {
+      statsAdd(&stats->flow_cache_hits, 1);
+      return true;
+    }
+    statsAdd(&stats->flow_cache_misses, 1);
+  }
+  bool found;
+  if (rangeFibCurrent()) {
+    statsAdd(&stats->range_fib_lookups, 1);
+    found = rangeFibLookup(dst_addr, route);
+  } else {
+    if (rangeFibEnabled()) {
+      statsAdd(&stats->range_fib_stale, 1);
+    }
+    found = queryEntry(dst_addr, route);
+  }
+  if (!found) {
+    return false;
+  }
+  flowCacheInsert(dst_addr, *route);
+  return true;
+}
+
+// 把路由表的快照交给日志线程输出
+void dumpTable() {
+  uint32_t n = routeCount();
+  RoutingTableEntry *routes = new RoutingTableEntry[n];
+  n = snapshotTable(routes, n);
+  logTable(routes, n);
+}
+
+void requestTable(int sig) { logRequestTable(); }
 
 int main(int argc, char *argv[]) {
+  // ROUTER_SNAPSHOT=<file> 时定期保存路由器状态，启动时从中恢复
+  const char *snapshot_path = getenv("ROUTER_SNAPSHOT");
+#ifdef ROUTER_BACKEND_SIM
+  // simulated routers would all share the one file
+  snapshot_path = NULL;
+#endif
+  // ROUTER_FIB_AGGREGATE=1 时 FIB 只保存聚合后的最少前缀
+  const char *aggregate = getenv("ROUTER_FIB_AGGREGATE");
+  rip_from_rib = aggregate && aggregate[0] && aggregate[0] != '0';
+  ribSetAggregate(rip_from_rib);
+  // ROUTER_FLOW_CACHE=4 时在 FIB 前加一个 4 路组相联的目的地址缓存，=1 时直接映射
+  const char *flow_cache = getenv("ROUTER_FLOW_CACHE");
+  if (flow_cache && flow_cache[0] && !flowCacheInit(atoi(flow_cache))) {
+    fprintf(stderr, "Flow cache not available\n");
+  }
+  // ROUTER_RANGE_FIB=1 时转发查询编译成区间表的 FIB ，在后台重建
+  const char *range_fib = getenv("ROUTER_RANGE_FIB");
+  if (range_fib && range_fib[0] && range_fib[0] != '0' && !rangeFibInit()) {
+    fprintf(stderr, "Range FIB not available\n");
+  }
+  const SnapshotHeader *snapshot = NULL;
+  if (snapshot_path && snapshot_path[0]) {
+    snapshot = snapshotMap(snapshot_path);
+  } else {
+    snapshot_path = NULL;
+  }
+  if (snapshot && argc == 1) {
+    // no addresses on the command line, use the saved ones
+    memcpy(addrs, snapshot->addrs, sizeof(addrs));
+  }
+  for (int i = 1; i < argc && i <= N_IFACE_ON_BOARD; i++) {
+    addrs[i - 1] = inet_addr(argv[i]);
+  }
   int res = HAL_Init(1, addrs);
   if (res < 0) {
     return res;
   }
+  // differs from router to router, see ecmpSetSeed
+  ecmpSetSeed(addrs[0]);
+  // ROUTER_IPV6 设置时同时转发 IPv6 ，见 setupIPv6
+  const char *ipv6 = getenv("ROUTER_IPV6");
+#ifdef ROUTER_BACKEND_SIM
+  // simulated routers would all get the same addresses
+  ipv6 = NULL;
+#endif
+  if (ipv6 && ipv6[0] && setupIPv6(ipv6) != 0) {
+    fprintf(stderr, "IPv6 not available\n");
+  }
+  if (snapshot) {
+    // forward along the saved routes at once, RIP keeps updating them
+    int restored = snapshotRestore(snapshot, addrs);
+    if (restored >= 0) {
+      fprintf(stderr, "Restored %d route(s) from %s\n", restored,
+              snapshot_path);
+    }
+  }
+  if (statsInit(NULL) < 0) {
+    fprintf(stderr, "Shared memory unavailable, statistics are local only\n");
+  }
+  StatsCounters *stats = statsLocal();
+  // kill -USR1 to print the routing table
+  logInit(stdout);
+  signal(SIGUSR1, requestTable);
   
   // Add direct routes
   // For example:
@@ -58,115 +432,96 @@ int main(int argc, char *argv[]) {
       .metric = 0,
       .time_stamp = 0
     };
-    update(true, entry);
+    ribUpdate(entry);
   }
+  statsSetRoutes(routeCount());
+  dumpTable();
 
   uint64_t last_time = 0;
+  uint64_t last_snapshot = HAL_GetTicks();
+  hal_packet_t *received = NULL;
   while (1) {
+    // the packet of the last round, unless it went to the HAL
+    HAL_FreePacket(received);
+    received = NULL;
     uint64_t time = HAL_GetTicks();
+    // routes not heard of for too long go, and the neighbors learn at once
+    if (ribAge(time)) {
+      statsSetRoutes(routeCount());
+    }
+    sendTriggeredUpdate();
     if (time > last_time + 5 * 1000) {
-      // TODO: send complete routing table to every interface
+      // send complete routing table to every interface
       // ref. RFC2453 Section 3.8
-      // multicast MAC for 224.0.0.9 is 01:00:5e:00:00:09
-      for (int j = 0; j < 4; j++) {
-        RipPacket resp;
-          // TODO: fill resp
-          genRipPack((uint32_t)j, &resp);
-          resp.command = 2;
-
-          // assemble
-          // IP
-          output[0] = 0x45;
-          output[1] = 0x0; // type of sevice
-          output[2] = 0x0;    // total length
-          output[3] = 0x0;
-          output[4] = 0x0;  // identification
-          output[5] = 0x0;
-          output[6] = 0x0; // flags
-          output[7] = 0x0;
-          output[8] = 0x1; // TTL
-          output[9] = 0x11; // protocal
-          output[10] = 0x0; // checksum
-          output[11] = 0x0;
-          output[12] = addrs[j] & 0xff; // src addr
-          output[13] = (addrs[j] >> 8) & 0xff; 
-          output[14] = (addrs[j] >> 16) & 0xff;
-          output[15] = (addrs[j] >> 24) & 0xff;        
-          output[16] = 0xe0; // dst addr
-          output[17] = 0x00;
-          output[18] = 0x00;
-          output[19] = 0x09;
-
-          // ...
-          // UDP
-          // port = 520
-          output[20] = 0x02; // src port
-          output[21] = 0x08;
-          output[22] = 0x02; // dst port
-          output[23] = 0x08;
-          output[24] = 0x00; // length
-          output[25] = 0x00;
-          output[26] = 0x00; // checksum
-          output[27] = 0x00;
-          // ...
-          // RIP
-          uint32_t rip_len = assemble(&resp, &output[20 + 8]);
-          // calc len for ip header and udp header
-          uint16_t ip_len = rip_len + 20 + 8;
-          uint16_t udp_len = rip_len + 8;
-          output[2] = ip_len >> 8;
-          output[3] = ip_len & 0xff;
-          output[24] = udp_len >> 8;
-          output[25] = udp_len & 0xff;
-          // checksum calculation for ip and udp
-          // if you don't want to calculate udp checksum, set it to zero
-          uint16_t checksum = checkSum(output);
-          output[10] = checksum >> 8;
-          output[11] = checksum & 0xff;
-          // send it back
-          macaddr_t mac_addr;
-          mac_addr[0] = 0x01;
-          mac_addr[1] = 0x00;
-          mac_addr[2] = 0x5e;
-          mac_addr[3] = 0x00;
-          mac_addr[4] = 0x00;
-          mac_addr[5] = 0x09;
-          HAL_SendIPPacket(j, output, rip_len + 20 + 8, mac_addr);
+      for (int j = 0; j < N_IFACE_ON_BOARD; j++) {
+        sendRipTable(j, RIP_MULTICAST_ADDR, rip_multicast_mac);
       }
-      printf("5s Timer\n");
-      // TODO: print complete routing table to stdout/stderr
-      printTable();
+      logEvent(LOG_TIMER, routeCount());
       last_time = time;
+      if (snapshot_path && time > last_snapshot + SNAPSHOT_INTERVAL) {
+        if (snapshotSave(snapshot_path, addrs) < 0) {
+          fprintf(stderr, "Failed to save snapshot to %s\n", snapshot_path);
+        }
+        last_snapshot = time;
+      }
+    }
+    if (logTableRequested()) {
+      dumpTable();
     }
+    rangeFibPoll();
 
     int mask = (1 << N_IFACE_ON_BOARD) - 1;
-    macaddr_t src_mac;
-    macaddr_t dst_mac;
-    int if_index;
-    res = HAL_ReceiveIPPacket(mask, packet, sizeof(packet), src_mac,
-                                  dst_mac, 1000, &if_index);
+    res = HAL_ReceivePacket(mask, &received, 1000);
     if (res == HAL_ERR_EOF) {
+      if (snapshot_path) {
+        snapshotSave(snapshot_path, addrs);
+      }
+      rangeFibShutdown();
+      logShutdown();
       break;
+    } else if (res == HAL_ERR_NO_BUFFER) {
+      // all buffers are in use, this packet is lost but the router goes on
+      statsAdd(&stats->drops[STATS_DROP_NO_BUFFER], 1);
+      continue;
     } else if (res < 0) {
+      rangeFibShutdown();
+      logShutdown();
       return res;
     } else if (res == 0) {
       // Timeout
       continue;
-    } else if (res > sizeof(packet)) {
+    }
+    // received, modified and sent in place
+    uint8_t *packet = received->data;
+    uint8_t *src_mac = received->src_mac;
+    int if_index = received->if_index;
+    statsAdd(&stats->iface[if_index].rx_packets, 1);
+    statsAdd(&stats->iface[if_index].rx_bytes, res);
+    if (res > (int)received->length) {
       // packet is truncated, ignore it
+      statsAdd(&stats->drops[STATS_DROP_TRUNCATED], 1);
       continue;
     }
-
-    if (!validateIPChecksum(packet, res)) {
-      printf("Invalid IP Checksum\n");
+    if ((packet[0] >> 4) == 6) {
+      // only with ROUTER_IPV6 set, see HAL_InitIPv6
+      if (forwardIPv6(received, stats)) {
+        received = NULL;
+      }
       continue;
     }
+
     in_addr_t src_addr, dst_addr;
     // extract src_addr and dst_addr from packet
     // big endian
 		src_addr = *(packet + 12) + (*(packet + 13)) * 0x100 + (*(packet + 14)) * 0x10000 + (*(packet + 15)) * 0x1000000;
 		dst_addr = *(packet + 16) + (*(packet + 17)) * 0x100 + (*(packet + 18)) * 0x10000 + (*(packet + 19)) * 0x1000000;
 
+    if (!validateIPChecksum(packet, res)) {
+      statsAdd(&stats->drops[STATS_DROP_BAD_CHECKSUM], 1);
+      logEvent(LOG_BAD_CHECKSUM, src_addr);
+      continue;
+    }
+
     bool dst_is_me = false;
     for (int i = 0; i < N_IFACE_ON_BOARD;i++) {
       if (memcmp(&dst_addr, &addrs[i], sizeof(in_addr_t)) == 0) {
@@ -187,66 +542,16 @@ int main(int argc, char *argv[]) {
       if (disassemble(packet, res, &rip)) {
         if (rip.command == 1) {
           // request
-          RipPacket resp;
-          // TODO: fill resp
-          genRipPack(if_index, &resp);
-          resp.command = 2;
-
-          // assemble
-          // IP
-          output[0] = 0x45;
-          output[1] = 0x0; // type of sevice
-          output[2] = 0x0;    // total length
-          output[3] = 0x0;
-          output[4] = 0x0;  // identification
-          output[5] = 0x0;
-          output[6] = 0x0; // flags
-          output[7] = 0x0;
-          output[8] = 0x1; // TTL
-          output[9] = 0x11; // protocal
-          output[10] = 0x0; // checksum
-          output[11] = 0x0;
-          output[12] = addrs[if_index] & 0xff; // src addr
-          output[13] = (addrs[if_index] >> 8) & 0xff; 
-          output[14] = (addrs[if_index] >> 16) & 0xff;
-          output[15] = (addrs[if_index] >> 24) & 0xff;       
-          output[16] = *(packet + 12); // dst addr
-          output[17] = *(packet + 13);
-          output[18] = *(packet + 14);
-          output[19] = *(packet + 15);
-
-          // ...
-          // UDP
-          // port = 520
-          output[20] = 0x02; // src port
-          output[21] = 0x08;
-          output[22] = 0x02; // dst port
-          output[23] = 0x08;
-          output[24] = 0x00; // length
-          output[25] = 0x00;
-          output[26] = 0x00; // checksum
-          output[27] = 0x00;
-          // ...
-          // RIP
-          uint32_t rip_len = assemble(&resp, &output[20 + 8]);
-          // calc len for ip header and udp header
-          uint16_t ip_len = rip_len + 20 + 8;
-          uint16_t udp_len = rip_len + 8;
-          output[2] = ip_len >> 8;
-          output[3] = ip_len & 0xff;
-          output[24] = udp_len >> 8;
-          output[25] = udp_len & 0xff;
-          // checksum calculation for ip and udp
-          // if you don't want to calculate udp checksum, set it to zero
-          uint16_t checksum = checkSum(output);
-          output[10] = checksum >> 8;
-          output[11] = checksum & 0xff;
-          // send it back
-          HAL_SendIPPacket(if_index, output, rip_len + 20 + 8, src_mac);
+          statsAdd(&stats->rip_requests, 1);
+          // the whole table back to the one asking
+          sendRipTable(if_index, src_addr, src_mac);
         } else {
           // response
           // TODO: use query and update
-          bool has_updated = false;
+          statsAdd(&stats->rip_responses, 1);
+          // routes via this neighbor are coming, keep its MAC address fresh
+          HAL_ArpKeepAlive(if_index, src_addr);
+          uint32_t n_updated = 0;
           for (int i = 0; i < rip.numEntries; i++) {
             // update routing table
             RoutingTableEntry entry = {
@@ -257,54 +562,72 @@ int main(int argc, char *argv[]) {
               .metric = rip.entries[i].metric,
               .time_stamp = time
             };
-            entry.addr = ((unsigned int)(entry.addr << entry.len)) >> entry.len;
+            // 掩码和地址一样是大端序，直接按位与
+            entry.addr &= rip.entries[i].mask;
             if (rip.entries[i].nexthop == 0) {
               entry.metric = 0x1000000;
             }
-            if (entry.metric == 0x11000000) {
-              update(false, entry);
-            }
-            else {
-              if (update(true, entry)) {
-                has_updated = true;
-              }
+            // the RIB keeps every neighbor's route and tells whether the
+            // best one changed; unreachable metrics withdraw the route
+            if (ribUpdate(entry)) {
+              n_updated++;
+              statsAdd(&stats->rip_routes_updated, 1);
             }
-            
+
           }
-          if (has_updated) {
-            // print rounting table
-            printTable();
+          statsSetRoutes(routeCount());
+          if (n_updated) {
+            logEvent(LOG_RIP_UPDATE, n_updated, routeCount());
           }
         }
       } else {
-				// 3b
-        // forward
-        // beware of endianness
-        uint32_t nexthop, dest_if;
-        if (query(dst_addr, &nexthop, &dest_if)) {
-          // found
-          macaddr_t dest_mac;
-          // direct routing
-          if (nexthop == 0) {
-            nexthop = dst_addr;
-          }
-          if (HAL_ArpGetMacAddress(dest_if, nexthop, dest_mac) == 0) {
-            // found
-            memcpy(output, packet, res);
-            // update ttl and checksum
-            forward(output, res);
-            // TODO: you might want to check ttl=0 case
-            HAL_SendIPPacket(dest_if, output, res, dest_mac);
-          } else {
-            // not found
-            // you can drop it
-            printf("ARP not found for nexthop %x\n", nexthop);
-          }
+        // addressed to us but not RIP
+        statsAdd(&stats->drops[STATS_DROP_BAD_RIP], 1);
+      }
+    } else {
+      // 3b
+      // forward
+      // beware of endianness
+      uint32_t nexthop, dest_if;
+      RoutingTableEntry route;
+      statsAdd(&stats->lookups, 1);
+      if (lookupRoute(dst_addr, &route, stats)) {
+        // found
+        nexthop = route.nexthop;
+        dest_if = route.if_index;
+        if (route.group) {
+          // equal cost paths, every packet of a flow takes the same one
+          ecmpSelect(route.group, ecmpFlowHash(packet, res), &nexthop,
+                     &dest_if);
+        }
+        // direct routing
+        if (nexthop == 0) {
+          nexthop = dst_addr;
+        }
+        // update ttl and checksum
+        forward(packet, res);
+        // TODO: you might want to check ttl=0 case
+        // the HAL sends this very buffer, or holds it until the ARP reply
+        // arrives if the nexthop is not resolved yet
+        int sent = HAL_SendPacketToNexthop(dest_if, received, nexthop);
+        received = NULL;
+        if (sent == 0) {
+          statsAdd(&stats->iface[dest_if].tx_packets, 1);
+          statsAdd(&stats->iface[dest_if].tx_bytes, res);
+          statsAdd(&stats->forwarded, 1);
+        } else if (sent > 0) {
+          statsAdd(&stats->arp_queued, 1);
         } else {
-          // not found
-          // TODO(optional): send ICMP Host Unreachable
-          printf("IP not found for src %x dst %x\n", src_addr, dst_addr);
+          // ARP not resolved and the pending queue is full
+          statsAdd(&stats->drops[STATS_DROP_NO_ARP], 1);
+          logEvent(LOG_NO_ARP, nexthop, dest_if);
         }
+      } else {
+        // not found
+        // TODO(optional): send ICMP Host Unreachable
+        statsAdd(&stats->lookup_misses, 1);
+        statsAdd(&stats->drops[STATS_DROP_NO_ROUTE], 1);
+        logEvent(LOG_NO_ROUTE, src_addr, dst_addr);
       }
     }
   }
@@ -0,0 +1,390 @@
+#include "rangefib.h"
+#include "router_hal.h"
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <new>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define RANGE_FIB_X86
+#endif
+
+extern uint32_t snapshotTable(RoutingTableEntry *output, uint32_t max);
+extern uint32_t routeCount();
+
+// keys per node, one cache line; node k has children k * 17 + 1 .. k * 17 + 17
+const uint32_t RANGE_FIB_KEYS = 16;
+// keys are stored with the top bit flipped so that signed compares order them
+const uint32_t RANGE_FIB_BIAS = 0x80000000u;
+const int32_t RANGE_FIB_PAD = 0x7fffffff;
+
+struct RangeHop {
+  uint32_t nexthop;
+  uint32_t if_index;
+  uint32_t group;
+};
+
+// a compiled table, one block of its builder arena
+struct RangeTable {
+  uint64_t generation;
+  uint32_t nodes;
+  // last address of each range, in order of the nodes, padded at the end
+  const int32_t *keys;
+  // next hop of each key: index in hop_table, 0 if there is no route
+  const uint32_t *hops;
+  const RangeHop *hop_table;
+};
+
+// the routes the builder is working on, from the router thread
+struct RangeBuilder {
+  std::mutex lock;
+  std::condition_variable wake;
+  bool pending;
+  bool stop;
+  std::vector<RoutingTableEntry> routes;
+  uint64_t generation;
+  hal_arena_t *arena; // reset and built into, not the one of the active table
+  std::atomic<RangeTable *> ready;
+  std::thread thread;
+};
+
+// a prefix as the range it covers
+struct RangePrefix {
+  uint32_t first;
+  uint32_t last;
+  uint32_t hop;
+};
+
+typedef uint32_t (*RangeSearch)(const RangeTable *table, uint32_t addr);
+
+// handed back instead of a table when the builder ran out of memory
+static RangeTable range_failed;
+
+ROUTER_LOCAL RangeBuilder *range_builder = NULL;
+ROUTER_LOCAL hal_arena_t *range_arenas[2];
+// the next table goes to range_arenas[range_next], the active one is in the
+// other
+ROUTER_LOCAL uint32_t range_next = 0;
+ROUTER_LOCAL const RangeTable *range_active = NULL;
+ROUTER_LOCAL bool range_building = false;
+// bumped on every change of the FIB
+ROUTER_LOCAL uint64_t range_generation = 1;
+ROUTER_LOCAL RangeSearch range_search = NULL;
+
+static uint32_t rangeChild(uint32_t node, uint32_t i) {
+  return node * (RANGE_FIB_KEYS + 1) + i + 1;
+}
+
+// i keys of a node are below the address: the range is at key i if i < 16,
+// further down child i either way. Returns the hop of the first key not below
+static uint32_t rangeSearchScalar(const RangeTable *table, uint32_t addr) {
+  int32_t x = (int32_t)(addr ^ RANGE_FIB_BIAS);
+  uint32_t node = 0;
+  uint32_t found = 0;
+  while (node < table->nodes) {
+    const int32_t *keys = &table->keys[node * RANGE_FIB_KEYS];
+    uint32_t i = 0;
+    for (uint32_t j = 0; j < RANGE_FIB_KEYS; j++) {
+      i += keys[j] < x;
+    }
+    found = i < RANGE_FIB_KEYS ? node * RANGE_FIB_KEYS + i : found;
+    node = rangeChild(node, i);
+  }
+  return table->hops[found];
+}
+
+#ifdef RANGE_FIB_X86
+// the same with two compares of 8 keys; the keys of a node are 64 aligned
+__attribute__((target("avx2,popcnt"))) static uint32_t
+rangeSearchAvx2(const RangeTable *table, uint32_t addr) {
+  __m256i x = _mm256_set1_epi32((int32_t)(addr ^ RANGE_FIB_BIAS));
+  uint32_t node = 0;
+  uint32_t found = 0;
+  while (node < table->nodes) {
+    const __m256i *keys =
+        (const __m256i *)&table->keys[node * RANGE_FIB_KEYS];
+    __m256i lo = _mm256_cmpgt_epi32(x, _mm256_load_si256(keys));
+    __m256i hi = _mm256_cmpgt_epi32(x, _mm256_load_si256(keys + 1));
+    uint32_t below = _mm256_movemask_ps(_mm256_castsi256_ps(lo)) |
+                     _mm256_movemask_ps(_mm256_castsi256_ps(hi)) << 8;
+    uint32_t i = __builtin_popcount(below);
+    found = i < RANGE_FIB_KEYS ? node * RANGE_FIB_KEYS + i : found;
+    node = rangeChild(node, i);
+  }
+  return table->hops[found];
+}
+#endif
+
+// appends a range starting at start, which replaces one starting there and
+// merges into the one before if it has the same hop
+static void rangeEmit(std::vector<uint32_t> &starts, std::vector<uint32_t> &hops,
+                      uint32_t start, uint32_t hop) {
+  if (!starts.empty() && starts.back() == start) {
+    starts.pop_back();
+    hops.pop_back();
+  }
+  if (!hops.empty() && hops.back() == hop) {
+    return;
+  }
+  starts.push_back(start);
+  hops.push_back(hop);
+}
+
+// lays the keys out in order of an in-order walk of the tree, so that the
+// keys of a node are sorted and those under child i lie between keys i - 1
+// and i; t counts the keys placed
+static void rangeLayout(uint32_t node, uint32_t nodes,
+                        const std::vector<uint32_t> &lasts,
+                        const std::vector<uint32_t> &ids, uint32_t *t,
+                        int32_t *keys, uint32_t *hops) {
+  if (node >= nodes) {
+    return;
+  }
+  for (uint32_t i = 0; i < RANGE_FIB_KEYS; i++) {
+    rangeLayout(rangeChild(node, i), nodes, lasts, ids, t, keys, hops);
+    uint32_t slot = node * RANGE_FIB_KEYS + i;
+    if (*t < lasts.size()) {
+      keys[slot] = (int32_t)(lasts[*t] ^ RANGE_FIB_BIAS);
+      hops[slot] = ids[*t];
+      ++*t;
+    } else {
+      // after 255.255.255.255, never the first key not below an address
+      keys[slot] = RANGE_FIB_PAD;
+      hops[slot] = 0;
+    }
+  }
+  rangeLayout(rangeChild(node, RANGE_FIB_KEYS), nodes, lasts, ids, t, keys,
+              hops);
+}
+
+// compiles routes into a table in arena, NULL if out of memory
+static RangeTable *rangeBuild(const std::vector<RoutingTableEntry> &routes,
+                              hal_arena_t *arena) {
+  std::map<std::pair<uint64_t, uint32_t>, uint32_t> hop_ids;
+  std::vector<RangeHop> hop_table(1);
+  std::vector<RangePrefix> prefixes;
+  prefixes.reserve(routes.size());
+  uint32_t fallback = 0; // the default route
+  for (size_t i = 0; i < routes.size(); i++) {
+    const RoutingTableEntry &route = routes[i];
+    if (route.len > 32) {
+      continue;
+    }
+    std::pair<uint64_t, uint32_t> key(
+        (uint64_t)route.nexthop << 32 | route.if_index, route.group);
+    uint32_t &id = hop_ids[key];
+    if (id == 0) {
+      RangeHop hop = {route.nexthop, route.if_index, route.group};
+      id = hop_table.size();
+      hop_table.push_back(hop);
+    }
+    if (route.len == 0) {
+      fallback = id;
+      continue;
+    }
+    uint32_t mask = route.len == 32 ? 0xffffffffu : ~(0xffffffffu >> route.len);
+    RangePrefix prefix;
+    prefix.first = ntohl(route.addr) & mask;
+    prefix.last = prefix.first | ~mask;
+    prefix.hop = id;
+    prefixes.push_back(prefix);
+  }
+  // a prefix comes after those containing it
+  std::sort(prefixes.begin(), prefixes.end(),
+            [](const RangePrefix &a, const RangePrefix &b) {
+              return a.first != b.first ? a.first < b.first : a.last > b.last;
+            });
+
+  // the prefixes still open at this point, innermost last; an address belongs
+  // to the innermost one containing it
+  std::vector<RangePrefix> open;
+  std::vector<uint32_t> starts;
+  std::vector<uint32_t> ids;
+  rangeEmit(starts, ids, 0, fallback);
+  for (size_t i = 0; i < prefixes.size(); i++) {
+    const RangePrefix &prefix = prefixes[i];
+    while (!open.empty() && open.back().last < prefix.first) {
+      uint32_t last = open.back().last;
+      open.pop_back();
+      rangeEmit(starts, ids, last + 1, open.empty() ? fallback : open.back().hop);
+    }
+    rangeEmit(starts, ids, prefix.first, prefix.hop);
+    open.push_back(prefix);
+  }
+  while (!open.empty()) {
+    uint32_t last = open.back().last;
+    open.pop_back();
+    if (last != 0xffffffffu) {
+      rangeEmit(starts, ids, last + 1, open.empty() ? fallback : open.back().hop);
+    }
+  }
+  // the tree is searched for the first range ending at or after an address
+  std::vector<uint32_t> lasts(starts.size());
+  for (size_t i = 0; i + 1 < starts.size(); i++) {
+    lasts[i] = starts[i + 1] - 1;
+  }
+  lasts.back() = 0xffffffffu;
+
+  uint32_t nodes = (lasts.size() + RANGE_FIB_KEYS - 1) / RANGE_FIB_KEYS;
+  size_t n_slots = (size_t)nodes * RANGE_FIB_KEYS;
+  size_t size = sizeof(RangeTable) + 64 + n_slots * sizeof(int32_t) +
+                n_slots * sizeof(uint32_t) + hop_table.size() * sizeof(RangeHop);
+  HAL_ArenaReset(arena);
+  uintptr_t p = (uintptr_t)HAL_ArenaAlloc(arena, size);
+  if (p == 0) {
+    return NULL;
+  }
+  RangeTable *table = (RangeTable *)p;
+  // the arena only aligns to 16 bytes
+  int32_t *keys = (int32_t *)((p + sizeof(RangeTable) + 63) & ~(uintptr_t)63);
+  uint32_t *hops = (uint32_t *)(keys + n_slots);
+  RangeHop *hop_copy = (RangeHop *)(hops + n_slots);
+  std::copy(hop_table.begin(), hop_table.end(), hop_copy);
+  uint32_t t = 0;
+  rangeLayout(0, nodes, lasts, ids, &t, keys, hops);
+  table->nodes = nodes;
+  table->keys = keys;
+  table->hops = hops;
+  table->hop_table = hop_copy;
+  return table;
+}
+
+static void rangeBuilder(RangeBuilder *builder) {
+  while (1) {
+    std::unique_lock<std::mutex> guard(builder->lock);
+    builder->wake.wait(guard,
+                       [builder] { return builder->pending || builder->stop; });
+    if (builder->stop) {
+      return;
+    }
+    builder->pending = false;
+    guard.unlock();
+
+    RangeTable *table = NULL;
+    try {
+      table = rangeBuild(builder->routes, builder->arena);
+    } catch (const std::bad_alloc &) {
+      table = NULL;
+    }
+    if (table == NULL) {
+      table = &range_failed;
+    } else {
+      table->generation = builder->generation;
+    }
+    builder->ready.store(table, std::memory_order_release);
+  }
+}
+
+bool rangeFibInit() {
+  if (range_builder) {
+    return true;
+  }
+  for (int i = 0; i < 2; i++) {
+    if (range_arenas[i] == NULL) {
+      range_arenas[i] = HAL_ArenaCreate(0);
+    }
+    if (range_arenas[i] == NULL) {
+      return false;
+    }
+  }
+  RangeBuilder *builder = new (std::nothrow) RangeBuilder();
+  if (builder == NULL) {
+    return false;
+  }
+  builder->pending = false;
+  builder->stop = false;
+  builder->ready.store(NULL, std::memory_order_relaxed);
+  try {
+    builder->thread = std::thread(rangeBuilder, builder);
+  } catch (const std::system_error &) {
+    delete builder;
+    return false;
+  }
+  range_search = rangeSearchScalar;
+#ifdef RANGE_FIB_X86
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt")) {
+    range_search = rangeSearchAvx2;
+  }
+#endif
+  range_builder = builder;
+  return true;
+}
+
+bool rangeFibEnabled() { return range_builder != NULL; }
+
+void rangeFibInvalidate() { range_generation++; }
+
+void rangeFibPoll() {
+  if (range_builder == NULL) {
+    return;
+  }
+  RangeTable *table =
+      range_builder->ready.exchange(NULL, std::memory_order_acquire);
+  if (table == &range_failed) {
+    fprintf(stderr, "Range FIB out of memory, using lookup.cpp only\n");
+    rangeFibShutdown();
+    return;
+  }
+  if (table) {
+    // the table before stays in its arena until the next build resets it
+    range_active = table;
+    range_next ^= 1;
+    range_building = false;
+  }
+  if (range_building || rangeFibCurrent()) {
+    return;
+  }
+  // the builder is idle and does not touch these until woken up
+  std::vector<RoutingTableEntry> &routes = range_builder->routes;
+  routes.resize(routeCount());
+  routes.resize(snapshotTable(routes.data(), routes.size()));
+  range_builder->generation = range_generation;
+  range_builder->arena = range_arenas[range_next];
+  {
+    std::lock_guard<std::mutex> guard(range_builder->lock);
+    range_builder->pending = true;
+  }
+  range_builder->wake.notify_one();
+  range_building = true;
+}
+
+bool rangeFibCurrent() {
+  return range_active && range_active->generation == range_generation;
+}
+
+bool rangeFibLookup(uint32_t addr, RoutingTableEntry *entry) {
+  uint32_t hop = range_search(range_active, ntohl(addr));
+  if (hop == 0) {
+    return false;
+  }
+  const RangeHop &found = range_active->hop_table[hop];
+  entry->nexthop = found.nexthop;
+  entry->if_index = found.if_index;
+  entry->group = found.group;
+  return true;
+}
+
+void rangeFibShutdown() {
+  if (range_builder == NULL) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> guard(range_builder->lock);
+    range_builder->stop = true;
+  }
+  range_builder->wake.notify_one();
+  range_builder->thread.join();
+  delete range_builder;
+  range_builder = NULL;
+  range_active = NULL;
+  range_building = false;
+  // the arenas are kept, their regions are reused if it is turned on again
+}
@@ -0,0 +1,64 @@
+#ifndef __ROUTER_RANGEFIB_H__
+#define __ROUTER_RANGEFIB_H__
+
+#include "router.h"
+#include <stdint.h>
+
+/*
+  编译成地址区间表的只读 FIB 。
+
+  lookup.cpp 中的路由表展开成一组互不相交、覆盖整个地址空间的区间，每个区间
+  对应一个下一跳编号（ nexthop 、 if_index 和 ECMP 组相同的路由共用一个编号，
+  0 表示没有路由），相邻的同一编号的区间合并。区间的末地址排成隐式的 17 叉
+  B 树（ S-tree ）：每个节点 16 个键，正好一个缓存行，子节点的位置由下标算出，
+  不存指针。查询每层读一个缓存行，用 AVX2 一次比较 8 个键（ CPU 不支持时
+  逐个比较，同样没有分支），算出要去的子节点，百万条路由只有 6 层。
+
+  FIB 每次改变（ rib.cpp 下发增量或整体装入）都让代数加一，编译出来的表只在
+  代数一致时回答查询，否则查询回到 lookup.cpp ，结果总是和它相同。
+  重建在后台线程中进行：路由器线程在 rangeFibPoll 中复制一份路由表交给它，
+  建好后通过一个原子指针交回，下一次 rangeFibPoll 时换上，旧的表所在的内存
+  留给再下一次重建。同一时间只有一次重建，其间的改变等它完成后再建一次。
+  适合很少变化的路由表；一直在变化时查询大多回到 lookup.cpp 。
+*/
+
+/**
+ * @brief 打开编译的 FIB 并启动重建线程，在转发前调用一次
+ * @return 内存不足或线程无法启动时返回 false ，保持关闭
+ */
+bool rangeFibInit();
+
+/**
+ * 编译的 FIB 是否打开
+ */
+bool rangeFibEnabled();
+
+/**
+ * @brief FIB 改变了，在此之前编译的表不再回答查询
+ */
+void rangeFibInvalidate();
+
+/**
+ * @brief 在主循环中调用：换上建好的表，需要时开始下一次重建
+ */
+void rangeFibPoll();
+
+/**
+ * @brief 编译的表是否和当前的 FIB 一致，一致时才能用 rangeFibLookup
+ */
+bool rangeFibCurrent();
+
+/**
+ * @brief 在编译的表中查询目的地址
+ * @param addr 大端序的目的地址
+ * @param entry 查到时写入 nexthop 、 if_index 和 group ，其他字段不变
+ * @return 查到时返回 true
+ */
+bool rangeFibLookup(uint32_t addr, RoutingTableEntry *entry);
+
+/**
+ * @brief 停止重建线程，退出前调用
+ */
+void rangeFibShutdown();
+
+#endif
@@ -0,0 +1,350 @@
+#include "rib.h"
+#include "aggregate.h"
+#include "arena.h"
+#include "ecmp.h"
+#include "flowcache.h"
+#include "rangefib.h"
+#include "router_hal.h"
+#include <arpa/inet.h>
+#include <deque>
+#include <functional>
+#include <iterator>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+extern bool update(bool insert, RoutingTableEntry entry);
+extern uint32_t bulkLoad(const RoutingTableEntry *entries, uint32_t count);
+
+// FIB 只会收到这三种增量
+enum FibOp {
+  FIB_ADD,
+  FIB_REPLACE,
+  FIB_DELETE,
+};
+
+typedef std::vector<RoutingTableEntry, ArenaAllocator<RoutingTableEntry>>
+    RibPaths;
+
+struct RibPrefix {
+  RibPaths paths;
+  bool installed; // best 已经在 FIB 中
+  RoutingTableEntry best; // 带上 ECMP 组
+  uint64_t garbage_until; // 不为 0 时最优路由已经消失，到这时删除
+};
+
+// a prefix that lost its best path and is advertised as unreachable until
+// the time it is deleted
+struct RibGarbage {
+  uint64_t key;
+  uint64_t until;
+};
+
+// the prefixes and their paths live in routeArena
+ROUTER_LOCAL std::unordered_map<
+    uint64_t, RibPrefix, std::hash<uint64_t>, std::equal_to<uint64_t>,
+    ArenaAllocator<std::pair<const uint64_t, RibPrefix>>>
+    rib;
+ROUTER_LOCAL uint32_t rib_paths = 0;
+// in the order the prefixes went, so the ones due come first
+ROUTER_LOCAL std::deque<RibGarbage> rib_garbage;
+// rib_garbage before this went out in a triggered update already
+ROUTER_LOCAL size_t rib_garbage_sent = 0;
+ROUTER_LOCAL uint64_t rib_now = 0;
+ROUTER_LOCAL uint64_t rib_next_scan = 0;
+ROUTER_LOCAL bool rib_aggregate = false;
+
+static uint64_t ribKey(uint32_t addr, uint32_t len) {
+  return ((uint64_t)len << 32) | addr;
+}
+
+static bool reachable(const RoutingTableEntry &entry) {
+  return ntohl(entry.metric) < RIB_INFINITY;
+}
+
+static bool samePath(const RoutingTableEntry &a, const RoutingTableEntry &b) {
+  return a.nexthop == b.nexthop && a.if_index == b.if_index;
+}
+
+static void fibApply(FibOp op, const RoutingTableEntry &entry) {
+  // cached lookups may have matched this prefix or one it covers
+  flowCacheInvalidate();
+  rangeFibInvalidate();
+  // lookup.cpp replaces an existing prefix on insert, and so does aggregate
+  if (rib_aggregate) {
+    aggregateUpdate(op != FIB_DELETE, entry);
+  } else {
+    update(op != FIB_DELETE, entry);
+  }
+}
+
+// lowest metric wins, the installed path wins ties so that equal
+// alternatives do not make the FIB flap
+static const RoutingTableEntry *selectBest(const RibPrefix &prefix) {
+  const RoutingTableEntry *best = NULL;
+  for (size_t i = 0; i < prefix.paths.size(); i++) {
+    const RoutingTableEntry &path = prefix.paths[i];
+    if (!reachable(path)) {
+      continue;
+    }
+    if (best == NULL || ntohl(path.metric) < ntohl(best->metric) ||
+        (ntohl(path.metric) == ntohl(best->metric) && prefix.installed &&
+         samePath(path, prefix.best))) {
+      best = &path;
+    }
+  }
+  return best;
+}
+
+// best with the group of every reachable path as good as it
+static RoutingTableEntry selectGroup(const RibPrefix &prefix,
+                                     const RoutingTableEntry &best) {
+  EcmpPath paths[ECMP_MAX_PATHS];
+  uint32_t count = 0;
+  paths[count].nexthop = best.nexthop;
+  paths[count++].if_index = best.if_index;
+  for (size_t i = 0; i < prefix.paths.size() && count < ECMP_MAX_PATHS; i++) {
+    const RoutingTableEntry &path = prefix.paths[i];
+    if (reachable(path) && path.metric == best.metric && !samePath(path, best)) {
+      paths[count].nexthop = path.nexthop;
+      paths[count++].if_index = path.if_index;
+    }
+  }
+  RoutingTableEntry entry = best;
+  entry.group = ecmpGroup(paths, count);
+  return entry;
+}
+
+// pushes the change of the best path, if any, down to the FIB
+static bool ribSelect(decltype(rib)::iterator it) {
+  RibPrefix &prefix = it->second;
+  const RoutingTableEntry *best = selectBest(prefix);
+  bool changed = false;
+  if (best == NULL) {
+    if (prefix.installed) {
+      fibApply(FIB_DELETE, prefix.best);
+      prefix.installed = false;
+      // kept to tell the neighbors, ref. RFC2453 Section 3.8
+      prefix.garbage_until = rib_now + RIB_GARBAGE;
+      RibGarbage garbage = {it->first, prefix.garbage_until};
+      rib_garbage.push_back(garbage);
+      changed = true;
+    }
+    if (prefix.paths.empty() && prefix.garbage_until == 0) {
+      rib.erase(it);
+    }
+    return changed;
+  }
+  RoutingTableEntry chosen = selectGroup(prefix, *best);
+  if (!prefix.installed) {
+    fibApply(FIB_ADD, chosen);
+    prefix.installed = true;
+    prefix.best = chosen;
+    prefix.garbage_until = 0;
+    changed = true;
+  } else if (!samePath(chosen, prefix.best) ||
+             chosen.metric != prefix.best.metric ||
+             chosen.group != prefix.best.group) {
+    fibApply(FIB_REPLACE, chosen);
+    prefix.best = chosen;
+    changed = true;
+  } else {
+    // only refreshed, the FIB stays as it is
+    prefix.best.time_stamp = best->time_stamp;
+  }
+  return changed;
+}
+
+bool ribUpdate(RoutingTableEntry entry) {
+  if (!reachable(entry)) {
+    return ribWithdraw(entry.addr, entry.len, entry.nexthop, entry.if_index);
+  }
+  auto it = rib.find(ribKey(entry.addr, entry.len));
+  if (it == rib.end()) {
+    it = rib.insert(std::make_pair(ribKey(entry.addr, entry.len), RibPrefix()))
+             .first;
+    it->second.installed = false;
+    it->second.garbage_until = 0;
+  }
+  RibPaths &paths = it->second.paths;
+  size_t i = 0;
+  while (i < paths.size() && !samePath(paths[i], entry)) {
+    i++;
+  }
+  if (i < paths.size()) {
+    paths[i] = entry;
+  } else {
+    paths.push_back(entry);
+    rib_paths++;
+  }
+  return ribSelect(it);
+}
+
+bool ribWithdraw(uint32_t addr, uint32_t len, uint32_t nexthop,
+                 uint32_t if_index) {
+  auto it = rib.find(ribKey(addr, len));
+  if (it == rib.end()) {
+    return false;
+  }
+  RibPaths &paths = it->second.paths;
+  for (size_t i = 0; i < paths.size(); i++) {
+    if (paths[i].nexthop == nexthop && paths[i].if_index == if_index) {
+      paths[i] = paths.back();
+      paths.pop_back();
+      rib_paths--;
+      // falls back to the next best candidate at once
+      return ribSelect(it);
+    }
+  }
+  return false;
+}
+
+// the record of a prefix that still waits for deletion, NULL once the
+// prefix came back or went again later
+static const RibPrefix *garbagePrefix(const RibGarbage &garbage) {
+  auto it = rib.find(garbage.key);
+  if (it == rib.end() || it->second.installed ||
+      it->second.garbage_until != garbage.until) {
+    return NULL;
+  }
+  return &it->second;
+}
+
+bool ribAge(uint64_t now) {
+  rib_now = now;
+  // a timeout of minutes does not need a finer scan than once a second
+  if (now < rib_next_scan) {
+    return false;
+  }
+  rib_next_scan = now + 1000;
+  bool changed = false;
+  for (auto it = rib.begin(); it != rib.end();) {
+    auto next = std::next(it);
+    RibPrefix &prefix = it->second;
+    RibPaths &paths = prefix.paths;
+    size_t before = paths.size();
+    for (size_t i = 0; i < paths.size();) {
+      // direct routes never time out
+      if (paths[i].nexthop != 0 && paths[i].time_stamp + RIB_TIMEOUT <= now) {
+        paths[i] = paths.back();
+        paths.pop_back();
+        rib_paths--;
+      } else {
+        i++;
+      }
+    }
+    if (paths.size() != before) {
+      changed |= ribSelect(it);
+    } else if (paths.empty() && prefix.garbage_until <= now) {
+      rib.erase(it);
+    }
+    it = next;
+  }
+  while (!rib_garbage.empty() && rib_garbage.front().until <= now) {
+    rib_garbage.pop_front();
+    if (rib_garbage_sent > 0) {
+      rib_garbage_sent--;
+    }
+  }
+  return changed;
+}
+
+uint32_t ribTakeWithdrawn(RoutingTableEntry *output, uint32_t max) {
+  uint32_t n = 0;
+  while (rib_garbage_sent < rib_garbage.size() && n < max) {
+    const RibPrefix *prefix = garbagePrefix(rib_garbage[rib_garbage_sent++]);
+    if (prefix != NULL) {
+      output[n] = prefix->best;
+      output[n++].metric = htonl(RIB_INFINITY);
+    }
+  }
+  return n;
+}
+
+uint32_t ribWithdrawn(RoutingTableEntry *output, uint32_t max,
+                      uint32_t *cursor) {
+  uint32_t n = 0;
+  while (*cursor < rib_garbage.size() && n < max) {
+    const RibPrefix *prefix = garbagePrefix(rib_garbage[(*cursor)++]);
+    if (prefix != NULL) {
+      output[n] = prefix->best;
+      output[n++].metric = htonl(RIB_INFINITY);
+    }
+  }
+  return n;
+}
+
+uint32_t ribBest(RoutingTableEntry *output, uint32_t max, uint64_t *cursor) {
+  // the cursor is one past the key of the prefix to go on with, the order of
+  // the map holds while nothing is inserted or erased
+  const uint64_t done = ~0ull;
+  if (*cursor == done) {
+    return 0;
+  }
+  auto it = *cursor == 0 ? rib.begin() : rib.find(*cursor - 1);
+  uint32_t n = 0;
+  for (; it != rib.end() && n < max; ++it) {
+    if (it->second.installed) {
+      output[n++] = it->second.best;
+    }
+  }
+  *cursor = it == rib.end() ? done : it->first + 1;
+  return n;
+}
+
+uint32_t ribLoad(const RoutingTableEntry *entries, uint32_t count) {
+  rib.clear();
+  rib_paths = 0;
+  rib_garbage.clear();
+  rib_garbage_sent = 0;
+  for (uint32_t i = 0; i < count; i++) {
+    const RoutingTableEntry &entry = entries[i];
+    if (!reachable(entry)) {
+      continue;
+    }
+    RibPrefix &prefix = rib[ribKey(entry.addr, entry.len)];
+    size_t j = 0;
+    while (j < prefix.paths.size() && !samePath(prefix.paths[j], entry)) {
+      j++;
+    }
+    if (j < prefix.paths.size()) {
+      prefix.paths[j] = entry;
+    } else {
+      prefix.paths.push_back(entry);
+      rib_paths++;
+    }
+  }
+
+  // the winners go to the FIB in one bulk load instead of one delta each
+  std::vector<RoutingTableEntry> fib;
+  fib.reserve(rib.size());
+  for (auto it = rib.begin(); it != rib.end(); ++it) {
+    RibPrefix &prefix = it->second;
+    prefix.installed = false;
+    prefix.garbage_until = 0;
+    prefix.best = selectGroup(prefix, *selectBest(prefix));
+    prefix.installed = true;
+    fib.push_back(prefix.best);
+  }
+  flowCacheInvalidate();
+  rangeFibInvalidate();
+  if (rib_aggregate) {
+    return aggregateLoad(fib.data(), fib.size());
+  }
+  return bulkLoad(fib.data(), fib.size());
+}
+
+void ribSetAggregate(bool enable) { rib_aggregate = enable; }
+
+uint32_t ribCount() { return rib_paths; }
+
+uint32_t ribSnapshot(RoutingTableEntry *output, uint32_t max) {
+  uint32_t n = 0;
+  for (auto it = rib.begin(); it != rib.end() && n < max; ++it) {
+    const RibPaths &paths = it->second.paths;
+    for (size_t i = 0; i < paths.size() && n < max; i++) {
+      output[n++] = paths[i];
+    }
+  }
+  return n;
+}
@@ -0,0 +1,93 @@
+#ifndef __ROUTER_RIB_H__
+#define __ROUTER_RIB_H__
+
+#include "router.h"
+#include <stdint.h>
+
+/*
+  RIB：每个前缀保存所有邻居通告的候选路由，按 metric 选出最优的一条。
+
+  lookup.cpp 中的路由表只作为 FIB ，每个前缀只有最优的一条，只在最优路由
+  真正改变时才通过 update 收到增量（添加、替换或删除）。最优路由被撤销时
+  直接在本地改用次优的候选，不用等下一次周期性更新。
+  候选由 (nexthop, if_index) 区分，nexthop 为 0 的是直连路由。
+  有多个 metric 相同的最优候选时，下发的表项带上它们组成的 ECMP 组（见 ecmp.h ），
+  组的成员变化也作为替换下发。
+  metric 和 RipEntry 中一样是大端序，不小于 16 表示不可达。
+
+  按 RFC 2453 第 3.8 节老化：邻居的候选 RIB_TIMEOUT 没有刷新就删除，直连路由
+  不老化。前缀的最优路由消失后先从 FIB 中删除，再保留 RIB_GARBAGE 等待删除，
+  其间以 metric 16 通告：刚消失时立即触发一次（ ribTakeWithdrawn ），之后
+  每次周期性更新都带上（ ribWithdrawn ）。撤销的是 RIB 中的前缀，所以聚合 FIB
+  时 RIP 也通告 RIB 中的最优路由（ ribBest ），而不是聚合后的路由表。
+*/
+
+#define RIB_INFINITY 16
+// 毫秒，和 HAL_GetTicks 一致
+#define RIB_TIMEOUT (180 * 1000)
+#define RIB_GARBAGE (120 * 1000)
+
+/**
+ * @brief 加入或更新一条候选路由，metric 不可达时相当于 ribWithdraw
+ * @return FIB 发生变化时返回 true
+ */
+bool ribUpdate(RoutingTableEntry entry);
+
+/**
+ * @brief 撤销 (nexthop, if_index) 通告的一条候选路由
+ * @return FIB 发生变化时返回 true
+ */
+bool ribWithdraw(uint32_t addr, uint32_t len, uint32_t nexthop,
+                 uint32_t if_index);
+
+/**
+ * @brief 在主循环中调用：删除超时的候选，删除等待期满的前缀
+ * @param now HAL_GetTicks() 的当前值
+ * @return FIB 发生变化时返回 true
+ */
+bool ribAge(uint64_t now);
+
+/**
+ * @brief 取出最优路由刚刚消失、还没有触发过更新的前缀，最多 max 项
+ * @return 取出的项数，metric 为 16 ，小于 max 时已经取完
+ */
+uint32_t ribTakeWithdrawn(RoutingTableEntry *output, uint32_t max);
+
+/**
+ * @brief 列出等待删除的前缀，最多 max 项
+ * @param cursor 第一次调用前置为 0 ，之后原样传回
+ * @return 列出的项数，metric 为 16 ，小于 max 时已经列完
+ */
+uint32_t ribWithdrawn(RoutingTableEntry *output, uint32_t max,
+                      uint32_t *cursor);
+
+/**
+ * @brief 列出 FIB 中的最优路由，聚合时是聚合之前的，最多 max 项
+ * @param cursor 第一次调用前置为 0 ，之后原样传回；其间 RIB 不能改变
+ * @return 列出的项数，小于 max 时已经列完
+ */
+uint32_t ribBest(RoutingTableEntry *output, uint32_t max, uint64_t *cursor);
+
+/**
+ * @brief 用一组候选路由整体替换 RIB ，并用 bulkLoad 一次建好 FIB
+ * @return FIB 中的表项数
+ */
+uint32_t ribLoad(const RoutingTableEntry *entries, uint32_t count);
+
+/**
+ * @brief 打开 FIB 聚合（见 aggregate.h ），此后最优路由先经过聚合再下发给 FIB ，
+ * 须在加入任何路由之前调用
+ */
+void ribSetAggregate(bool enable);
+
+/**
+ * RIB 中的候选路由数
+ */
+uint32_t ribCount();
+
+/**
+ * @brief 把所有候选路由复制到 output 中，最多 max 项，返回复制的项数
+ */
+uint32_t ribSnapshot(RoutingTableEntry *output, uint32_t max);
+
+#endif
@@ -0,0 +1,28 @@
+#include "stats.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// 读取正在运行的路由器的统计计数器
+// 用法：./routerstat [interval_seconds] [shm_name]
+int main(int argc, char *argv[]) {
+  int interval = argc > 1 ? atoi(argv[1]) : 0;
+  const char *name = argc > 2 ? argv[2] : STATS_SHM_NAME;
+
+  const StatsRegion *region = statsAttach(name);
+  if (region == NULL) {
+    fprintf(stderr, "routerstat: cannot attach to shared memory %s\n", name);
+    return 1;
+  }
+
+  while (1) {
+    statsPrint(stdout, region);
+    fflush(stdout);
+    if (interval <= 0) {
+      break;
+    }
+    sleep(interval);
+    printf("\n");
+  }
+  return 0;
+}
@@ -0,0 +1,197 @@
+#include "snapshot.h"
+#include "rib.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+const uint64_t FNV_OFFSET = 0xcbf29ce484222325ULL;
+const uint64_t FNV_PRIME = 0x100000001b3ULL;
+
+static uint64_t fnv1a(uint64_t hash, const void *data, size_t len) {
+  const uint8_t *p = (const uint8_t *)data;
+  for (size_t i = 0; i < len; i++) {
+    hash = (hash ^ p[i]) * FNV_PRIME;
+  }
+  return hash;
+}
+
+static uint64_t align8(uint64_t offset) { return (offset + 7) & ~7ULL; }
+
+static uint64_t wallClock() {
+  struct timespec tp;
+  clock_gettime(CLOCK_REALTIME, &tp);
+  return (uint64_t)tp.tv_sec * 1000 + (uint64_t)tp.tv_nsec / 1000000;
+}
+
+static bool writeAll(int fd, const void *data, size_t len) {
+  const char *p = (const char *)data;
+  while (len > 0) {
+    ssize_t res = write(fd, p, len);
+    if (res < 0 && errno == EINTR) {
+      continue;
+    }
+    if (res <= 0) {
+      return false;
+    }
+    p += res;
+    len -= res;
+  }
+  return true;
+}
+
+int snapshotSave(const char *path, const in_addr_t addrs[N_IFACE_ON_BOARD]) {
+  // every candidate, so that a restored router still has its backups
+  std::vector<RoutingTableEntry> routes(ribCount());
+  routes.resize(ribSnapshot(routes.data(), routes.size()));
+  std::vector<arpentry_t> arp(64);
+  int n_arp;
+  // the HAL tells how many it copied, not how many there are
+  while ((n_arp = HAL_ArpGetEntries(arp.data(), arp.size())) == (int)arp.size()) {
+    arp.resize(arp.size() * 2);
+  }
+  arp.resize(n_arp > 0 ? n_arp : 0);
+
+  SnapshotHeader header;
+  memset(&header, 0, sizeof(header));
+  header.magic = SNAPSHOT_MAGIC;
+  header.version = SNAPSHOT_VERSION;
+  header.header_size = sizeof(SnapshotHeader);
+  header.route_size = sizeof(RoutingTableEntry);
+  header.arp_size = sizeof(arpentry_t);
+  header.n_routes = routes.size();
+  header.n_arp = arp.size();
+  memcpy(header.addrs, addrs, sizeof(header.addrs));
+  header.routes_offset = align8(sizeof(SnapshotHeader));
+  header.arp_offset =
+      align8(header.routes_offset + routes.size() * sizeof(RoutingTableEntry));
+  header.size = header.arp_offset + arp.size() * sizeof(arpentry_t);
+  header.saved_ticks = HAL_GetTicks();
+  header.saved_time = wallClock();
+
+  const char zero[8] = {0};
+  size_t pad_header = header.routes_offset - sizeof(SnapshotHeader);
+  size_t pad_routes = header.arp_offset - header.routes_offset -
+                      routes.size() * sizeof(RoutingTableEntry);
+  uint64_t hash = FNV_OFFSET;
+  hash = fnv1a(hash, zero, pad_header);
+  hash = fnv1a(hash, routes.data(), routes.size() * sizeof(RoutingTableEntry));
+  hash = fnv1a(hash, zero, pad_routes);
+  hash = fnv1a(hash, arp.data(), arp.size() * sizeof(arpentry_t));
+  header.checksum = hash;
+
+  // readers only ever see a complete file, the old one or the new one
+  std::string tmp = std::string(path) + ".tmp";
+  int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    return -1;
+  }
+  bool ok = writeAll(fd, &header, sizeof(header)) &&
+            writeAll(fd, zero, pad_header) &&
+            writeAll(fd, routes.data(),
+                     routes.size() * sizeof(RoutingTableEntry)) &&
+            writeAll(fd, zero, pad_routes) &&
+            writeAll(fd, arp.data(), arp.size() * sizeof(arpentry_t)) &&
+            fsync(fd) == 0;
+  close(fd);
+  if (!ok || rename(tmp.c_str(), path) < 0) {
+    unlink(tmp.c_str());
+    return -1;
+  }
+  return 0;
+}
+
+const SnapshotHeader *snapshotMap(const char *path) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return NULL;
+  }
+  struct stat st;
+  void *addr = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(SnapshotHeader)) {
+    addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  }
+  close(fd);
+  if (addr == MAP_FAILED) {
+    return NULL;
+  }
+
+  const SnapshotHeader *header = (const SnapshotHeader *)addr;
+  const char *base = (const char *)addr;
+  const char *error = NULL;
+  if (header->magic != SNAPSHOT_MAGIC || header->version != SNAPSHOT_VERSION ||
+      header->header_size != sizeof(SnapshotHeader) ||
+      header->route_size != sizeof(RoutingTableEntry) ||
+      header->arp_size != sizeof(arpentry_t)) {
+    error = "unknown version";
+  } else if (header->size != (uint64_t)st.st_size ||
+             header->routes_offset % 8 || header->arp_offset % 8 ||
+             header->routes_offset < sizeof(SnapshotHeader) ||
+             header->arp_offset < header->routes_offset +
+                                      (uint64_t)header->n_routes *
+                                          sizeof(RoutingTableEntry) ||
+             header->size < header->arp_offset + (uint64_t)header->n_arp *
+                                                     sizeof(arpentry_t)) {
+    error = "truncated";
+  } else if (fnv1a(FNV_OFFSET, base + sizeof(SnapshotHeader),
+                   header->size - sizeof(SnapshotHeader)) !=
+             header->checksum) {
+    error = "bad checksum";
+  }
+  if (error) {
+    fprintf(stderr, "Snapshot %s ignored: %s\n", path, error);
+    munmap(addr, st.st_size);
+    return NULL;
+  }
+  return header;
+}
+
+int snapshotRestore(const SnapshotHeader *snapshot,
+                    const in_addr_t addrs[N_IFACE_ON_BOARD]) {
+  const char *base = (const char *)snapshot;
+  int res = -1;
+  if (memcmp(snapshot->addrs, addrs, sizeof(snapshot->addrs)) != 0) {
+    fprintf(stderr, "Snapshot ignored: interface addresses changed\n");
+  } else {
+    // age of every entry = its age when saved + time since the save
+    uint64_t now = HAL_GetTicks();
+    uint64_t wall = wallClock();
+    uint64_t down = wall > snapshot->saved_time ? wall - snapshot->saved_time : 0;
+    const RoutingTableEntry *saved =
+        (const RoutingTableEntry *)(base + snapshot->routes_offset);
+    std::vector<RoutingTableEntry> routes;
+    routes.reserve(snapshot->n_routes);
+    for (uint32_t i = 0; i < snapshot->n_routes; i++) {
+      RoutingTableEntry entry = saved[i];
+      uint64_t age = down;
+      if (entry.time_stamp < snapshot->saved_ticks) {
+        age += snapshot->saved_ticks - entry.time_stamp;
+      }
+      // the neighbor has had a whole timeout to refresh it and did not
+      if (entry.nexthop != 0 && age >= RIB_TIMEOUT) {
+        continue;
+      }
+      // the rest age from here on like any candidate, so each is gone one
+      // timeout after the restore at the latest unless heard of again
+      entry.time_stamp = now > age ? now - age : 0;
+      routes.push_back(entry);
+    }
+    res = ribLoad(routes.data(), routes.size());
+
+    const arpentry_t *arp = (const arpentry_t *)(base + snapshot->arp_offset);
+    for (uint32_t i = 0; i < snapshot->n_arp; i++) {
+      macaddr_t mac;
+      memcpy(mac, arp[i].mac, sizeof(macaddr_t));
+      HAL_ArpAddEntry(arp[i].if_index, arp[i].ip, mac);
+    }
+  }
+  munmap((void *)snapshot, snapshot->size);
+  return res;
+}
@@ -0,0 +1,67 @@
+#ifndef __ROUTER_SNAPSHOT_H__
+#define __ROUTER_SNAPSHOT_H__
+
+#include "router.h"
+#include "router_hal.h"
+#include <stdint.h>
+
+/*
+  路由器状态的快照，用于热重启。
+
+  定期把 RIB 中的路由（含 metric 和时间戳）、接口地址和 ARP 表中学到的邻居
+  写入一个文件。重启时把它映射进来直接装入，不用等 RIP 重新收敛就可以转发，
+  之后 RIP 照常更新这些表项。文件中只有相对于文件开头的偏移量而没有指针，映射到任何
+  地址都可以直接读取；保存时先写临时文件再 rename ，不会留下写了一半的文件。
+*/
+
+#define SNAPSHOT_MAGIC 0x50414e53 // "SNAP"
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_INTERVAL 30000 // 毫秒
+
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  // 各部分的大小，结构体的布局变了也能发现
+  uint32_t header_size;
+  uint32_t route_size;
+  uint32_t arp_size;
+  uint32_t n_routes;
+  uint32_t n_arp;
+  in_addr_t addrs[N_IFACE_ON_BOARD];
+  uint64_t routes_offset; // RoutingTableEntry[n_routes]，RIB 中的所有候选
+  uint64_t arp_offset;    // arpentry_t[n_arp]
+  uint64_t size;          // 整个文件的大小
+  uint64_t saved_ticks;   // 保存时的 HAL_GetTicks()
+  uint64_t saved_time;    // 保存时的墙上时间，毫秒
+  uint64_t checksum;      // 头部之后所有字节的 FNV-1a
+} SnapshotHeader;
+
+/**
+ * @brief 把当前的 RIB 、接口地址和 ARP 表写入快照文件
+ * @param path 快照文件的路径
+ * @param addrs 各个接口的地址
+ * @return 0 表示成功，-1 表示失败
+ */
+int snapshotSave(const char *path, const in_addr_t addrs[N_IFACE_ON_BOARD]);
+
+/**
+ * @brief 只读地映射快照文件并检查其完整性，可以在 HAL_Init 之前调用
+ * @return 文件不存在、版本不匹配或者损坏时返回 NULL
+ */
+const SnapshotHeader *snapshotMap(const char *path);
+
+/**
+ * @brief 用快照替换 RIB 和 FIB 并恢复 ARP 表，在 HAL_Init 之后调用，之后 snapshot
+ * 被解除映射
+ *
+ * 表项的时间戳按照保存以来经过的时间换算到现在的 HAL_GetTicks() ，之后和
+ * 学到的候选一样老化（见 rib.h ）：邻居的候选最迟在恢复后 RIB_TIMEOUT 删除，
+ * 除非邻居再次通告；已经超过 RIB_TIMEOUT 的不恢复。
+ * 接口地址和快照中的不同时，路由和邻居都可能已经失效，不做恢复。
+ *
+ * @return 恢复后 FIB 中的路由条数，没有恢复时返回 -1
+ */
+int snapshotRestore(const SnapshotHeader *snapshot,
+                    const in_addr_t addrs[N_IFACE_ON_BOARD]);
+
+#endif
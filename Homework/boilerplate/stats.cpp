@@ -0,0 +1,171 @@
+#include "stats.h"
+#include "router_hal.h"
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+ROUTER_LOCAL StatsRegion *stats_region = NULL;
+static ROUTER_LOCAL StatsRegion stats_fallback;
+thread_local StatsCounters *stats_local = NULL;
+
+static const char *drop_reason_names[STATS_DROP_REASON_COUNT] = {
+    "truncated", "bad_checksum", "no_route", "no_arp", "bad_rip", "hop_limit",
+    "no_buffer",
+};
+
+int statsInit(const char *name) {
+  if (stats_region) {
+    return 0;
+  }
+  if (name == NULL) {
+    name = STATS_SHM_NAME;
+  }
+
+  StatsRegion *region = NULL;
+#ifdef ROUTER_BACKEND_SIM
+  // simulated routers share the process but not their counters
+  int fd = -1;
+#else
+  int fd = shm_open(name, O_CREAT | O_RDWR, 0644);
+#endif
+  if (fd >= 0) {
+    if (ftruncate(fd, sizeof(StatsRegion)) == 0) {
+      void *addr = mmap(NULL, sizeof(StatsRegion), PROT_READ | PROT_WRITE,
+                        MAP_SHARED, fd, 0);
+      if (addr != MAP_FAILED) {
+        region = (StatsRegion *)addr;
+      }
+    }
+    close(fd);
+  }
+
+  int res = 0;
+#ifdef ROUTER_BACKEND_SIM
+  region = &stats_fallback;
+#endif
+  if (region == NULL) {
+    // no shared memory, keep counting in-process
+    region = &stats_fallback;
+    res = -1;
+  }
+  memset(region, 0, sizeof(StatsRegion));
+  region->version = STATS_VERSION;
+  region->pid = getpid();
+  // publish magic last so that readers never see a half initialized region
+  __atomic_store_n(&region->magic, STATS_MAGIC, __ATOMIC_RELEASE);
+  stats_region = region;
+  return res;
+}
+
+StatsCounters *statsLocal() {
+  if (stats_local) {
+    return stats_local;
+  }
+  if (stats_region == NULL) {
+    statsInit(NULL);
+  }
+  uint32_t slot =
+      __atomic_fetch_add(&stats_region->n_slots, 1, __ATOMIC_RELAXED);
+  if (slot >= STATS_MAX_THREADS) {
+    // out of slots: share the last one, counts may be slightly off
+    slot = STATS_MAX_THREADS - 1;
+  }
+  stats_local = &stats_region->slots[slot];
+  return stats_local;
+}
+
+void statsSetRoutes(uint64_t routes) {
+  if (stats_region == NULL) {
+    return;
+  }
+  __atomic_store_n(&stats_region->routes, routes, __ATOMIC_RELAXED);
+}
+
+const StatsRegion *statsAttach(const char *name) {
+  if (name == NULL) {
+    name = STATS_SHM_NAME;
+  }
+  int fd = shm_open(name, O_RDONLY, 0);
+  if (fd < 0) {
+    return NULL;
+  }
+  void *addr = mmap(NULL, sizeof(StatsRegion), PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (addr == MAP_FAILED) {
+    return NULL;
+  }
+  const StatsRegion *region = (const StatsRegion *)addr;
+  if (__atomic_load_n(&region->magic, __ATOMIC_ACQUIRE) != STATS_MAGIC ||
+      region->version != STATS_VERSION) {
+    munmap(addr, sizeof(StatsRegion));
+    return NULL;
+  }
+  return region;
+}
+
+void statsSnapshot(const StatsRegion *region, StatsCounters *output) {
+  memset(output, 0, sizeof(StatsCounters));
+  uint32_t n_slots = __atomic_load_n(&region->n_slots, __ATOMIC_RELAXED);
+  if (n_slots > STATS_MAX_THREADS) {
+    n_slots = STATS_MAX_THREADS;
+  }
+  // StatsCounters is nothing but uint64_t counters, sum them word by word
+  const size_t n_words = sizeof(StatsCounters) / sizeof(uint64_t);
+  uint64_t *out = (uint64_t *)output;
+  for (uint32_t i = 0; i < n_slots; i++) {
+    const uint64_t *in = (const uint64_t *)&region->slots[i];
+    for (size_t j = 0; j < n_words; j++) {
+      out[j] += statsRead(&in[j]);
+    }
+  }
+}
+
+void statsPrint(FILE *fp, const StatsRegion *region) {
+  StatsCounters total;
+  statsSnapshot(region, &total);
+
+  fprintf(fp, "pid %u, %u thread(s), %llu route(s)\n", region->pid,
+          region->n_slots, (unsigned long long)statsRead(&region->routes));
+  for (int i = 0; i < N_IFACE_ON_BOARD; i++) {
+    fprintf(fp, "if %d: rx %llu pkts %llu bytes, tx %llu pkts %llu bytes\n", i,
+            (unsigned long long)total.iface[i].rx_packets,
+            (unsigned long long)total.iface[i].rx_bytes,
+            (unsigned long long)total.iface[i].tx_packets,
+            (unsigned long long)total.iface[i].tx_bytes);
+  }
+  fprintf(fp, "forwarded %llu (%llu IPv6), %llu queued for ARP\n",
+          (unsigned long long)total.forwarded,
+          (unsigned long long)total.forwarded6,
+          (unsigned long long)total.arp_queued);
+  fprintf(fp, "drops:");
+  for (int i = 0; i < STATS_DROP_REASON_COUNT; i++) {
+    fprintf(fp, " %s %llu", drop_reason_names[i],
+            (unsigned long long)total.drops[i]);
+  }
+  fprintf(fp, "\n");
+  fprintf(fp, "rip: %llu requests, %llu responses, %llu routes updated\n",
+          (unsigned long long)total.rip_requests,
+          (unsigned long long)total.rip_responses,
+          (unsigned long long)total.rip_routes_updated);
+  double miss_rate =
+      total.lookups ? 100.0 * total.lookup_misses / total.lookups : 0.0;
+  fprintf(fp, "lookup: %llu queries, %llu misses (%.2f%%)\n",
+          (unsigned long long)total.lookups,
+          (unsigned long long)total.lookup_misses, miss_rate);
+  uint64_t cached = total.flow_cache_hits + total.flow_cache_misses;
+  if (cached) {
+    fprintf(fp, "flow cache: %llu hits, %llu misses (%.2f%% hit)\n",
+            (unsigned long long)total.flow_cache_hits,
+            (unsigned long long)total.flow_cache_misses,
+            100.0 * total.flow_cache_hits / cached);
+  }
+  uint64_t compiled = total.range_fib_lookups + total.range_fib_stale;
+  if (compiled) {
+    fprintf(fp, "range fib: %llu lookups, %llu while rebuilding (%.2f%%)\n",
+            (unsigned long long)total.range_fib_lookups,
+            (unsigned long long)total.range_fib_stale,
+            100.0 * total.range_fib_stale / compiled);
+  }
+}
@@ -0,0 +1,110 @@
+#ifndef __ROUTER_STATS_H__
+#define __ROUTER_STATS_H__
+
+#include "router_hal.h"
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+  路由器的统计计数器。
+
+  每个线程独占一个按缓存行对齐的 StatsCounters，热路径上只做单写者的
+  relaxed 写入，不加锁也不产生跨核的缓存行争用；需要时再把所有线程的计数器
+  累加起来。计数器放在 POSIX 共享内存 STATS_SHM_NAME 中，外部工具
+  （见 routerstat.cpp）可以只读地映射它，不会打扰转发。
+*/
+
+#define STATS_SHM_NAME "/router_stats"
+#define STATS_MAGIC 0x41545352 // "RSTA"
+#define STATS_VERSION 6
+#define STATS_MAX_THREADS 16
+#define STATS_CACHE_LINE 64
+
+enum StatsDropReason {
+  STATS_DROP_TRUNCATED,    // 报文超过接收缓冲区
+  STATS_DROP_BAD_CHECKSUM, // IP 头校验和错误
+  STATS_DROP_NO_ROUTE,     // 路由表中查不到
+  STATS_DROP_NO_ARP,       // 下一跳没有 ARP 且等待队列已满，或者 IPv6 的下一跳没有解析
+  STATS_DROP_BAD_RIP,      // 发给自己但不是合法的 RIP 报文
+  STATS_DROP_HOP_LIMIT,    // IPv6 的 hop limit 耗尽
+  STATS_DROP_NO_BUFFER,    // HAL 的报文缓冲区用完，没能收下
+  STATS_DROP_REASON_COUNT,
+};
+
+typedef struct {
+  uint64_t rx_packets;
+  uint64_t rx_bytes;
+  uint64_t tx_packets;
+  uint64_t tx_bytes;
+} StatsInterface;
+
+typedef struct alignas(STATS_CACHE_LINE) {
+  StatsInterface iface[N_IFACE_ON_BOARD];
+  uint64_t drops[STATS_DROP_REASON_COUNT];
+  uint64_t forwarded;
+  uint64_t forwarded6; // 其中的 IPv6 报文
+  uint64_t arp_queued; // 交给 HAL 等待 ARP 解析的报文
+  uint64_t rip_requests;
+  uint64_t rip_responses;
+  uint64_t rip_routes_updated;
+  uint64_t lookups;
+  uint64_t lookup_misses;
+  uint64_t flow_cache_hits;   // 打开流缓存时，查询中命中缓存的
+  uint64_t flow_cache_misses; // 和没命中、查了 FIB 的
+  uint64_t range_fib_lookups; // 打开编译的 FIB 时，查询中由它回答的
+  uint64_t range_fib_stale;   // 和它正在重建、回到 lookup.cpp 的
+} StatsCounters;
+
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t n_slots; // 已经被线程占用的槽数
+  uint32_t pid;
+  uint64_t routes; // 当前路由表大小，由控制面线程写入
+  StatsCounters slots[STATS_MAX_THREADS];
+} StatsRegion;
+
+/**
+ * @brief 创建并映射统计计数器所在的共享内存，在使用其他 stats 函数前调用一次
+ * @param name 共享内存的名字，NULL 表示使用 STATS_SHM_NAME
+ * @return 0 表示成功；共享内存不可用时退化为进程内的计数器并返回 -1
+ */
+int statsInit(const char *name);
+
+/**
+ * @brief 取得当前线程的计数器，第一次调用时为线程分配一个槽
+ */
+StatsCounters *statsLocal();
+
+/**
+ * @brief 更新路由表大小
+ */
+void statsSetRoutes(uint64_t routes);
+
+/**
+ * @brief 以只读方式映射另一个进程创建的计数器
+ * @return 映射失败或版本不匹配时返回 NULL
+ */
+const StatsRegion *statsAttach(const char *name);
+
+/**
+ * @brief 把所有线程的计数器累加到 *output
+ */
+void statsSnapshot(const StatsRegion *region, StatsCounters *output);
+
+/**
+ * @brief 以文本格式输出计数器
+ */
+void statsPrint(FILE *fp, const StatsRegion *region);
+
+// 单写者计数器：只有所属线程会写，读者可能在另一个核上，因此用 relaxed
+// 原子写避免撕裂，同时不需要 lock 前缀的读改写指令
+static inline void statsAdd(uint64_t *counter, uint64_t value) {
+  __atomic_store_n(counter, *counter + value, __ATOMIC_RELAXED);
+}
+
+static inline uint64_t statsRead(const uint64_t *counter) {
+  return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+#endif
@@ -15,6 +15,12 @@ import glob
 import traceback
 
 prefix = 'checksum'
+if len(sys.argv) > 1 and sys.argv[1] == '--perf':
+    # 性能评测，见 ../perf.py
+    sys.path.insert(0, join(os.path.dirname(os.path.abspath(__file__)), '..'))
+    import perf
+    perf.main(prefix, sys.argv[2:])
+
 exe = prefix
 if len(sys.argv) > 1:
     exe = sys.argv[1]
@@ -2,12 +2,47 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <unistd.h>
 
 extern bool forward(uint8_t *packet, size_t len);
 
 in_addr_t addrs[N_IFACE_ON_BOARD] = {0};
 uint8_t packet[1024];
 
+// 输出攒成一大块再写，逐字节 printf 比 forward 本身慢得多
+const size_t OUTPUT_SIZE = 1 << 20;
+char output[OUTPUT_SIZE];
+size_t output_len = 0;
+
+static void flushOutput() {
+  size_t done = 0;
+  while (done < output_len) {
+    ssize_t res = write(STDOUT_FILENO, output + done, output_len - done);
+    if (res <= 0) {
+      break;
+    }
+    done += res;
+  }
+  output_len = 0;
+}
+
+// 保证之后能再写入 len 字节
+static char *reserveOutput(size_t len) {
+  if (output_len + len > OUTPUT_SIZE) {
+    flushOutput();
+  }
+  return output + output_len;
+}
+
+// 小写十六进制，固定 digits 位
+static char *writeHex(char *p, uint32_t value, int digits) {
+  static const char hex[] = "0123456789abcdef";
+  for (int shift = (digits - 1) * 4; shift >= 0; shift -= 4) {
+    *p++ = hex[(value >> shift) & 0xf];
+  }
+  return p;
+}
+
 int main(int argc, char *argv[]) {
   int res = HAL_Init(0, addrs);
   if (res < 0) {
@@ -23,14 +58,18 @@ int main(int argc, char *argv[]) {
     if (res == HAL_ERR_EOF) {
       break;
     } else if (res < 0) {
+      flushOutput();
       return res;
     }
     if (forward(packet, res)) {
-      for (size_t i = 0; i < res;i++) {
-        printf("%02x", packet[i]);
+      char *p = reserveOutput(res * 2 + 1);
+      for (int i = 0; i < res; i++) {
+        p = writeHex(p, packet[i], 2);
       }
-      printf("\n");
+      *p++ = '\n';
+      output_len = p - output;
     }
   }
+  flushOutput();
   return 0;
-}
\ No newline at end of file
+}
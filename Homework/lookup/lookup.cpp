@@ -1,8 +1,16 @@
 #include "router.h"
+#include "router_hal.h"
+#include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include "rip.h"
+#include <arpa/inet.h>
 #include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <new>
+#include <utility>
+#include <vector>
 
 /*
   RoutingTable Entry 的定义如下：
@@ -33,78 +41,748 @@ uint32_t change_endian(uint32_t a) {
   return (a >> 24) + ((a >> 16) & 0xff) * 0x100 + ((a >> 8) & 0xff) * 0x10000 + (a & 0xff) * 0x1000000;
 }
 
+/*
+  路由表的实现
+
+  所有表项串成一个双向链表，genRipPack 和 snapshotTable 遍历它。
+  查询用按前缀长度二分（ Waldvogel ）：每个出现过的前缀长度一张开放寻址的
+  哈希表，以前缀（主机序）为键；这些长度排成一棵二叉搜索树，查询从根开始，
+  在哈希表中查到就往更长的子树走，查不到就往更短的子树走。
+  路由多的长度离根近，按路由条数加权的探测次数最少，树高最多比平衡时
+  多一层：10 种长度时最多 5 次探测，1 到 31 全有时最多 6 次。
+  一条路由在查询路径上每个比它短的长度处留一个标记（ marker ），
+  保证查询能一路走到它；每个标记和前缀都预先算好它能匹配上的最长的真实路由
+  （ bmp ），查询记下最后一次命中的 bmp ，不用回溯。
+  内存和路由条数成正比，和地址空间无关。
+
+  插入和删除只修改路径上的标记，以及被这条路由覆盖的更长的表项的 bmp 。
+  出现一个新的前缀长度时树的形状改变，所有表项按长度从短到长重新插入一遍；
+  表空了的长度留在树中，直到 bulkLoad 。默认路由不放在哈希表中。
+
+  主机路由（ /32 ，如直连的邻居）是精确匹配，单独放在一张 Robin Hood
+  哈希表中，查询先查它，命中就不用再做最长前缀匹配，一般一次探测就够；
+  它们不在上面的树中，也不给更短的长度留标记，树矮一层，标记也少很多。
+*/
+
 struct myNode{
   	RoutingTableEntry * entry;
   	myNode* next;
+  	myNode* prev;
 } ;
 
-myNode* start = NULL;
+// 节点和它的表项一起分配，哈希表中只存表项的指针
+struct myRoute {
+	myNode node;
+	RoutingTableEntry entry;
+};
+
+// 前缀正好是这里的路由存在时 bmp 就是它，bmp->len 等于这张表的长度；
+// bmp 和 markers 都为空的槽是空闲的
+struct WvSlot {
+	uint32_t prefix;   // 主机序，只有前 len 位可能非零
+	uint32_t markers;  // 把这里当作标记的更长的路由的条数
+	const RoutingTableEntry* bmp; // 能匹配上的最长的真实路由，没有则为 NULL
+};
+
+struct WvTable {
+	WvSlot* slots;
+	uint32_t capacity; // 2 的幂，至少一半空闲
+	uint32_t count;
+	uint32_t shift;    // 32 - log2(capacity)
+};
+
+// 离 home 远的项不给近的让位，同一个 home 的项连在一起，
+// 查不到时探测到比自己离 home 还近的项就可以停下
+struct HostSlot {
+	uint32_t addr;  // 主机序
+	uint32_t dist;  // 离 home 的距离加一，0 表示空槽
+	const RoutingTableEntry* entry;
+};
+
+struct HostTable {
+	HostSlot* slots;
+	uint32_t capacity; // 2 的幂，至少一半空闲
+	uint32_t count;
+	uint32_t shift;    // 32 - log2(capacity)
+};
+
+ROUTER_LOCAL myNode* start = NULL;
+ROUTER_LOCAL uint32_t route_count = 0;
+// 链表的节点和表项、各个哈希表都从这个 arena 中分配（见 HAL_ArenaCreate ），
+// 尽量落在大页上；bulkLoad 重建时整体释放
+ROUTER_LOCAL hal_arena_t *table_arena = NULL;
+ROUTER_LOCAL WvTable wv_tables[33];
+// 树中的前缀长度，从小到大，不含 0
+ROUTER_LOCAL uint32_t wv_lengths[32];
+ROUTER_LOCAL uint32_t wv_n = 0;
+// 树的根和每种长度的子树，都用长度表示，0 表示没有
+ROUTER_LOCAL uint32_t wv_root = 0;
+ROUTER_LOCAL uint32_t wv_left[33];
+ROUTER_LOCAL uint32_t wv_right[33];
+// 树中离每种长度最近的更短的祖先，没有则为 0
+ROUTER_LOCAL uint32_t wv_parent[33];
+ROUTER_LOCAL uint32_t wv_count[33]; // 每种长度的路由条数，不含 /32
+ROUTER_LOCAL myNode* wv_default = NULL;
+ROUTER_LOCAL HostTable host_table;
+
+static hal_arena_t* tableArena() {
+	if (table_arena == NULL) {
+		table_arena = HAL_ArenaCreate(0);
+	}
+	return table_arena;
+}
+
+static myNode* newNode(const RoutingTableEntry &entry) {
+	hal_arena_t* arena = tableArena();
+	if (arena == NULL) {
+		return NULL;
+	}
+	myRoute* route = (myRoute*)HAL_ArenaAlloc(arena, sizeof(myRoute));
+	if (route == NULL) {
+		return NULL;
+	}
+	route->entry = entry;
+	route->node.entry = &route->entry;
+	route->node.next = NULL;
+	route->node.prev = NULL;
+	return &route->node;
+}
+
+static void deleteNode(myNode* node) {
+	HAL_ArenaFree(table_arena, node, sizeof(myRoute));
+}
+
+static myNode* nodeOf(const RoutingTableEntry* entry) {
+	return (myNode*)((const char*)entry - offsetof(myRoute, entry));
+}
+
+static void linkNode(myNode* node) {
+	node->prev = NULL;
+	node->next = start;
+	if (start != NULL) {
+		start->prev = node;
+	}
+	start = node;
+}
+
+static void unlinkNode(myNode* node) {
+	if (node->prev != NULL) {
+		node->prev->next = node->next;
+	} else {
+		start = node->next;
+	}
+	if (node->next != NULL) {
+		node->next->prev = node->prev;
+	}
+}
+
+static uint32_t wvMask(uint32_t len) {
+	return len == 0 ? 0 : 0xffffffffu << (32 - len);
+}
+
+static uint32_t wvPrefix(const RoutingTableEntry &entry) {
+	return ntohl(entry.addr) & wvMask(entry.len);
+}
+
+static uint32_t wvHome(const WvTable &table, uint32_t prefix) {
+	return (prefix * 0x9e3779b1u) >> table.shift;
+}
+
+static bool wvUsed(const WvSlot &slot) {
+	return slot.bmp != NULL || slot.markers != 0;
+}
+
+// 前缀正好是 slot 的路由是否存在，len 是 slot 所在的表的长度
+static bool wvHasRoute(const WvSlot* slot, uint32_t len) {
+	return slot->bmp != NULL && slot->bmp->len == len;
+}
+
+static WvSlot* wvFind(uint32_t len, uint32_t prefix) {
+	WvTable &table = wv_tables[len];
+	if (table.count == 0) {
+		return NULL;
+	}
+	uint32_t mask = table.capacity - 1;
+	for (uint32_t i = wvHome(table, prefix);; i = (i + 1) & mask) {
+		WvSlot &slot = table.slots[i];
+		if (!wvUsed(slot)) {
+			return NULL;
+		}
+		if (slot.prefix == prefix) {
+			return &slot;
+		}
+	}
+}
+
+static void wvGrow(WvTable &table) {
+	WvTable bigger;
+	bigger.capacity = table.capacity ? table.capacity * 2 : 16;
+	bigger.shift = 32 - __builtin_ctz(bigger.capacity);
+	bigger.count = table.count;
+	size_t size = bigger.capacity * sizeof(WvSlot);
+	hal_arena_t* arena = tableArena();
+	bigger.slots = arena ? (WvSlot*)HAL_ArenaAlloc(arena, size) : NULL;
+	if (bigger.slots == NULL) {
+		throw std::bad_alloc();
+	}
+	memset(bigger.slots, 0, size);
+	for (uint32_t i = 0; i < table.capacity; i++) {
+		if (wvUsed(table.slots[i])) {
+			uint32_t j = wvHome(bigger, table.slots[i].prefix);
+			while (wvUsed(bigger.slots[j])) {
+				j = (j + 1) & (bigger.capacity - 1);
+			}
+			bigger.slots[j] = table.slots[i];
+		}
+	}
+	if (table.slots != NULL) {
+		HAL_ArenaFree(table_arena, table.slots, table.capacity * sizeof(WvSlot));
+	}
+	table = bigger;
+}
+
+// 新的空槽，调用者马上填上 bmp 或 markers
+static WvSlot* wvAdd(uint32_t len, uint32_t prefix) {
+	WvTable &table = wv_tables[len];
+	if ((table.count + 1) * 2 > table.capacity) {
+		wvGrow(table);
+	}
+	uint32_t i = wvHome(table, prefix);
+	while (wvUsed(table.slots[i])) {
+		i = (i + 1) & (table.capacity - 1);
+	}
+	table.count++;
+	WvSlot &slot = table.slots[i];
+	slot.prefix = prefix;
+	slot.markers = 0;
+	slot.bmp = NULL;
+	return &slot;
+}
+
+// 线性探测的删除：把后面探测链上的槽往前挪，不留墓碑
+static void wvRemove(uint32_t len, WvSlot* slot) {
+	WvTable &table = wv_tables[len];
+	uint32_t mask = table.capacity - 1;
+	uint32_t hole = slot - table.slots;
+	for (uint32_t i = (hole + 1) & mask; wvUsed(table.slots[i]); i = (i + 1) & mask) {
+		uint32_t home = wvHome(table, table.slots[i].prefix);
+		// home 不在 (hole, i] 中时，这一项可以挪到 hole
+		if ((i > hole && (home <= hole || home > i)) || (i < hole && home <= hole && home > i)) {
+			table.slots[hole] = table.slots[i];
+			hole = i;
+		}
+	}
+	table.slots[hole].bmp = NULL;
+	table.slots[hole].markers = 0;
+	table.count--;
+}
+
+static uint32_t hostHome(const HostTable &table, uint32_t addr) {
+	return (addr * 0x9e3779b1u) >> table.shift;
+}
+
+static HostSlot* hostFind(uint32_t addr) {
+	HostTable &table = host_table;
+	if (table.count == 0) {
+		return NULL;
+	}
+	uint32_t mask = table.capacity - 1;
+	uint32_t i = hostHome(table, addr);
+	for (uint32_t dist = 1;; dist++, i = (i + 1) & mask) {
+		HostSlot &slot = table.slots[i];
+		// 空槽的 dist 是 0 ，也在这里停下
+		if (slot.dist < dist) {
+			return NULL;
+		}
+		if (slot.addr == addr) {
+			return &slot;
+		}
+	}
+}
+
+// 放入一项，一路上和离 home 更近的项交换，由被换下的项接着往后找位置
+static void hostPlace(HostTable &table, HostSlot item) {
+	uint32_t mask = table.capacity - 1;
+	uint32_t i = hostHome(table, item.addr);
+	for (item.dist = 1;; item.dist++, i = (i + 1) & mask) {
+		HostSlot &slot = table.slots[i];
+		if (slot.dist == 0) {
+			slot = item;
+			return;
+		}
+		if (slot.dist < item.dist) {
+			std::swap(slot, item);
+		}
+	}
+}
+
+static void hostAdd(const RoutingTableEntry* entry) {
+	HostTable &table = host_table;
+	if ((table.count + 1) * 2 > table.capacity) {
+		HostTable bigger;
+		bigger.capacity = table.capacity ? table.capacity * 2 : 16;
+		bigger.shift = 32 - __builtin_ctz(bigger.capacity);
+		bigger.count = table.count;
+		size_t size = bigger.capacity * sizeof(HostSlot);
+		hal_arena_t* arena = tableArena();
+		bigger.slots = arena ? (HostSlot*)HAL_ArenaAlloc(arena, size) : NULL;
+		if (bigger.slots == NULL) {
+			throw std::bad_alloc();
+		}
+		memset(bigger.slots, 0, size);
+		for (uint32_t i = 0; i < table.capacity; i++) {
+			if (table.slots[i].dist != 0) {
+				hostPlace(bigger, table.slots[i]);
+			}
+		}
+		if (table.slots != NULL) {
+			HAL_ArenaFree(table_arena, table.slots, table.capacity * sizeof(HostSlot));
+		}
+		table = bigger;
+	}
+	HostSlot item;
+	item.addr = ntohl(entry->addr);
+	item.entry = entry;
+	hostPlace(table, item);
+	table.count++;
+}
+
+// 把后面离 home 有距离的项依次往前挪一格，不留墓碑
+static void hostRemove(HostSlot* slot) {
+	HostTable &table = host_table;
+	uint32_t mask = table.capacity - 1;
+	uint32_t hole = slot - table.slots;
+	for (uint32_t i = (hole + 1) & mask; table.slots[i].dist > 1; i = (i + 1) & mask) {
+		table.slots[hole] = table.slots[i];
+		table.slots[hole].dist--;
+		hole = i;
+	}
+	table.slots[hole].dist = 0;
+	table.slots[hole].entry = NULL;
+	table.count--;
+}
+
+/**
+ * @brief 在树上查找，只看不超过 max_len 的长度
+ * @return 匹配 addr （主机序）的最长的真实路由，没有则为 NULL
+ */
+static const RoutingTableEntry* wvBest(uint32_t addr, uint32_t max_len) {
+	const RoutingTableEntry* best = wv_default ? wv_default->entry : NULL;
+	uint32_t len = wv_root;
+	while (len != 0) {
+		const WvSlot* slot = len <= max_len ? wvFind(len, addr & wvMask(len)) : NULL;
+		if (slot != NULL) {
+			if (slot->bmp != NULL) {
+				best = slot->bmp;
+			}
+			len = wv_right[len];
+		} else {
+			len = wv_left[len];
+		}
+	}
+	return best;
+}
+
+/**
+ * @brief 对 prefix/len 覆盖的所有更长的标记调用 fn
+ *
+ * 只有标记的 bmp 会因为别的路由改变，真实路由的 bmp 总是它自己；
+ * 标记只在有更长的子树的长度上，其他长度不用看。
+ * 长度 l 上的每个表项在 l 的每个更短的祖先上都有标记，所以长度 l 上要找的
+ * 前缀只需从最近的更短祖先上已经找到的表项展开，没有这样的祖先时从
+ * prefix 展开；要探测的前缀太多时改为扫描整张哈希表。
+ */
+template <class F> static void wvUnder(uint32_t prefix, uint32_t len, F fn) {
+	std::vector<uint32_t> found[33];
+	for (uint32_t k = 0; k < wv_n; k++) {
+		uint32_t l = wv_lengths[k];
+		WvTable &table = wv_tables[l];
+		if (l <= len || table.count == 0 || wv_right[l] == 0) {
+			continue;
+		}
+		uint32_t from = wv_parent[l] > len ? wv_parent[l] : len;
+		uint32_t span = l - from;
+		uint64_t bases = from > len ? found[from].size() : 1;
+		if ((bases << span) < table.capacity / 4) {
+			for (uint64_t b = 0; b < bases; b++) {
+				uint32_t base = from > len ? found[from][b] : prefix;
+				for (uint32_t i = 0; i < (1u << span); i++) {
+					WvSlot* slot = wvFind(l, base | (i << (32 - l)));
+					if (slot != NULL) {
+						found[l].push_back(slot->prefix);
+						fn(*slot);
+					}
+				}
+			}
+		} else {
+			for (uint32_t i = 0; i < table.capacity; i++) {
+				WvSlot &slot = table.slots[i];
+				if (wvUsed(slot) && (slot.prefix & wvMask(len)) == prefix) {
+					found[l].push_back(slot.prefix);
+					fn(slot);
+				}
+			}
+		}
+	}
+}
+
+/**
+ * @brief 把一条已经在链表中的路由加入哈希表
+ * @param cover 是否更新被它覆盖的更长的表项的 bmp ，按长度从短到长重建时不需要
+ */
+static void wvInsert(myNode* node, bool cover) {
+	const RoutingTableEntry* entry = node->entry;
+	uint32_t len = entry->len;
+	if (len == 0) {
+		wv_default = node;
+		if (cover) {
+			wvUnder(0, 0, [&](WvSlot &slot) {
+				if (slot.bmp == NULL) {
+					slot.bmp = entry;
+				}
+			});
+		}
+		return;
+	}
+	uint32_t prefix = wvPrefix(*entry);
+	// 查询路径上比它短的长度处放标记
+	uint32_t l = wv_root;
+	while (l != 0 && l != len) {
+		if (l > len) {
+			l = wv_left[l];
+			continue;
+		}
+		uint32_t marker = prefix & wvMask(l);
+		WvSlot* slot = wvFind(l, marker);
+		if (slot == NULL) {
+			const RoutingTableEntry* best = wvBest(marker, l);
+			slot = wvAdd(l, marker);
+			slot->bmp = best;
+		}
+		slot->markers++;
+		l = wv_right[l];
+	}
+	WvSlot* slot = wvFind(len, prefix);
+	if (slot == NULL) {
+		slot = wvAdd(len, prefix);
+	}
+	slot->bmp = entry;
+	if (cover) {
+		wvUnder(prefix, len, [&](WvSlot &under) {
+			if (under.bmp == NULL || under.bmp->len < len) {
+				under.bmp = entry;
+			}
+		});
+	}
+}
+
+/**
+ * @brief 把一条路由从哈希表中去掉，它还在链表中
+ */
+static void wvErase(myNode* node) {
+	const RoutingTableEntry* entry = node->entry;
+	uint32_t len = entry->len;
+	if (len == 0) {
+		wv_default = NULL;
+		wvUnder(0, 0, [&](WvSlot &slot) {
+			if (slot.bmp == entry) {
+				slot.bmp = NULL;
+			}
+		});
+		return;
+	}
+	uint32_t prefix = wvPrefix(*entry);
+	// 原来匹配到它的表项改为匹配比它短的
+	const RoutingTableEntry* cover = wvBest(prefix, len - 1);
+	wvUnder(prefix, len, [&](WvSlot &under) {
+		if (under.bmp == entry) {
+			under.bmp = cover;
+		}
+	});
+	uint32_t l = wv_root;
+	while (l != 0 && l != len) {
+		if (l > len) {
+			l = wv_left[l];
+			continue;
+		}
+		WvSlot* slot = wvFind(l, prefix & wvMask(l));
+		if (--slot->markers == 0 && !wvHasRoute(slot, l)) {
+			wvRemove(l, slot);
+		}
+		l = wv_right[l];
+	}
+	WvSlot* slot = wvFind(len, prefix);
+	if (slot->markers == 0) {
+		wvRemove(len, slot);
+	} else {
+		slot->bmp = cover;
+	}
+}
+
+static bool lenOrder(const myNode* a, const myNode* b) {
+	return a->entry->len < b->entry->len;
+}
+
+// 把 wv_lengths[i, j) 按 plan 中的选择接成高不超过 depth 的子树，返回子树的根
+static uint32_t wvLink(const std::vector<uint32_t> &plan, uint32_t depth, uint32_t i, uint32_t j, uint32_t shorter) {
+	if (i == j) {
+		return 0;
+	}
+	uint32_t r = plan[(depth * 33 + i) * 33 + j];
+	uint32_t len = wv_lengths[r];
+	wv_parent[len] = shorter;
+	wv_left[len] = wvLink(plan, depth - 1, i, r, shorter);
+	wv_right[len] = wvLink(plan, depth - 1, r + 1, j, len);
+	return len;
+}
+
+/**
+ * @brief 按各长度的路由条数排树的形状
+ *
+ * 区间动态规划：wv_lengths[i, j) 排成高不超过 d 的树时，每种长度的深度乘上
+ * 路由条数加一的和最小。树高限制为平衡时加一，最坏情况的探测次数不会变多太多。
+ */
+static void wvPlan() {
+	uint32_t n = wv_n;
+	uint32_t depth = 0;
+	while ((1u << depth) - 1 < n) {
+		depth++;
+	}
+	depth++;
+	uint64_t weight[33];
+	weight[0] = 0;
+	for (uint32_t k = 0; k < n; k++) {
+		weight[k + 1] = weight[k] + wv_count[wv_lengths[k]] + 1;
+	}
+	const uint64_t INF = ~(uint64_t)0;
+	std::vector<uint64_t> cost((depth + 1) * 33 * 33, INF);
+	std::vector<uint32_t> plan((depth + 1) * 33 * 33, 0);
+	for (uint32_t d = 0; d <= depth; d++) {
+		for (uint32_t i = 0; i <= n; i++) {
+			cost[(d * 33 + i) * 33 + i] = 0;
+		}
+		if (d == 0) {
+			continue;
+		}
+		for (uint32_t size = 1; size <= n; size++) {
+			for (uint32_t i = 0; i + size <= n; i++) {
+				uint32_t j = i + size;
+				uint64_t &best = cost[(d * 33 + i) * 33 + j];
+				for (uint32_t r = i; r < j; r++) {
+					uint64_t left = cost[((d - 1) * 33 + i) * 33 + r];
+					uint64_t right = cost[((d - 1) * 33 + r + 1) * 33 + j];
+					if (left == INF || right == INF) {
+						continue;
+					}
+					if (left + right + weight[j] - weight[i] < best) {
+						best = left + right + weight[j] - weight[i];
+						plan[(d * 33 + i) * 33 + j] = r;
+					}
+				}
+			}
+		}
+	}
+	memset(wv_left, 0, sizeof(wv_left));
+	memset(wv_right, 0, sizeof(wv_right));
+	memset(wv_parent, 0, sizeof(wv_parent));
+	wv_root = wvLink(plan, depth, 0, n, 0);
+}
+
+/**
+ * @brief 按现在的长度重新排树的形状，所有路由从短到长重新插入
+ */
+static void wvRebuild() {
+	wv_n = 0;
+	for (uint32_t len = 1; len < 32; len++) {
+		WvTable &table = wv_tables[len];
+		if (table.slots != NULL) {
+			memset(table.slots, 0, table.capacity * sizeof(WvSlot));
+			table.count = 0;
+		}
+		// 表曾经建过的长度也留下，删掉又加回来的路由不会每次都引起重建
+		if (wv_count[len] > 0 || table.slots != NULL) {
+			wv_lengths[wv_n++] = len;
+		}
+	}
+	wvPlan();
+	wv_default = NULL;
+	std::vector<myNode*> nodes;
+	nodes.reserve(route_count);
+	for (myNode* temp = start; temp != NULL; temp = temp->next) {
+		// 主机路由在自己的表中，不受树的形状影响
+		if (temp->entry->len < 32) {
+			nodes.push_back(temp);
+		}
+	}
+	// 短的先插入，之后的标记算 bmp 时它们已经在表中，更长的表项还不存在
+	std::stable_sort(nodes.begin(), nodes.end(), lenOrder);
+	for (size_t i = 0; i < nodes.size(); i++) {
+		wvInsert(nodes[i], false);
+	}
+}
+
+static bool wvHasLength(uint32_t len) {
+	return len == 0 || wv_tables[len].slots != NULL;
+}
+
+// addr 和 len 都相同的路由
+static myNode* findRoute(const RoutingTableEntry &entry) {
+	if (entry.len == 0) {
+		return wv_default;
+	}
+	if (entry.len == 32) {
+		HostSlot* slot = hostFind(ntohl(entry.addr));
+		return slot ? nodeOf(slot->entry) : NULL;
+	}
+	WvSlot* slot = wvFind(entry.len, wvPrefix(entry));
+	if (slot == NULL || !wvHasRoute(slot, entry.len)) {
+		return NULL;
+	}
+	return nodeOf(slot->bmp);
+}
+
 bool query(uint32_t addr, uint32_t *nexthop, uint32_t *if_index);
 
 bool update(bool insert, RoutingTableEntry entry) {
 	// TODO:
+	if (entry.len > 32) {
+		return false;
+	}
+	myNode* found = findRoute(entry);
 	if (insert) {
-		// 插入
-		myNode* temp = new myNode;
-		RoutingTableEntry* entry_temp = new RoutingTableEntry;
-		entry_temp->addr = entry.addr;
-		entry_temp->len = entry.len;
-		entry_temp->if_index = entry.if_index;
-		entry_temp->nexthop = entry.nexthop;
-		entry_temp->metric = entry.metric;
-		entry_temp->time_stamp = entry.time_stamp;
-		temp->entry = entry_temp;
-		temp->next = NULL;
-		if (start == NULL) {
-			start = temp;
+		// 已有相同的 addr 和 len 则替换，哈希表中指向它的 bmp 不变
+		if (found != NULL) {
+			found->entry->if_index = entry.if_index;
+			found->entry->nexthop = entry.nexthop;
+			found->entry->metric = entry.metric;
+			found->entry->time_stamp = entry.time_stamp;
+			found->entry->group = entry.group;
+			return true;
+		}
+		// 添加
+		myNode* temp = newNode(entry);
+		if (temp == NULL) {
+			return false;
+		}
+		linkNode(temp);
+		route_count++;
+		if (entry.len == 32) {
+			hostAdd(temp->entry);
 			return true;
+		}
+		wv_count[entry.len]++;
+		if (wvHasLength(entry.len)) {
+			wvInsert(temp, true);
 		} else {
-			myNode * temp2 = start;
-			while(temp2 != NULL) {
-				if (temp2->entry->addr == entry.addr && temp2->entry->len == entry.len && temp2->entry->metric > entry.metric) {
-					// 替换
-					temp2->entry->if_index = entry.if_index;
-					temp2->entry->nexthop = entry.nexthop;
-					temp2->entry->metric = entry.metric;
-					temp2->entry->time_stamp = entry.time_stamp;
-					return true;
-					break;
-				} else {
-					temp2 = temp2->next;
-				}
-			}
-			uint32_t* nhop, *iindex;
-			if (!query(entry.addr, nhop, iindex)) {
-				// 	添加
-				temp->next = start;
-				start = temp;
-				return true;
-			} else {
-				// 不更新
-				return false;
-			}
+			wvRebuild();
 		}
+		return true;
 	} else {
 		// 删除
-		if (start->entry->addr == entry.addr && start->entry->len == entry.len) {
-			myNode* del = start;
-			start = start->next;
-			delete del;
+		if (found == NULL) {
+			return false;
+		}
+		if (entry.len == 32) {
+			hostRemove(hostFind(ntohl(entry.addr)));
 		} else {
-			myNode * temp = start;
-			myNode * next = temp->next;
-			while (next != NULL) {
-				if (next->entry->addr == entry.addr && next->entry->len == entry.len) {
-					temp->next = next->next;
-					delete next;
-					break;
-				} else {
-					temp = next;
-					next = next->next;
-				}
-			}
+			wvErase(found);
+			wv_count[entry.len]--;
+		}
+		unlinkNode(found);
+		deleteNode(found);
+		route_count--;
+		return true;
+	}
+}
+
+static bool bulkOrder(const RoutingTableEntry &a, const RoutingTableEntry &b) {
+	if (a.len != b.len) {
+		return a.len > b.len;
+	}
+	return a.addr < b.addr;
+}
+
+/**
+ * @brief 用一组表项整体重建路由表，用于启动或控制面重启时一次装入大量路由
+ * @param entries 表项数组，顺序任意，可以有 addr 和 len 都相同的表项
+ * @param count 表项数
+ * @return 装入后路由表中的表项数
+ *
+ * 原有的表项全部丢弃。addr 和 len 都相同的表项只保留最后一条，
+ * 和逐条 update 的替换规则一致。
+ * 先排序去重，再从后往前一次串成链表，最后一次建好哈希表，
+ * 总共 O(N log N) 。
+ */
+uint32_t bulkLoad(const RoutingTableEntry *entries, uint32_t count) {
+	// 原有的节点和哈希表一次全部释放，新的从 arena 的开头依次排列
+	start = NULL;
+	route_count = 0;
+	memset(wv_tables, 0, sizeof(wv_tables));
+	memset(wv_count, 0, sizeof(wv_count));
+	memset(&host_table, 0, sizeof(host_table));
+	if (table_arena != NULL) {
+		HAL_ArenaReset(table_arena);
+	}
+
+	std::vector<RoutingTableEntry> sorted;
+	sorted.reserve(count);
+	for (uint32_t i = 0; i < count; i++) {
+		if (entries[i].len <= 32) {
+			sorted.push_back(entries[i]);
+		}
+	}
+	// 稳定排序，重复的表项保持原来的先后，后来的覆盖先来的
+	std::stable_sort(sorted.begin(), sorted.end(), bulkOrder);
+	size_t n = 0;
+	for (size_t i = 0; i < sorted.size(); i++) {
+		if (n > 0 && sorted[i].addr == sorted[n - 1].addr && sorted[i].len == sorted[n - 1].len) {
+			sorted[n - 1] = sorted[i];
+		} else {
+			sorted[n++] = sorted[i];
 		}
 	}
+
+	// 链表按前缀长度从长到短
+	for (size_t i = n; i > 0; i--) {
+		myNode* temp = newNode(sorted[i - 1]);
+		if (temp == NULL) {
+			break;
+		}
+		linkNode(temp);
+		route_count++;
+		if (temp->entry->len == 32) {
+			hostAdd(temp->entry);
+		} else {
+			wv_count[temp->entry->len]++;
+		}
+	}
+	wvRebuild();
+	return route_count;
+}
+
+/**
+ * 路由表中的表项数
+ */
+uint32_t routeCount() {
+	return route_count;
+}
+
+/**
+ * @brief 进行一次路由表的查询，按照最长前缀匹配原则
+ * @param addr 需要查询的目标地址，大端序
+ * @param entry 如果查询到目标，把匹配的表项写入
+ * @return 查到则返回 true ，没查到则返回 false
+ */
+bool queryEntry(uint32_t addr, RoutingTableEntry *entry) {
+	uint32_t host = ntohl(addr);
+	// 主机路由总是最长的，查到就不用再看更短的前缀
+	const HostSlot* slot = hostFind(host);
+	const RoutingTableEntry* best = slot ? slot->entry : wvBest(host, 31);
+	if (best == NULL) {
+		return false;
+	}
+	*entry = *best;
+	return true;
 }
 
 /**
@@ -116,66 +794,61 @@ bool update(bool insert, RoutingTableEntry entry) {
  */
 bool query(uint32_t addr, uint32_t *nexthop, uint32_t *if_index) {
 	// TODO:
-	bool res = false;
-	uint32_t len = 0;
-	myNode* temp = start;
-	while (temp != NULL) {
-		if ((addr << (32 - temp->entry->len)) == ((temp->entry->addr) << (32 - temp->entry->len))) {
-			if (temp->entry->len > len) {
-				len = temp->entry->len;
-				*nexthop = temp->entry->nexthop;
-				*if_index = temp->entry->if_index;
-				res = true;
-			}
-		}
-		temp = temp->next;
+	RoutingTableEntry entry;
+	if (!queryEntry(addr, &entry)) {
+		return false;
 	}
-	return res;
+	*nexthop = entry.nexthop;
+	*if_index = entry.if_index;
+	return true;
 }
 
 /**
- * 构造rippacket结构体
+ * @brief 构造发往 if_index 的 RIP response 中的一个报文，最多 RIP_MAX_ENTRY 项
+ * @param cursor 第一次调用前置为 NULL ，之后原样传回，记录下一个报文从哪里开始
+ * @return 还有表项没有放进报文时返回 true ，用同一个 cursor 再调用一次
+ *
+ * 整张表的一次通告由连续的几次调用组成，期间不能修改路由表。
  */
-void genRipPack(uint32_t if_index, RipPacket* rip) {
+bool genRipPack(uint32_t if_index, RipPacket* rip, const void** cursor) {
 	rip->numEntries = 0;
 	rip->command = 0;
-	myNode * temp = start;
-	while (temp != NULL) {
-		// 水平分割
-		if (temp->entry->if_index != if_index) {
+	const myNode* temp = *cursor != NULL ? (const myNode*)*cursor : start;
+	while (temp != NULL && rip->numEntries < RIP_MAX_ENTRY) {
+		// 带毒性逆转的水平分割：从 if_index 学到的路由以 metric 16 通告回去，
+		// 邻居就不会留着经过自己的旧路由；直连路由两边都有，不用通告
+		if (temp->entry->if_index != if_index || temp->entry->nexthop != 0) {
 			rip->entries[rip->numEntries].addr = temp->entry->addr;
 			rip->entries[rip->numEntries].nexthop = temp->entry->nexthop;
-			rip->entries[rip->numEntries].mask = ((unsigned int)0xffffffff) >> (32 - temp->entry->len);
-			rip->entries[rip->numEntries].metric = change_endian(change_endian(temp->entry->metric) + 1) ;
+			rip->entries[rip->numEntries].mask = htonl(wvMask(temp->entry->len));
+			if (temp->entry->if_index == if_index) {
+				rip->entries[rip->numEntries].metric = change_endian(16);
+			} else {
+				rip->entries[rip->numEntries].metric = change_endian(change_endian(temp->entry->metric) + 1) ;
+			}
 
 			rip->numEntries++;
 		}
 		
 		temp = temp->next;
 	}
+	// 剩下的都被水平分割掉时就不用再发一个空报文
+	while (temp != NULL && temp->entry->if_index == if_index && temp->entry->nexthop == 0) {
+		temp = temp->next;
+	}
+	*cursor = temp;
+	return temp != NULL;
 }
 
-void printTable() {
+/**
+ * 把路由表复制到 output 中，最多 max 项，返回复制的项数
+ */
+uint32_t snapshotTable(RoutingTableEntry *output, uint32_t max) {
+	uint32_t n = 0;
 	myNode * temp = start;
-	while (temp != NULL) {
-		printf("%d.%d.%d.%d/%d ", temp->entry->addr & 0xff, (temp->entry->addr >> 8) & 0xff, (temp->entry->addr >> 16) & 0xff, (temp->entry->addr >> 24) & 0xff, temp->entry->len);
-		if (temp->entry->nexthop != 0) {
-			printf("via %d.%d.%d.%d ", temp->entry->nexthop & 0xff, (temp->entry->nexthop >> 8) & 0xff, (temp->entry->nexthop >> 16) & 0xff, (temp->entry->nexthop >> 24) & 0xff);
-		}
-		if (temp->entry->if_index == 0) {
-			printf("dev r2r1 ");
-		}
-		else if (temp->entry->if_index == 1) {
-			printf("dev r2r3 ");
-		}
-		else {
-			printf("dev eth%d ", temp->entry->if_index + 1);
-		}
-		
-		if (temp->entry->nexthop == 0) {
-			printf("scope link");
-		}
-		printf("\n");
+	while (temp != NULL && n < max) {
+		output[n++] = *temp->entry;
 		temp = temp->next;
 	}
+	return n;
 }
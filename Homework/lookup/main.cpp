@@ -1,39 +1,288 @@
 #include "router_hal.h"
 #include "router.h"
+#include <fcntl.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
 
-extern void update(bool insert, RoutingTableEntry entry);
+extern bool update(bool insert, RoutingTableEntry entry);
 extern bool query(uint32_t addr, uint32_t *nexthop, uint32_t *if_index);
-char buffer[1024];
+extern uint32_t bulkLoad(const RoutingTableEntry *entries, uint32_t count);
+
+// 输入可以是文本格式：每行一个操作
+//   I,<addr>,<len>,<if_index>,<nexthop>
+//   D,<addr>,<len>
+//   Q,<addr>
+// 也可以是二进制格式：8 字节的 TRACE_MAGIC 之后是若干个 TraceRecord 。
+// 用 ./lookup -c < 文本 > 二进制 可以把文本格式转换成二进制格式。
+// 用 ./lookup -b 运行时，开头连续的插入操作一次用 bulkLoad 装入。
+const char TRACE_MAGIC[8] = {'L', 'K', 'T', 'R', 'A', 'C', 'E', '1'};
+
+struct TraceRecord {
+  uint8_t op; // 'I' 'D' 'Q'
+  uint8_t len;
+  uint16_t if_index;
+  // 和文本格式中的数值相同，按小端序存放，即网络字节序的 IPv4 地址
+  uint32_t addr;
+  uint32_t nexthop;
+};
+
+const size_t OUTPUT_SIZE = 1 << 20;
+char output[OUTPUT_SIZE];
+size_t output_len = 0;
+int8_t hex_value[256];
+// -b 时还没有装入的开头的插入操作
+bool bulk_pending = false;
+std::vector<RoutingTableEntry> bulk_entries;
+
+static void writeAll(const char *data, size_t len) {
+  size_t done = 0;
+  while (done < len) {
+    ssize_t res = write(STDOUT_FILENO, data + done, len - done);
+    if (res <= 0) {
+      break;
+    }
+    done += res;
+  }
+}
+
+static void flushOutput() {
+  writeAll(output, output_len);
+  output_len = 0;
+}
+
+static void writeOutput(const void *data, size_t len) {
+  if (output_len + len > OUTPUT_SIZE) {
+    flushOutput();
+    if (len > OUTPUT_SIZE) {
+      writeAll((const char *)data, len);
+      return;
+    }
+  }
+  memcpy(output + output_len, data, len);
+  output_len += len;
+}
+
+static void bulkFlush() {
+  if (bulk_pending) {
+    bulkLoad(bulk_entries.data(), bulk_entries.size());
+    bulk_pending = false;
+    std::vector<RoutingTableEntry>().swap(bulk_entries);
+  }
+}
+
+static void runRecord(const TraceRecord &record) {
+  RoutingTableEntry entry = {0};
+  entry.addr = record.addr;
+  entry.len = record.len;
+  if (bulk_pending && record.op == 'I') {
+    entry.if_index = record.if_index;
+    entry.nexthop = record.nexthop;
+    bulk_entries.push_back(entry);
+    return;
+  }
+  bulkFlush();
+  if (record.op == 'I') {
+    entry.if_index = record.if_index;
+    entry.nexthop = record.nexthop;
+    update(true, entry);
+  } else if (record.op == 'D') {
+    update(false, entry);
+  } else if (record.op == 'Q') {
+    uint32_t nexthop, if_index;
+    if (output_len + 32 > OUTPUT_SIZE) {
+      flushOutput();
+    }
+    char *p = output + output_len;
+    if (query(record.addr, &nexthop, &if_index)) {
+      static const char digits[] = "0123456789abcdef";
+      *p++ = '0';
+      *p++ = 'x';
+      for (int shift = 28; shift >= 0; shift -= 4) {
+        *p++ = digits[(nexthop >> shift) & 0xf];
+      }
+      *p++ = ' ';
+      char tmp[10];
+      int n = 0;
+      do {
+        tmp[n++] = '0' + if_index % 10;
+        if_index /= 10;
+      } while (if_index);
+      while (n) {
+        *p++ = tmp[--n];
+      }
+      *p++ = '\n';
+    } else {
+      memcpy(p, "Not Found\n", 10);
+      p += 10;
+    }
+    output_len = p - output;
+  }
+}
+
+// 和 sscanf 的 %x 一样可以有 0x 前缀
+static const char *parseHex(const char *p, const char *end, uint32_t *value) {
+  while (p < end && (*p == ' ' || *p == '\t')) {
+    p++;
+  }
+  if (end - p >= 2 && p[0] == '0' && (p[1] == 'x' || p[1] == 'X')) {
+    p += 2;
+  }
+  uint32_t res = 0;
+  while (p < end && hex_value[(uint8_t)*p] >= 0) {
+    res = (res << 4) | hex_value[(uint8_t)*p];
+    p++;
+  }
+  *value = res;
+  return p;
+}
+
+static const char *parseDec(const char *p, const char *end, uint32_t *value) {
+  while (p < end && (*p == ' ' || *p == '\t')) {
+    p++;
+  }
+  uint32_t res = 0;
+  while (p < end && *p >= '0' && *p <= '9') {
+    res = res * 10 + (*p - '0');
+    p++;
+  }
+  *value = res;
+  return p;
+}
+
+static const char *skipComma(const char *p, const char *end) {
+  while (p < end && *p != ',' && *p != '\n') {
+    p++;
+  }
+  return p < end && *p == ',' ? p + 1 : p;
+}
+
+// 解析一行，返回下一行的开头
+static const char *parseLine(const char *p, const char *end,
+                             TraceRecord *record) {
+  record->op = 0;
+  if (p < end && (*p == 'I' || *p == 'D' || *p == 'Q')) {
+    uint32_t value = 0;
+    record->op = *p;
+    p = parseHex(skipComma(p, end), end, &record->addr);
+    record->len = 0;
+    record->if_index = 0;
+    record->nexthop = 0;
+    if (record->op != 'Q') {
+      p = parseDec(skipComma(p, end), end, &value);
+      record->len = value;
+    }
+    if (record->op == 'I') {
+      p = parseDec(skipComma(p, end), end, &value);
+      record->if_index = value;
+      p = parseHex(skipComma(p, end), end, &record->nexthop);
+    }
+  }
+  const char *newline = (const char *)memchr(p, '\n', end - p);
+  return newline ? newline + 1 : end;
+}
 
 int main(int argc, char *argv[]) {
-  uint32_t addr, len, if_index, nexthop;
-  char tmp;
-  while (fgets(buffer, sizeof(buffer), stdin)) {
-    if (buffer[0] == 'I') {
-      sscanf(buffer, "%c,%x,%d,%d,%x", &tmp, &addr, &len, &if_index, &nexthop);
-      RoutingTableEntry entry = {
-          .addr = addr, .len = len, .if_index = if_index, .nexthop = nexthop};
-      update(true, entry);
-    } else if (buffer[0] == 'D') {
-      sscanf(buffer, "%c,%x,%d", &tmp, &addr, &len);
-      RoutingTableEntry entry = {
-        .addr = addr,
-        .len = len,
-        .if_index = 0,
-        .nexthop = 0
-      };
-      update(false, entry);
-    } else if (buffer[0] == 'Q') {
-      sscanf(buffer, "%c,%x", &tmp, &addr);
-      if (query(addr, &nexthop, &if_index)) {
-        printf("0x%08x %d\n", nexthop, if_index);
+  bool convert = false;
+  int arg = 1;
+  for (; arg < argc && argv[arg][0] == '-' && argv[arg][1]; arg++) {
+    if (strcmp(argv[arg], "-c") == 0) {
+      convert = true;
+    } else if (strcmp(argv[arg], "-b") == 0) {
+      bulk_pending = true;
+    } else {
+      fprintf(stderr, "Usage: %s [-c] [-b] [file]\n", argv[0]);
+      return 1;
+    }
+  }
+  memset(hex_value, -1, sizeof(hex_value));
+  for (int i = 0; i < 10; i++) {
+    hex_value['0' + i] = i;
+  }
+  for (int i = 0; i < 6; i++) {
+    hex_value['a' + i] = hex_value['A' + i] = 10 + i;
+  }
+
+  // 普通文件直接 mmap ，管道则全部读进内存
+  int fd = STDIN_FILENO;
+  if (arg < argc) {
+    fd = open(argv[arg], O_RDONLY);
+    if (fd < 0) {
+      perror("open");
+      return 1;
+    }
+  }
+  const char *data = NULL;
+  size_t size = 0;
+  struct stat st;
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+    off_t offset = lseek(fd, 0, SEEK_CUR);
+    if (offset < 0) {
+      offset = 0;
+    }
+    size = st.st_size - offset;
+    if (size > 0) {
+      void *addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (addr == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+      }
+      madvise(addr, st.st_size, MADV_SEQUENTIAL);
+      data = (const char *)addr + offset;
+    }
+  } else {
+    size_t capacity = 1 << 20;
+    char *buffer = (char *)malloc(capacity);
+    ssize_t res;
+    while (buffer && (res = read(fd, buffer + size, capacity - size)) > 0) {
+      size += res;
+      if (size == capacity) {
+        capacity *= 2;
+        buffer = (char *)realloc(buffer, capacity);
+      }
+    }
+    data = buffer;
+  }
+  const char *end = data + size;
+
+  if (size >= sizeof(TRACE_MAGIC) &&
+      memcmp(data, TRACE_MAGIC, sizeof(TRACE_MAGIC)) == 0) {
+    const char *p = data + sizeof(TRACE_MAGIC);
+    size_t count = (end - p) / sizeof(TraceRecord);
+    if (convert) {
+      // 已经是二进制格式
+      writeOutput(data, sizeof(TRACE_MAGIC) + count * sizeof(TraceRecord));
+    } else {
+      for (size_t i = 0; i < count; i++) {
+        TraceRecord record;
+        memcpy(&record, p + i * sizeof(TraceRecord), sizeof(TraceRecord));
+        runRecord(record);
+      }
+    }
+  } else {
+    if (convert) {
+      writeOutput(TRACE_MAGIC, sizeof(TRACE_MAGIC));
+    }
+    const char *p = data;
+    while (p < end) {
+      TraceRecord record;
+      p = parseLine(p, end, &record);
+      if (record.op == 0) {
+        continue;
+      }
+      if (convert) {
+        writeOutput(&record, sizeof(record));
       } else {
-        printf("Not Found\n");
+        runRecord(record);
       }
     }
   }
+  bulkFlush();
+  flushOutput();
   return 0;
-}
\ No newline at end of file
+}
@@ -1,3 +1,6 @@
+#ifndef __ROUTER_H__
+#define __ROUTER_H__
+
 #include <stdint.h>
 typedef struct {
     uint32_t addr;
@@ -6,4 +9,7 @@ typedef struct {
     uint32_t nexthop;
     uint32_t metric;
     uint64_t time_stamp;
-} RoutingTableEntry;
\ No newline at end of file
+    uint32_t group; // ECMP 组的编号，0 表示只有这一条路径，见 boilerplate/ecmp.h
+} RoutingTableEntry;
+
+#endif
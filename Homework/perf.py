@@ -0,0 +1,257 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+
+# 各个 grade.py 的性能评测模式：python3 grade.py --perf
+#
+# 在逐渐增大的输入上运行程序（lookup 是路由条数，其余是报文个数），
+# 记录运行时间、内存峰值和每秒处理的操作数，用 log-log 线性回归拟合
+# 时间随规模增长的指数。最大规模下的吞吐量低于 --min-ops，或者指数
+# 超过 --max-exponent 时评测失败。某个规模超时后不再尝试更大的规模。
+#
+# lookup 的输入是随机生成的路由表加同样多的查询，和 Datagen 的 routes
+# 生成的一样：编译过 Datagen 时直接调用它，否则用下面移植的同一个算法，
+# 前缀长度的分布都来自 Datagen/prefix_lengths.txt 。其余题目的输入是把
+# data 目录下的报文重复到指定的个数。
+
+import argparse
+import bisect
+import glob
+import itertools
+import json
+import math
+import os
+import random
+import struct
+import subprocess
+import sys
+import tempfile
+import time
+
+# 默认参数：规模、最大规模的吞吐量下限（每秒操作数）
+DEFAULTS = {
+    'lookup': ([1000, 10000, 100000, 1000000], 1000000),
+    'checksum': ([10000, 100000, 1000000], 1000000),
+    'forwarding': ([10000, 100000, 1000000], 1000000),
+    'protocol': ([10000, 100000, 1000000], 500000),
+}
+
+DATAGEN = os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', 'Datagen')
+
+
+def prefix_lengths(profile):
+    """Datagen/prefix_lengths.txt 中的 [(前缀长度, 权重)]"""
+    lengths = []
+    with open(os.path.join(DATAGEN, 'prefix_lengths.txt')) as f:
+        for line in f:
+            fields = line.split()
+            if len(fields) == 3 and fields[0] == profile:
+                lengths.append((int(fields[1]), int(fields[2])))
+    return lengths
+
+
+def mask(length):
+    return (0xffffffff << (32 - length)) & 0xffffffff
+
+
+def trace(addr):
+    """lookup 的输入中地址按大端序存放，当作一个数输出"""
+    return struct.unpack('<I', struct.pack('>I', addr))[0]
+
+
+def generate(rng, count, lengths, nested=0.3):
+    """Datagen/src/routes.rs 中的 generate ：按权重抽前缀长度，以 nested 的概率
+    取之前某个前缀的更具体的前缀，返回 [(前缀, 长度)]，主机序"""
+    total = sum(weight for _, weight in lengths)
+    seen = set()
+    routes = []
+    while len(routes) < count:
+        pick = rng.randrange(total)
+        length = lengths[-1][0]
+        for l, weight in lengths:
+            if pick < weight:
+                length = l
+                break
+            pick -= weight
+        addr = None
+        if routes and rng.random() < nested:
+            for _ in range(8):
+                outer, outer_len = routes[rng.randrange(len(routes))]
+                if outer_len < length:
+                    addr = (outer | rng.getrandbits(32 - outer_len)) & mask(length)
+                    break
+        if addr is None:
+            addr = rng.getrandbits(32) & mask(length)
+        first = addr >> 24
+        if first in (0, 10, 127) or first >= 224 or (addr, length) in seen:
+            continue
+        seen.add((addr, length))
+        routes.append((addr, length))
+    return routes
+
+
+def datagen_routes():
+    for build in ('release', 'debug'):
+        exe = os.path.join(DATAGEN, 'target', build, 'routes')
+        if os.access(exe, os.X_OK):
+            return exe
+    return None
+
+
+def lookup_input(path, routes, rng):
+    """写入 routes 条路由和同样多的查询，返回操作数"""
+    exe = datagen_routes()
+    if exe is not None:
+        subprocess.check_call([exe, 'perf', str(routes), '--seed', str(rng.getrandbits(63))],
+                              cwd=os.path.dirname(path), stdout=subprocess.DEVNULL)
+        os.replace(os.path.join(os.path.dirname(path), 'lookup_inputperf.in'), path)
+        os.unlink(os.path.join(os.path.dirname(path), 'lookup_outputperf.out'))
+        return 2 * routes
+
+    # 和 routes 的默认参数相同：4 个网口各一个邻居 10.0.if.2 ，查询的目的地址
+    # 按 Zipf(1.0) 落在随机排列的路由中，5% 查不到
+    prefixes = generate(rng, routes, prefix_lengths('bgp'))
+    rng.shuffle(prefixes)
+    popular = list(range(routes))
+    rng.shuffle(popular)
+    cdf = list(itertools.accumulate(1.0 / (rank + 1) for rank in range(routes)))
+    with open(path, 'w') as f:
+        for addr, length in prefixes:
+            if_index = rng.randrange(4)
+            f.write('I,0x{:08x},{},{},0x{:08x}\n'.format(
+                trace(addr), length, if_index, trace(0x0a000002 | if_index << 8)))
+        for _ in range(routes):
+            if rng.random() < 0.05:
+                addr = 0xf0000000 | rng.getrandbits(28)
+            else:
+                rank = min(bisect.bisect_left(cdf, rng.random() * cdf[-1]), routes - 1)
+                addr, length = prefixes[popular[rank]]
+                addr |= rng.getrandbits(32 - length) if length < 32 else 0
+            f.write('Q,0x{:08x}\n'.format(trace(addr)))
+    return 2 * routes
+
+
+def read_pcap(path):
+    data = open(path, 'rb').read()
+    magic = data[:4]
+    endian = '<' if magic in (b'\xd4\xc3\xb2\xa1', b'\x4d\x3c\xb2\xa1') else '>'
+    frames = []
+    offset = 24
+    while offset + 16 <= len(data):
+        _, _, caplen, length = struct.unpack(endian + 'IIII', data[offset:offset + 16])
+        frames.append(data[offset + 16:offset + 16 + caplen])
+        offset += 16 + caplen
+    return frames
+
+
+def pcap_input(path, prefix, packets):
+    frames = []
+    for name in sorted(glob.glob('data/{}_input*.pcap'.format(prefix))):
+        frames += read_pcap(name)
+    records = [struct.pack('<IIII', 0, 0, len(frame), len(frame)) + frame for frame in frames]
+    with open(path, 'wb') as f:
+        f.write(struct.pack('<IHHiIII', 0xa1b2c3d4, 2, 4, 0, 0, 0x40000, 1))
+        # 一次写出一批，重复到 packets 个
+        batch = b''.join(records)
+        for _ in range(packets // len(records)):
+            f.write(batch)
+        f.write(b''.join(records[:packets % len(records)]))
+    return packets
+
+
+def run(exe, in_file, timeout):
+    """返回 (运行时间, 内存峰值 KB, 退出码)，超时的退出码为 None"""
+    start = time.monotonic()
+    p = subprocess.Popen(['./{}'.format(exe)], stdin=open(in_file, 'rb'),
+                         stdout=subprocess.DEVNULL)
+    while True:
+        pid, status, usage = os.wait4(p.pid, os.WNOHANG)
+        if pid != 0:
+            break
+        if time.monotonic() - start > timeout:
+            p.kill()
+            os.wait4(p.pid, 0)
+            return timeout, 0, None
+        time.sleep(0.005)
+    wall = time.monotonic() - start
+    # Linux 上 ru_maxrss 的单位是 KB ，macOS 上是字节
+    rss = usage.ru_maxrss // 1024 if sys.platform == 'darwin' else usage.ru_maxrss
+    return wall, rss, os.waitstatus_to_exitcode(status) if hasattr(
+        os, 'waitstatus_to_exitcode') else status >> 8
+
+
+def fit(sizes, times):
+    """log(time) = k * log(size) + b 中的 k"""
+    xs = [math.log(s) for s in sizes]
+    ys = [math.log(max(t, 1e-6)) for t in times]
+    mx = sum(xs) / len(xs)
+    my = sum(ys) / len(ys)
+    sxx = sum((x - mx) ** 2 for x in xs)
+    if sxx == 0:
+        return None
+    return sum((x - mx) * (y - my) for x, y in zip(xs, ys)) / sxx
+
+
+def main(prefix, argv):
+    sizes, min_ops = DEFAULTS[prefix]
+    parser = argparse.ArgumentParser(prog='grade.py --perf')
+    parser.add_argument('exe', nargs='?', default=prefix)
+    parser.add_argument('--sizes', default=','.join(str(s) for s in sizes),
+                        help='comma separated sizes, routes for lookup and packets otherwise')
+    parser.add_argument('--min-ops', type=float, default=min_ops,
+                        help='operations per second required at the largest size')
+    parser.add_argument('--max-exponent', type=float, default=1.25,
+                        help='largest acceptable growth exponent of the running time')
+    parser.add_argument('--timeout', type=float, default=60, help='seconds for each size')
+    parser.add_argument('--seed', type=int, default=1)
+    args = parser.parse_args(argv)
+
+    tty = os.isatty(1)
+    rng = random.Random(args.seed)
+    results = []
+    with tempfile.TemporaryDirectory() as tmp:
+        for size in [int(s) for s in args.sizes.split(',')]:
+            if prefix == 'lookup':
+                in_file = os.path.join(tmp, 'input.in')
+                ops = lookup_input(in_file, size, rng)
+            else:
+                in_file = os.path.join(tmp, 'input.pcap')
+                ops = pcap_input(in_file, prefix, size)
+            wall, rss, code = run(args.exe, in_file, args.timeout)
+            os.unlink(in_file)
+            result = {'size': size, 'ops': ops, 'wall': wall, 'ops_per_sec': ops / wall,
+                      'peak_rss_kb': rss, 'timeout': code is None, 'exit': code}
+            results.append(result)
+            if tty:
+                print('{:>10} {:>10} ops {:>9.3f} s {:>12.0f} ops/s {:>8.1f} MB{}'.format(
+                    size, ops, wall, ops / wall, rss / 1024.0,
+                    '  timeout' if code is None else ''))
+            if code is None:
+                break
+
+    finished = [r for r in results if not r['timeout']]
+    exponent = fit([r['ops'] for r in finished], [r['wall'] for r in finished]) \
+        if len(finished) >= 2 else None
+    failures = []
+    if any(r['timeout'] for r in results):
+        failures.append('timed out at size {}'.format(results[-1]['size']))
+    if any(r['exit'] not in (0, None) for r in results):
+        failures.append('exited with an error')
+    last = results[-1]
+    if not last['timeout'] and last['ops_per_sec'] < args.min_ops:
+        failures.append('{:.0f} ops/s at size {} is below {:.0f}'.format(
+            last['ops_per_sec'], last['size'], args.min_ops))
+    if exponent is not None and exponent > args.max_exponent:
+        failures.append('time grows as size^{:.2f}, more than size^{:.2f}'.format(
+            exponent, args.max_exponent))
+
+    if tty:
+        if exponent is not None:
+            print('Running time grows as size^{:.2f}'.format(exponent))
+        for failure in failures:
+            print('Failed: ' + failure)
+        if not failures:
+            print('Passed')
+    else:
+        print(json.dumps({'perf': results, 'exponent': exponent,
+                          'passed': not failures, 'failures': failures}))
+    sys.exit(1 if failures else 0)
@@ -3,6 +3,8 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <unistd.h>
 
 extern bool disassemble(const uint8_t *packet, uint32_t len, RipPacket *output);
 extern uint32_t assemble(const RipPacket *rip, uint8_t *buffer);
@@ -11,6 +13,40 @@ uint8_t packet[2048];
 RipPacket rip;
 in_addr_t addrs[N_IFACE_ON_BOARD] = {0};
 
+// 输出攒成一大块再写，逐字节 printf 比解析本身慢得多
+const size_t OUTPUT_SIZE = 1 << 20;
+char output[OUTPUT_SIZE];
+size_t output_len = 0;
+
+static void flushOutput() {
+  size_t done = 0;
+  while (done < output_len) {
+    ssize_t res = write(STDOUT_FILENO, output + done, output_len - done);
+    if (res <= 0) {
+      break;
+    }
+    done += res;
+  }
+  output_len = 0;
+}
+
+// 保证之后能再写入 len 字节
+static char *reserveOutput(size_t len) {
+  if (output_len + len > OUTPUT_SIZE) {
+    flushOutput();
+  }
+  return output + output_len;
+}
+
+// 小写十六进制，固定 digits 位
+static char *writeHex(char *p, uint32_t value, int digits) {
+  static const char hex[] = "0123456789abcdef";
+  for (int shift = (digits - 1) * 4; shift >= 0; shift -= 4) {
+    *p++ = hex[(value >> shift) & 0xf];
+  }
+  return p;
+}
+
 int main(int argc, char *argv[]) {
   int res = HAL_Init(0, addrs);
   if (res < 0) {
@@ -26,21 +62,37 @@ int main(int argc, char *argv[]) {
     if (res == HAL_ERR_EOF) {
       break;
     } else if (res < 0) {
+      flushOutput();
       return res;
     }
     if (disassemble(packet, res, &rip)) {
-      printf("Valid %d %d\n", rip.numEntries, rip.command);
-      for (int i = 0;i < rip.numEntries;i++) {
-        printf("%08x %08x %08x %08x\n", rip.entries[i].addr, rip.entries[i].mask, rip.entries[i].nexthop, rip.entries[i].metric);
+      // 最多 25 项，"Valid" 行不超过 32 字节
+      char *p = reserveOutput(32 + RIP_MAX_ENTRY * 36);
+      p += sprintf(p, "Valid %d %d\n", rip.numEntries, rip.command);
+      for (int i = 0; i < rip.numEntries; i++) {
+        p = writeHex(p, rip.entries[i].addr, 8);
+        *p++ = ' ';
+        p = writeHex(p, rip.entries[i].mask, 8);
+        *p++ = ' ';
+        p = writeHex(p, rip.entries[i].nexthop, 8);
+        *p++ = ' ';
+        p = writeHex(p, rip.entries[i].metric, 8);
+        *p++ = '\n';
       }
+      output_len = p - output;
       uint32_t len = assemble(&rip, buffer);
-      for (uint32_t i = 0;i < len;i++) {
-        printf("%02x ", buffer[i]);
+      p = reserveOutput(len * 3 + 1);
+      for (uint32_t i = 0; i < len; i++) {
+        p = writeHex(p, buffer[i], 2);
+        *p++ = ' ';
       }
-      printf("\n");
+      *p++ = '\n';
+      output_len = p - output;
     } else {
-      printf("Invalid\n");
+      memcpy(reserveOutput(8), "Invalid\n", 8);
+      output_len += 8;
     }
   }
+  flushOutput();
   return 0;
-}
\ No newline at end of file
+}